@@ -0,0 +1,262 @@
+// Group-by aggregation of a file-backed big.matrix, e.g. all.matrix, without R.
+// This is what bigtabulate's bigtsummary() and tapply() do single threaded in R, e.g. the mean ArrDelay
+// by UniqueCarrier by Month, done natively as a parallel scan into dense per-thread accumulators (see group_aggregate.h).
+
+// Each --by=column,... is one grouping, and the aggregate columns are summarized in every group of every grouping,
+// all in a single pass over the matrix, so one read of all.matrix answers a whole report.
+// Without --by the whole matrix is one group. Columns are given by their names or their numbers counted from 1.
+// For every group the report has the row count, and for every aggregate column the count of values that are not missing,
+// the count of missing values, the sum, the mean, the smallest and the largest value.
+// The missing value is -1, as map_fields writes it, unless set with --missing=value.
+// Conditions written column:comparison:value as for query_matrix, e.g. Cancelled:eq:1, restrict the rows aggregated,
+// all of them or with --op=OR any of them.
+// The report is printed as csv, one table per grouping separated by blank lines, or written to --output=report_filename.
+
+// To compile this c++ program on linux:
+//     g++ -W -std=c++17 -O2 -mavx2 -pthread aggregate_matrix.cpp -o aggregate_matrix
+// Run it with:
+//     $ ./aggregate_matrix [--threads N] [--by=column,...]... [--op=AND|OR] [--missing=value] [--output=report_filename] [descriptor_filename] [aggregate_column|condition]...
+// e.g.
+//     $ ./aggregate_matrix --threads 8 --by=UniqueCarrier,Month --by=Origin big_matrices/all.matrix.desc ArrDelay DepDelay
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "group_aggregate.h"
+
+// Write one grouping's table of the report.
+void write_report_table(FILE* report_file, const mapped_big_matrix& matrix, const group_by& grouping, const std::vector<long>& aggregate_columns)
+{
+    for (size_t group_column = 0; group_column < grouping.column_indexes.size(); group_column++)
+    {
+        fprintf(report_file, "%s,", matrix.column_name(grouping.column_indexes[group_column]).c_str());
+    }
+    fputs("Rows", report_file);
+    for (size_t aggregate_index = 0; aggregate_index < aggregate_columns.size(); aggregate_index++)
+    {
+        std::string name = matrix.column_name(aggregate_columns[aggregate_index]);
+        fprintf(report_file, ",%s.count,%s.missing,%s.sum,%s.mean,%s.min,%s.max",
+                name.c_str(), name.c_str(), name.c_str(), name.c_str(), name.c_str(), name.c_str());
+    }
+    fputc('\n', report_file);
+
+    const group_accumulators& totals = grouping.totals;
+    for (long slot = 0; slot < grouping.slot_count; slot++)
+    {
+        if (totals.row_counts[slot] == 0)
+        {
+            continue;
+        }
+        for (size_t group_column = 0; group_column < grouping.column_indexes.size(); group_column++)
+        {
+            fprintf(report_file, "%d,", grouping.group_value(slot, group_column));
+        }
+        fprintf(report_file, "%lld", (long long)totals.row_counts[slot]);
+        for (size_t aggregate_index = 0; aggregate_index < aggregate_columns.size(); aggregate_index++)
+        {
+            size_t index = aggregate_index * grouping.slot_count + slot;
+            long long count = totals.counts[index];
+            fprintf(report_file, ",%lld,%lld,%lld", count, (long long)totals.row_counts[slot] - count, (long long)totals.sums[index]);
+            if (count == 0)
+            {
+                fputs(",NA,NA,NA", report_file);
+                continue;
+            }
+            fprintf(report_file, ",%.4f,%d,%d", double(totals.sums[index]) / count, totals.min_values[index], totals.max_values[index]);
+        }
+        fputc('\n', report_file);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int thread_count = 1;
+    bool any = false;
+    int missing_value = -1;
+    std::vector<std::string> group_specifications;
+    std::string report_file_name;
+    std::vector<char*> arguments;
+    for (int argument_index = 1; argument_index < argc; argument_index++)
+    {
+        std::string argument = argv[argument_index];
+        if (argument == "--threads" && argument_index + 1 < argc)
+        {
+            argument = std::string("--threads=") + argv[++argument_index];
+        }
+        if (argument.compare(0, 10, "--threads=") == 0)
+        {
+            thread_count = atoi(argument.c_str() + 10);
+            if (thread_count < 1)
+            {
+                std::cout << "Invalid thread count: " << argument << std::endl;
+                return 1;
+            }
+        }
+        else if (argument.compare(0, 5, "--by=") == 0)
+        {
+            group_specifications.push_back(argument.substr(5));
+        }
+        else if (argument == "--op=AND" || argument == "--op=OR")
+        {
+            any = argument == "--op=OR";
+        }
+        else if (argument.compare(0, 10, "--missing=") == 0)
+        {
+            missing_value = atoi(argument.c_str() + 10);
+        }
+        else if (argument.compare(0, 9, "--output=") == 0)
+        {
+            report_file_name = argument.substr(9);
+        }
+        else if (argument.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option: " << argument << std::endl;
+            return 1;
+        }
+        else
+        {
+            arguments.push_back(argv[argument_index]);
+        }
+    }
+
+    if (arguments.size() < 1)
+    {
+        std::cout << "Use: ./aggregate_matrix [--threads N] [--by=column,...]... [--op=AND|OR] [--missing=value] [--output=report_filename] [descriptor_filename] [aggregate_column|condition]..." << std::endl;
+        std::cout << " where a condition is column:eq|neq|lt|le|gt|ge:value, e.g. Cancelled:eq:1" << std::endl;
+        return 1;
+    }
+
+    // The progress goes to stderr when the report is printed, so the report alone can be redirected.
+    std::ostream& progress = report_file_name.empty() ? std::cerr : std::cout;
+
+    // Attach the matrix.
+
+    std::chrono::steady_clock::time_point start_clock = std::chrono::steady_clock::now();
+    mapped_big_matrix matrix;
+    std::string error;
+    if (!matrix.open(arguments[0], error))
+    {
+        std::cout << "Invalid descriptor file " << arguments[0] << ": " << error << std::endl;
+        return 1;
+    }
+    progress << "Matrix file path: " << matrix.backing_path() << ", rows: " << matrix.row_count()
+        << ", columns: " << matrix.column_count() << ", type: " << matrix.descriptor().type_name << std::endl;
+
+    std::vector<long> aggregate_columns;
+    std::vector<column_condition> conditions;
+    for (size_t argument_index = 1; argument_index < arguments.size(); argument_index++)
+    {
+        std::string argument = arguments[argument_index];
+        if (argument.find(':') != std::string::npos)
+        {
+            if (!parse_column_condition(matrix, argument, conditions))
+            {
+                std::cout << "Invalid condition: " << argument << std::endl;
+                return 1;
+            }
+            continue;
+        }
+        long column_index = matrix.column_index(argument);
+        if (column_index < 0)
+        {
+            std::cout << "Unknown column: " << argument << std::endl;
+            return 1;
+        }
+        aggregate_columns.push_back(column_index);
+    }
+
+    // Lay out the groups of each grouping.
+
+    if (group_specifications.empty())
+    {
+        group_specifications.push_back(std::string());
+    }
+    progress << "Thread count: " << thread_count << std::endl;
+    std::vector<group_by> groupings(group_specifications.size());
+    long accumulator_size = 0;
+    for (size_t grouping_index = 0; grouping_index < groupings.size(); grouping_index++)
+    {
+        std::vector<long> group_columns;
+        std::stringstream group_items(group_specifications[grouping_index]);
+        std::string group_item;
+        while (std::getline(group_items, group_item, ','))
+        {
+            long column_index = matrix.column_index(group_item);
+            if (column_index < 0)
+            {
+                std::cout << "Unknown column: " << group_item << std::endl;
+                return 1;
+            }
+            group_columns.push_back(column_index);
+        }
+        if (!plan_group_by(matrix, group_columns, thread_count, groupings[grouping_index], error))
+        {
+            std::cout << "Invalid grouping --by=" << group_specifications[grouping_index] << ": " << error << std::endl;
+            return 1;
+        }
+        progress << "Grouping: " << (group_specifications[grouping_index].empty() ? "(all rows)" : group_specifications[grouping_index])
+            << ", group slots: " << groupings[grouping_index].slot_count << std::endl;
+        accumulator_size += groupings[grouping_index].slot_count * group_accumulators::slot_size(aggregate_columns.size());
+    }
+    if (accumulator_size * thread_count > dense_accumulator_byte_limit)
+    {
+        std::cout << "The accumulators would take " << accumulator_size * thread_count / (1 << 20)
+            << "MB, more than the limit of " << dense_accumulator_byte_limit / (1 << 20) << "MB: use fewer group columns or threads" << std::endl;
+        return 1;
+    }
+
+    // One pass over the matrix for every grouping and aggregate.
+
+    std::chrono::steady_clock::time_point aggregate_clock = std::chrono::steady_clock::now();
+    long settled_block_count = 0;
+    long row_count = aggregate_rows(matrix, groupings, aggregate_columns, missing_value, conditions, any, thread_count, settled_block_count);
+    double aggregate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - aggregate_clock).count();
+    if (row_count < 0)
+    {
+        std::cout << "A group column holds values outside the range of its zone map, which no longer matches the matrix: "
+            << zone_map_path_for(matrix.backing_path()) << std::endl;
+        return 1;
+    }
+    progress << "Row count: " << row_count << std::endl;
+    if (matrix.has_zone_map() && !conditions.empty())
+    {
+        progress << "Blocks skipped by the zone map: " << settled_block_count << " of " << zone_block_count(matrix.row_count()) << std::endl;
+    }
+
+    FILE* report_file = stdout;
+    if (!report_file_name.empty())
+    {
+        std::cout << "Report file path: " << report_file_name << std::endl;
+        report_file = fopen(report_file_name.c_str(), "w");
+        if (report_file == NULL)
+        {
+            std::cout << "Null output file pointer from path: " << report_file_name << std::endl;
+            return 1;
+        }
+    }
+    for (size_t grouping_index = 0; grouping_index < groupings.size(); grouping_index++)
+    {
+        if (grouping_index > 0)
+        {
+            fputc('\n', report_file);
+        }
+        write_report_table(report_file, matrix, groupings[grouping_index], aggregate_columns);
+    }
+    if (report_file != stdout ? fclose(report_file) != 0 : fflush(stdout) != 0)
+    {
+        std::cout << "Failed to write the report file: " << report_file_name << std::endl;
+        return 1;
+    }
+
+    double duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+    double scanned_megabytes = double(matrix.row_count()) * matrix.element_size() / 1e6;
+    progress << "Aggregate duration/sec: " << aggregate_seconds << " (" << scanned_megabytes / (aggregate_seconds > 0 ? aggregate_seconds : 1e-9)
+        << " MB/s per column)" << std::endl;
+    progress << "Duration/sec: " << duration_secs << std::endl;
+    return 0;
+}
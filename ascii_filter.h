@@ -0,0 +1,153 @@
+/* Strip the bytes that are not printable ASCII from a block of text,
+   keeping exactly the bytes clean_to_ascii.c has always kept:
+   isprint() in the C locale (0x20 to 0x7E) and '\n'.
+
+   Blocks are classified 32 bytes at a time with AVX2 compares (16 with SSE2),
+   whole runs of clean bytes are copied straight through,
+   and runs holding bytes to drop are compacted 8 bytes at a time through a shuffle table (SSSE3).
+   Hosts without these fall back to a branch-free scalar loop with the same result.
+   Compile with -mavx2 (or -mssse3) on hosts that support it.
+
+   Used from both clean_to_ascii.c and map_string_fields.cpp, so it is plain C.
+
+   The output never runs ahead of the input, so a block can be filtered in place.
+
+   Typical use:
+       ascii_filter_init();   (once, before any threads use the filter)
+       size_t kept = ascii_filter_block(input, size, output);
+*/
+
+#ifndef ASCII_FILTER_H
+#define ASCII_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static inline int ascii_filter_keeps(unsigned char c)
+{
+    return (c >= 0x20 && c <= 0x7E) || c == '\n';
+}
+
+#if defined(__SSSE3__)
+/* For each 8 bit keep mask, the pshufb indices that gather the kept bytes of a group to its front. */
+static uint64_t ascii_filter_shuffles[256];
+#endif
+
+/* Build the shuffle table. */
+static void ascii_filter_init(void)
+{
+#if defined(__SSSE3__)
+    int mask;
+    for (mask = 0; mask < 256; mask++)
+    {
+        uint64_t shuffle = 0x8080808080808080ULL;
+        int kept = 0;
+        int bit;
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (mask & (1 << bit))
+            {
+                shuffle &= ~(0xFFULL << (8 * kept));
+                shuffle |= (uint64_t)bit << (8 * kept);
+                kept++;
+            }
+        }
+        ascii_filter_shuffles[mask] = shuffle;
+    }
+#endif
+}
+
+/* Copy the kept bytes of one group of up to 64 bytes, given its keep mask. Returns the bytes written.
+   Each 8 byte store lands at or before the group it came from. */
+static inline size_t ascii_filter_compact(const char* input, size_t size, uint64_t mask, char* output)
+{
+    size_t written = 0;
+#if defined(__SSSE3__)
+    size_t group;
+    for (group = 0; group + 8 <= size; group += 8)
+    {
+        unsigned group_mask = (unsigned)(mask >> group) & 0xFF;
+        __m128i bytes = _mm_loadl_epi64((const __m128i*)(input + group));
+        __m128i shuffle = _mm_cvtsi64_si128((long long)ascii_filter_shuffles[group_mask]);
+        _mm_storel_epi64((__m128i*)(output + written), _mm_shuffle_epi8(bytes, shuffle));
+        written += __builtin_popcount(group_mask);
+    }
+    input += group;
+    size -= group;
+    mask >>= group;
+#endif
+    size_t index;
+    for (index = 0; index < size; index++)
+    {
+        output[written] = input[index];
+        written += (mask >> index) & 1;
+    }
+    return written;
+}
+
+/* Filter size bytes of input into output, which may be the same buffer.
+   Returns the number of bytes kept. */
+static size_t ascii_filter_block(const char* input, size_t size, char* output)
+{
+    size_t position = 0;
+    size_t written = 0;
+
+#if defined(__AVX2__)
+    /* As signed bytes the printable range is (0x1F, 0x7F), and every byte from 0x80 up is negative. */
+    const __m256i low = _mm256_set1_epi8(0x1F);
+    const __m256i high = _mm256_set1_epi8(0x7F);
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; position + 32 <= size; position += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(input + position));
+        __m256i keep = _mm256_or_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi8(bytes, low), _mm256_cmpgt_epi8(high, bytes)),
+            _mm256_cmpeq_epi8(bytes, newline));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(keep);
+        if (mask == 0xFFFFFFFFu)
+        {
+            _mm256_storeu_si256((__m256i*)(output + written), bytes);
+            written += 32;
+        }
+        else
+        {
+            written += ascii_filter_compact(input + position, 32, mask, output + written);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i low = _mm_set1_epi8(0x1F);
+    const __m128i high = _mm_set1_epi8(0x7F);
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; position + 16 <= size; position += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(input + position));
+        __m128i keep = _mm_or_si128(
+            _mm_and_si128(_mm_cmpgt_epi8(bytes, low), _mm_cmpgt_epi8(high, bytes)),
+            _mm_cmpeq_epi8(bytes, newline));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(keep);
+        if (mask == 0xFFFFu)
+        {
+            _mm_storeu_si128((__m128i*)(output + written), bytes);
+            written += 16;
+        }
+        else
+        {
+            written += ascii_filter_compact(input + position, 16, mask, output + written);
+        }
+    }
+#endif
+
+    /* The tail, or everything on hosts without SSE2. */
+    for (; position < size; position++)
+    {
+        output[written] = input[position];
+        written += ascii_filter_keeps((unsigned char)input[position]);
+    }
+    return written;
+}
+
+#endif /* ASCII_FILTER_H */
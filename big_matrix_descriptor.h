@@ -0,0 +1,278 @@
+// Reading and writing the descriptor files of bigmemory file-backed big.matrices,
+// the files that R writes with dput() and reads back with dget() for attach.big.matrix().
+// The backing file itself is a plain column-major array with no header (separated = FALSE),
+// so the descriptor is all that is needed to find any value in it.
+
+// Used from map_string_fields.cpp, concat_matrices.cpp and column_scan.h.
+
+#ifndef BIG_MATRIX_DESCRIPTOR_H
+#define BIG_MATRIX_DESCRIPTOR_H
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+// What a descriptor says about a big.matrix.
+struct big_matrix_descriptor
+{
+    std::string file_name;      // The backing file name.
+    std::string folder_path;    // The folder it was created in, with a trailing '/'.
+    long row_count;
+    long column_count;
+    std::vector<std::string> column_names;     // Empty for colNames = NULL.
+    std::string type_name;      // char, short, integer, float or double.
+    bool separated;
+
+    big_matrix_descriptor() : row_count(0), column_count(0), separated(false) {}
+};
+
+// The size of one element of a bigmemory type, 0 if it is not known.
+inline size_t big_matrix_element_size(const std::string& type_name)
+{
+    if (type_name == "char" || type_name == "raw")
+    {
+        return 1;
+    }
+    if (type_name == "short")
+    {
+        return 2;
+    }
+    if (type_name == "integer" || type_name == "float")
+    {
+        return 4;
+    }
+    if (type_name == "double")
+    {
+        return 8;
+    }
+    return 0;
+}
+
+// Derive the descriptor file path from the backing file path
+// the same way tutorial_bigmemory_3.R does: 2008.matrix -> 2008.desc
+inline std::string descriptor_path_for(const std::string& backing_file_path)
+{
+    std::string::size_type slash_position = backing_file_path.find_last_of('/');
+    std::string::size_type dot_position = backing_file_path.find_last_of('.');
+    if (dot_position == std::string::npos || (slash_position != std::string::npos && dot_position < slash_position))
+    {
+        return backing_file_path + ".desc";
+    }
+    return backing_file_path.substr(0, dot_position) + ".desc";
+}
+
+// Write a big.matrix.descriptor that R can read back with dget() and attach.big.matrix().
+// This is the same form that dput() gives for a descriptor of a file-backed big.matrix.
+inline bool write_big_matrix_descriptor(const std::string& descriptor_file_path, const std::string& backing_file_path,
+                                        long row_count, const std::vector<std::string>& column_names, const char* type_name)
+{
+    std::string::size_type slash_position = backing_file_path.find_last_of('/');
+    std::string backing_file_name = backing_file_path;
+    std::string backing_folder_path = ".";
+    if (slash_position != std::string::npos)
+    {
+        backing_file_name = backing_file_path.substr(slash_position + 1);
+        backing_folder_path = backing_file_path.substr(0, slash_position + 1);
+    }
+    char resolved_path[PATH_MAX];
+    if (realpath(backing_folder_path.c_str(), resolved_path) != NULL)
+    {
+        backing_folder_path = resolved_path;
+    }
+    if (backing_folder_path.empty() || backing_folder_path[backing_folder_path.size() - 1] != '/')
+    {
+        backing_folder_path += "/";
+    }
+
+    std::ofstream descriptor_file(descriptor_file_path.c_str());
+    if (!descriptor_file.is_open())
+    {
+        return false;
+    }
+
+    long column_count = column_names.size();
+    descriptor_file << "new(\"big.matrix.descriptor\"\n"
+        << "    , description = list(sharedType = \"FileBacked\", filename = \"" << backing_file_name << "\", "
+        << "dirname = \"" << backing_folder_path << "\", "
+        << "totalRows = " << row_count << ", totalCols = " << column_count << ", "
+        << "rowOffset = c(0, " << row_count << "), colOffset = c(0, " << column_count << "), "
+        << "nrow = " << row_count << ", ncol = " << column_count << ", "
+        << "rowNames = NULL, colNames = c(";
+    for (long column_index = 0; column_index < column_count; column_index++)
+    {
+        descriptor_file << (column_index > 0 ? ", " : "") << "\"" << column_names[column_index] << "\"";
+    }
+    descriptor_file << "), type = \"" << type_name << "\", separated = FALSE)\n"
+        << ")\n";
+
+    return descriptor_file.good();
+}
+
+// Find "name = " at the top level of the description list and return the position of its value.
+inline std::string::size_type find_descriptor_entry(const std::string& text, const char* name)
+{
+    std::string key = std::string(name) + " =";
+    std::string::size_type position = 0;
+    while ((position = text.find(key, position)) != std::string::npos)
+    {
+        // Make sure this is the whole name, e.g. "nrow" and not the end of "totalnrow".
+        char before = position > 0 ? text[position - 1] : ' ';
+        if (before == ' ' || before == ',' || before == '(' || before == '\n')
+        {
+            position += key.size();
+            while (position < text.size() && (text[position] == ' ' || text[position] == '\n'))
+            {
+                position++;
+            }
+            return position;
+        }
+        position += key.size();
+    }
+    return std::string::npos;
+}
+
+// Read the quoted strings of a value: "a" or c("a", "b", ...). Returns false for anything else, e.g. NULL.
+inline bool read_descriptor_strings(const std::string& text, std::string::size_type position, std::vector<std::string>& values)
+{
+    values.clear();
+    if (position == std::string::npos || position >= text.size())
+    {
+        return false;
+    }
+    std::string::size_type end = position + 1;
+    if (text.compare(position, 2, "c(") == 0)
+    {
+        end = text.find(')', position);
+    }
+    else if (text[position] != '"')
+    {
+        return false;
+    }
+    while ((position = text.find('"', position)) != std::string::npos && position < end)
+    {
+        std::string::size_type close_position = text.find('"', position + 1);
+        if (close_position == std::string::npos)
+        {
+            return false;
+        }
+        values.push_back(text.substr(position + 1, close_position - position - 1));
+        position = close_position + 1;
+    }
+    return true;
+}
+
+// Read a number value, which R may write as 7009728, 7009728L or 7.009728e+06.
+inline bool read_descriptor_number(const std::string& text, const char* name, long& value)
+{
+    std::string::size_type position = find_descriptor_entry(text, name);
+    if (position == std::string::npos)
+    {
+        return false;
+    }
+    char* end;
+    double number = strtod(text.c_str() + position, &end);
+    value = (long)number;
+    return end != text.c_str() + position;
+}
+
+// Read a descriptor file as written by dput() or write_big_matrix_descriptor().
+// Only descriptors of whole file-backed matrices are accepted, not sub.big.matrix views.
+inline bool read_big_matrix_descriptor(const std::string& descriptor_file_path, big_matrix_descriptor& descriptor,
+                                       std::string& error)
+{
+    std::ifstream descriptor_file(descriptor_file_path.c_str());
+    if (!descriptor_file.is_open())
+    {
+        error = "cannot open the descriptor file";
+        return false;
+    }
+    std::stringstream contents;
+    contents << descriptor_file.rdbuf();
+    std::string text = contents.str();
+
+    std::vector<std::string> values;
+    if (!read_descriptor_strings(text, find_descriptor_entry(text, "sharedType"), values) || values.size() != 1 || values[0] != "FileBacked")
+    {
+        error = "not a file-backed big.matrix descriptor";
+        return false;
+    }
+    if (!read_descriptor_strings(text, find_descriptor_entry(text, "filename"), values) || values.size() != 1)
+    {
+        error = "no backing file name";
+        return false;
+    }
+    descriptor.file_name = values[0];
+    if (!read_descriptor_strings(text, find_descriptor_entry(text, "dirname"), values) || values.size() != 1)
+    {
+        error = "no backing folder";
+        return false;
+    }
+    descriptor.folder_path = values[0];
+    if (descriptor.folder_path.empty() || descriptor.folder_path[descriptor.folder_path.size() - 1] != '/')
+    {
+        descriptor.folder_path += "/";
+    }
+    if (!read_descriptor_strings(text, find_descriptor_entry(text, "type"), values) || values.size() != 1
+        || big_matrix_element_size(values[0]) == 0)
+    {
+        error = "unknown element type";
+        return false;
+    }
+    descriptor.type_name = values[0];
+
+    long total_rows;
+    long total_columns;
+    if (!read_descriptor_number(text, "totalRows", total_rows) || !read_descriptor_number(text, "totalCols", total_columns)
+        || !read_descriptor_number(text, "nrow", descriptor.row_count) || !read_descriptor_number(text, "ncol", descriptor.column_count))
+    {
+        error = "no matrix dimensions";
+        return false;
+    }
+    if (total_rows != descriptor.row_count || total_columns != descriptor.column_count)
+    {
+        error = "sub.big.matrix descriptors are not supported";
+        return false;
+    }
+
+    std::string::size_type separated_position = find_descriptor_entry(text, "separated");
+    descriptor.separated = separated_position != std::string::npos && text.compare(separated_position, 4, "TRUE") == 0;
+    if (descriptor.separated)
+    {
+        error = "separated big.matrices are not supported";
+        return false;
+    }
+
+    if (!read_descriptor_strings(text, find_descriptor_entry(text, "colNames"), descriptor.column_names))
+    {
+        descriptor.column_names.clear();
+    }
+    if (!descriptor.column_names.empty() && (long)descriptor.column_names.size() != descriptor.column_count)
+    {
+        error = "the column names do not match the column count";
+        return false;
+    }
+    return true;
+}
+
+// Find the backing file of a descriptor: next to the descriptor file, as attach.big.matrix(path=) is used
+// in the tutorials, or else in the folder it was created in.
+inline std::string find_big_matrix_backing_path(const std::string& descriptor_file_path, const big_matrix_descriptor& descriptor)
+{
+    std::string::size_type slash_position = descriptor_file_path.find_last_of('/');
+    std::string descriptor_folder = slash_position == std::string::npos ? "" : descriptor_file_path.substr(0, slash_position + 1);
+    std::string beside_descriptor = descriptor_folder + descriptor.file_name;
+    struct stat status;
+    if (stat(beside_descriptor.c_str(), &status) == 0)
+    {
+        return beside_descriptor;
+    }
+    return descriptor.folder_path + descriptor.file_name;
+}
+
+#endif // BIG_MATRIX_DESCRIPTOR_H
@@ -0,0 +1,763 @@
+// Bitmap indexes of the low-cardinality columns of a file-backed big.matrix, e.g. the carrier, airport,
+// month and cancellation columns of all.matrix: for every value of the column, the set of rows holding it.
+// A query like "the cancelled flights of carrier X out of airport Y" then ANDs three bitmaps
+// and only reads the rows it finds, rather than scanning the three columns in full.
+
+// The bitmaps are held the way Roaring bitmaps hold them: the rows are split into blocks of 65536
+// (the zone blocks of zone_map.h), and each block holding the value has one container of the row offsets in it,
+// a sorted array of 16 bit offsets when there are at most 4096 of them, otherwise a bitset of 1024 64 bit words.
+// Sparse values cost 2 bytes a row, dense ones at most 8KB a block, and ANDs and ORs work a container at a time.
+
+// The index of all.matrix is kept in the sidecar file all.matrix.bitmaps, memory mapped when it is queried:
+//     bitmap_index_header
+//     index_count x bitmap_index_column        each column indexed
+//     per column: value_count x bitmap_index_value, sorted by value
+//     per value: container_count x bitmap_index_container, then the containers' offsets or words
+// All offsets are from the start of the file and all words are 8 byte aligned.
+
+// Used from map_string_fields.cpp, concat_matrices.cpp and query_matrix.cpp.
+
+#ifndef BITMAP_INDEX_H
+#define BITMAP_INDEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "column_scan.h"
+
+// The columns of the airline data indexed unless others are asked for.
+const char* const default_bitmap_columns = "Year,Month,DayOfWeek,UniqueCarrier,Origin,Dest,Cancelled,CancellationCode,Diverted";
+
+// Columns with more distinct values than this, or a wider range of values than bitmap_value_range_limit, are not indexed.
+const long bitmap_value_count_limit = 16384;
+const long bitmap_value_range_limit = 1 << 20;
+
+// A container holds its offsets as an array up to this many, as a bitset beyond.
+const uint32_t bitmap_array_limit = 4096;
+const long bitmap_words_per_block = zone_block_row_count / 64;
+
+// The rows of one block holding a value.
+struct bitmap_container
+{
+    uint32_t key;                       // The block index.
+    uint32_t cardinality;
+    std::vector<uint16_t> offsets;      // The sorted row offsets in the block, when an array.
+    std::vector<uint64_t> words;        // bitmap_words_per_block words, when a bitset.
+
+    bool is_bitset() const { return !words.empty(); }
+};
+
+// A container from a bitset, kept as a bitset or turned into an array, whichever is smaller.
+inline bitmap_container make_bitmap_container(uint32_t key, std::vector<uint64_t>& words)
+{
+    bitmap_container container;
+    container.key = key;
+    container.cardinality = 0;
+    for (long word_index = 0; word_index < bitmap_words_per_block; word_index++)
+    {
+        container.cardinality += __builtin_popcountll(words[word_index]);
+    }
+    if (container.cardinality > bitmap_array_limit)
+    {
+        container.words.swap(words);
+        return container;
+    }
+    container.offsets.reserve(container.cardinality);
+    for (long word_index = 0; word_index < bitmap_words_per_block; word_index++)
+    {
+        uint64_t word = words[word_index];
+        while (word != 0)
+        {
+            container.offsets.push_back(uint16_t(word_index * 64 + __builtin_ctzll(word)));
+            word &= word - 1;
+        }
+    }
+    return container;
+}
+
+inline void bitmap_container_words(const bitmap_container& container, std::vector<uint64_t>& words)
+{
+    if (container.is_bitset())
+    {
+        words = container.words;
+        return;
+    }
+    words.assign(bitmap_words_per_block, 0);
+    for (size_t index = 0; index < container.offsets.size(); index++)
+    {
+        words[container.offsets[index] >> 6] |= uint64_t(1) << (container.offsets[index] & 63);
+    }
+}
+
+inline bool bitmap_container_contains(const bitmap_container& container, uint16_t offset)
+{
+    if (container.is_bitset())
+    {
+        return (container.words[offset >> 6] >> (offset & 63)) & 1;
+    }
+    return std::binary_search(container.offsets.begin(), container.offsets.end(), offset);
+}
+
+// A set of rows, as containers in key order.
+class row_bitmap
+{
+public:
+    long cardinality() const
+    {
+        long count = 0;
+        for (size_t container_index = 0; container_index < m_containers.size(); container_index++)
+        {
+            count += m_containers[container_index].cardinality;
+        }
+        return count;
+    }
+
+    // The rows, from 0 and in order.
+    void to_rows(std::vector<long>& rows) const
+    {
+        rows.clear();
+        rows.reserve(cardinality());
+        for (size_t container_index = 0; container_index < m_containers.size(); container_index++)
+        {
+            const bitmap_container& container = m_containers[container_index];
+            long first_row = long(container.key) * zone_block_row_count;
+            if (!container.is_bitset())
+            {
+                for (size_t index = 0; index < container.offsets.size(); index++)
+                {
+                    rows.push_back(first_row + container.offsets[index]);
+                }
+                continue;
+            }
+            for (long word_index = 0; word_index < bitmap_words_per_block; word_index++)
+            {
+                uint64_t word = container.words[word_index];
+                while (word != 0)
+                {
+                    rows.push_back(first_row + word_index * 64 + __builtin_ctzll(word));
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+    // The rows in both bitmaps.
+    static row_bitmap intersect(const row_bitmap& a, const row_bitmap& b)
+    {
+        row_bitmap result;
+        size_t a_index = 0;
+        size_t b_index = 0;
+        std::vector<uint64_t> words;
+        while (a_index < a.m_containers.size() && b_index < b.m_containers.size())
+        {
+            const bitmap_container& a_container = a.m_containers[a_index];
+            const bitmap_container& b_container = b.m_containers[b_index];
+            if (a_container.key != b_container.key)
+            {
+                (a_container.key < b_container.key ? a_index : b_index)++;
+                continue;
+            }
+            bitmap_container container;
+            container.key = a_container.key;
+            if (a_container.is_bitset() && b_container.is_bitset())
+            {
+                words.resize(bitmap_words_per_block);
+                for (long word_index = 0; word_index < bitmap_words_per_block; word_index++)
+                {
+                    words[word_index] = a_container.words[word_index] & b_container.words[word_index];
+                }
+                container = make_bitmap_container(a_container.key, words);
+            }
+            else if (a_container.is_bitset() || b_container.is_bitset())
+            {
+                // Keep the offsets of the array that are in the bitset.
+                const bitmap_container& array = a_container.is_bitset() ? b_container : a_container;
+                const bitmap_container& bitset = a_container.is_bitset() ? a_container : b_container;
+                for (size_t index = 0; index < array.offsets.size(); index++)
+                {
+                    if (bitmap_container_contains(bitset, array.offsets[index]))
+                    {
+                        container.offsets.push_back(array.offsets[index]);
+                    }
+                }
+            }
+            else
+            {
+                std::set_intersection(a_container.offsets.begin(), a_container.offsets.end(),
+                                      b_container.offsets.begin(), b_container.offsets.end(), std::back_inserter(container.offsets));
+            }
+            if (!container.is_bitset())
+            {
+                container.cardinality = container.offsets.size();
+            }
+            if (container.cardinality > 0)
+            {
+                result.m_containers.push_back(container);
+            }
+            a_index++;
+            b_index++;
+        }
+        return result;
+    }
+
+    // The rows in either bitmap.
+    static row_bitmap unite(const row_bitmap& a, const row_bitmap& b)
+    {
+        row_bitmap result;
+        size_t a_index = 0;
+        size_t b_index = 0;
+        std::vector<uint64_t> words;
+        std::vector<uint64_t> other_words;
+        while (a_index < a.m_containers.size() || b_index < b.m_containers.size())
+        {
+            if (b_index == b.m_containers.size()
+                || (a_index < a.m_containers.size() && a.m_containers[a_index].key < b.m_containers[b_index].key))
+            {
+                result.m_containers.push_back(a.m_containers[a_index++]);
+                continue;
+            }
+            if (a_index == a.m_containers.size() || b.m_containers[b_index].key < a.m_containers[a_index].key)
+            {
+                result.m_containers.push_back(b.m_containers[b_index++]);
+                continue;
+            }
+            const bitmap_container& a_container = a.m_containers[a_index++];
+            const bitmap_container& b_container = b.m_containers[b_index++];
+            if (!a_container.is_bitset() && !b_container.is_bitset()
+                && a_container.cardinality + b_container.cardinality <= bitmap_array_limit)
+            {
+                bitmap_container container;
+                container.key = a_container.key;
+                std::set_union(a_container.offsets.begin(), a_container.offsets.end(),
+                               b_container.offsets.begin(), b_container.offsets.end(), std::back_inserter(container.offsets));
+                container.cardinality = container.offsets.size();
+                result.m_containers.push_back(container);
+                continue;
+            }
+            bitmap_container_words(a_container, words);
+            bitmap_container_words(b_container, other_words);
+            for (long word_index = 0; word_index < bitmap_words_per_block; word_index++)
+            {
+                words[word_index] |= other_words[word_index];
+            }
+            result.m_containers.push_back(make_bitmap_container(a_container.key, words));
+        }
+        return result;
+    }
+
+    std::vector<bitmap_container>& containers() { return m_containers; }
+    const std::vector<bitmap_container>& containers() const { return m_containers; }
+
+private:
+    std::vector<bitmap_container> m_containers;
+};
+
+struct bitmap_index_header
+{
+    char magic[8];          // "BITMAPS1"
+    int64_t row_count;
+    int64_t column_count;
+    int64_t index_count;    // The number of columns indexed.
+};
+
+struct bitmap_index_column
+{
+    int64_t column_index;
+    int64_t value_count;
+    int64_t values_offset;
+};
+
+struct bitmap_index_value
+{
+    int32_t value;
+    uint32_t container_count;
+    int64_t cardinality;
+    int64_t containers_offset;
+};
+
+struct bitmap_index_container
+{
+    uint32_t key;
+    uint32_t cardinality;
+    int64_t data_offset;
+};
+
+const char bitmap_index_magic[8] = {'B', 'I', 'T', 'M', 'A', 'P', 'S', '1'};
+
+// The sidecar file path of a backing file: all.matrix -> all.matrix.bitmaps
+inline std::string bitmap_index_path_for(const std::string& backing_file_path)
+{
+    return backing_file_path + ".bitmaps";
+}
+
+// The bitmaps of one column of a matrix, by value, built a block of rows at a time on thread_count threads.
+// Returns false if the column has too many distinct values to be worth indexing.
+template <typename T>
+bool build_column_bitmaps(const T* values, long row_count, int thread_count, std::map<int, row_bitmap>& bitmaps)
+{
+    bitmaps.clear();
+    if (row_count == 0)
+    {
+        return true;
+    }
+    T min_value = values[0];
+    T max_value = values[0];
+    for (long row_index = 0; row_index < row_count; row_index++)
+    {
+        min_value = values[row_index] < min_value ? values[row_index] : min_value;
+        max_value = values[row_index] > max_value ? values[row_index] : max_value;
+    }
+    long value_range = long(max_value) - long(min_value) + 1;
+    if (value_range > bitmap_value_range_limit)
+    {
+        return false;
+    }
+
+    // Each block is counted per value into a dense table over the range of values, then each value
+    // present gets an array or a bitset container, filled in a second pass over the block.
+    long block_count = zone_block_count(row_count);
+    std::vector<std::vector<std::pair<int, bitmap_container> > > block_containers(block_count);
+    std::atomic<long> next_block(0);
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            std::vector<uint32_t> counts(value_range, 0);
+            std::vector<int32_t> slots(value_range, -1);
+            std::vector<long> present;
+            long block_index;
+            while ((block_index = next_block.fetch_add(1)) < block_count)
+            {
+                const T* block = values + block_index * zone_block_row_count;
+                long block_rows = zone_block_rows(row_count, block_index);
+                present.clear();
+                for (long row_index = 0; row_index < block_rows; row_index++)
+                {
+                    long value_index = long(block[row_index]) - min_value;
+                    present.push_back(value_index);
+                    counts[value_index]++;
+                }
+                std::sort(present.begin(), present.end());
+                present.erase(std::unique(present.begin(), present.end()), present.end());
+
+                std::vector<std::pair<int, bitmap_container> >& containers = block_containers[block_index];
+                containers.resize(present.size());
+                for (size_t present_index = 0; present_index < present.size(); present_index++)
+                {
+                    long value_index = present[present_index];
+                    bitmap_container& container = containers[present_index].second;
+                    containers[present_index].first = int(value_index + min_value);
+                    container.key = uint32_t(block_index);
+                    container.cardinality = counts[value_index];
+                    if (container.cardinality > bitmap_array_limit)
+                    {
+                        container.words.assign(bitmap_words_per_block, 0);
+                    }
+                    else
+                    {
+                        container.offsets.reserve(container.cardinality);
+                    }
+                    slots[value_index] = present_index;
+                    counts[value_index] = 0;
+                }
+                for (long row_index = 0; row_index < block_rows; row_index++)
+                {
+                    bitmap_container& container = containers[slots[long(block[row_index]) - min_value]].second;
+                    if (container.is_bitset())
+                    {
+                        container.words[row_index >> 6] |= uint64_t(1) << (row_index & 63);
+                    }
+                    else
+                    {
+                        container.offsets.push_back(uint16_t(row_index));
+                    }
+                }
+            }
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+    }
+
+    for (long block_index = 0; block_index < block_count; block_index++)
+    {
+        std::vector<std::pair<int, bitmap_container> >& containers = block_containers[block_index];
+        for (size_t container_index = 0; container_index < containers.size(); container_index++)
+        {
+            bitmaps[containers[container_index].first].containers().push_back(std::move(containers[container_index].second));
+        }
+        std::vector<std::pair<int, bitmap_container> >().swap(containers);
+        if ((long)bitmaps.size() > bitmap_value_count_limit)
+        {
+            bitmaps.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Build the bitmap indexes of the named columns of a matrix (comma separated, default_bitmap_columns
+// for the airline columns) and write them to its sidecar file. Columns the matrix does not have are passed over,
+// as are columns with too many values, which are listed in skipped_columns.
+inline bool write_bitmap_index(const mapped_big_matrix& matrix, const std::string& column_list, int thread_count,
+                               const std::string& bitmap_file_name, std::vector<std::string>& skipped_columns)
+{
+    std::vector<long> column_indexes;
+    std::stringstream column_names(column_list);
+    std::string column_name;
+    while (std::getline(column_names, column_name, ','))
+    {
+        long column_index = matrix.column_index(column_name);
+        if (column_index >= 0 && std::find(column_indexes.begin(), column_indexes.end(), column_index) == column_indexes.end())
+        {
+            column_indexes.push_back(column_index);
+        }
+    }
+
+    std::ofstream bitmap_file(bitmap_file_name.c_str(), std::ios::binary);
+    if (!bitmap_file.is_open())
+    {
+        return false;
+    }
+    bitmap_index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, bitmap_index_magic, sizeof(header.magic));
+    header.row_count = matrix.row_count();
+    header.column_count = matrix.column_count();
+    std::vector<bitmap_index_column> directory;
+
+    // One column at a time, so only one column's bitmaps are held in memory.
+    // The directory goes at the front, so it is written last.
+    int64_t offset = sizeof(header) + column_indexes.size() * sizeof(bitmap_index_column);
+    bitmap_file.seekp(offset);
+    const uint64_t padding = 0;
+    for (size_t index = 0; index < column_indexes.size(); index++)
+    {
+        long column_index = column_indexes[index];
+        std::map<int, row_bitmap> bitmaps;
+        const char* column = matrix.column_data(column_index);
+        bool built;
+        switch (matrix.element_size())
+        {
+        case 1:
+            built = build_column_bitmaps(reinterpret_cast<const int8_t*>(column), matrix.row_count(), thread_count, bitmaps);
+            break;
+        case 2:
+            built = build_column_bitmaps(reinterpret_cast<const int16_t*>(column), matrix.row_count(), thread_count, bitmaps);
+            break;
+        default:
+            built = build_column_bitmaps(reinterpret_cast<const int32_t*>(column), matrix.row_count(), thread_count, bitmaps);
+            break;
+        }
+        if (!built)
+        {
+            skipped_columns.push_back(matrix.column_name(column_index));
+            continue;
+        }
+
+        bitmap_index_column entry = {column_index, int64_t(bitmaps.size()), offset};
+        directory.push_back(entry);
+        std::vector<bitmap_index_value> values;
+        int64_t containers_offset = offset + bitmaps.size() * sizeof(bitmap_index_value);
+        for (std::map<int, row_bitmap>::const_iterator bitmap = bitmaps.begin(); bitmap != bitmaps.end(); ++bitmap)
+        {
+            const std::vector<bitmap_container>& containers = bitmap->second.containers();
+            bitmap_index_value value = {bitmap->first, uint32_t(containers.size()), bitmap->second.cardinality(), containers_offset};
+            values.push_back(value);
+            containers_offset += containers.size() * sizeof(bitmap_index_container);
+            for (size_t container_index = 0; container_index < containers.size(); container_index++)
+            {
+                const bitmap_container& container = containers[container_index];
+                containers_offset += container.is_bitset() ? bitmap_words_per_block * 8 : (container.offsets.size() * 2 + 7) / 8 * 8;
+            }
+        }
+        bitmap_file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(bitmap_index_value));
+        offset += values.size() * sizeof(bitmap_index_value);
+
+        std::vector<bitmap_index_container> container_entries;
+        for (std::map<int, row_bitmap>::const_iterator bitmap = bitmaps.begin(); bitmap != bitmaps.end(); ++bitmap)
+        {
+            const std::vector<bitmap_container>& containers = bitmap->second.containers();
+            int64_t data_offset = offset + containers.size() * sizeof(bitmap_index_container);
+            container_entries.resize(containers.size());
+            for (size_t container_index = 0; container_index < containers.size(); container_index++)
+            {
+                const bitmap_container& container = containers[container_index];
+                bitmap_index_container container_entry = {container.key, container.cardinality, data_offset};
+                container_entries[container_index] = container_entry;
+                data_offset += container.is_bitset() ? bitmap_words_per_block * 8 : (container.offsets.size() * 2 + 7) / 8 * 8;
+            }
+            bitmap_file.write(reinterpret_cast<const char*>(container_entries.data()), container_entries.size() * sizeof(bitmap_index_container));
+            for (size_t container_index = 0; container_index < containers.size(); container_index++)
+            {
+                const bitmap_container& container = containers[container_index];
+                if (container.is_bitset())
+                {
+                    bitmap_file.write(reinterpret_cast<const char*>(container.words.data()), bitmap_words_per_block * 8);
+                }
+                else
+                {
+                    size_t size = container.offsets.size() * 2;
+                    bitmap_file.write(reinterpret_cast<const char*>(container.offsets.data()), size);
+                    bitmap_file.write(reinterpret_cast<const char*>(&padding), (size + 7) / 8 * 8 - size);
+                }
+            }
+            offset = data_offset;
+        }
+    }
+
+    header.index_count = directory.size();
+    bitmap_file.seekp(0);
+    bitmap_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    bitmap_file.write(reinterpret_cast<const char*>(directory.data()), directory.size() * sizeof(bitmap_index_column));
+    bitmap_file.close();
+    return !bitmap_file.fail();
+}
+
+// A bitmap index file, memory mapped read-only.
+class bitmap_index
+{
+public:
+    bitmap_index() : m_data(NULL), m_size(0) {}
+    ~bitmap_index() { close(); }
+
+    // Map the bitmap index of a matrix of row_count rows and column_count columns.
+    bool open(const std::string& bitmap_file_name, long row_count, long column_count)
+    {
+        int file_descriptor = ::open(bitmap_file_name.c_str(), O_RDONLY);
+        struct stat file_status;
+        if (file_descriptor < 0 || fstat(file_descriptor, &file_status) != 0 || (size_t)file_status.st_size < sizeof(bitmap_index_header))
+        {
+            if (file_descriptor >= 0)
+            {
+                ::close(file_descriptor);
+            }
+            return false;
+        }
+        m_size = file_status.st_size;
+        void* mapping = mmap(NULL, m_size, PROT_READ, MAP_SHARED, file_descriptor, 0);
+        ::close(file_descriptor);
+        if (mapping == MAP_FAILED)
+        {
+            m_size = 0;
+            return false;
+        }
+        m_data = static_cast<const char*>(mapping);
+        const bitmap_index_header* header = reinterpret_cast<const bitmap_index_header*>(m_data);
+        if (memcmp(header->magic, bitmap_index_magic, sizeof(header->magic)) != 0 || header->row_count != row_count
+            || header->column_count != column_count
+            || sizeof(bitmap_index_header) + header->index_count * sizeof(bitmap_index_column) > m_size)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (m_data != NULL)
+        {
+            munmap(const_cast<char*>(m_data), m_size);
+            m_data = NULL;
+        }
+        m_size = 0;
+    }
+
+    bool is_open() const { return m_data != NULL; }
+
+    // The indexed columns.
+    std::vector<long> column_indexes() const
+    {
+        std::vector<long> columns;
+        for (long index = 0; m_data != NULL && index < header().index_count; index++)
+        {
+            columns.push_back(directory()[index].column_index);
+        }
+        return columns;
+    }
+
+    // The values of an indexed column, sorted, or NULL if the column is not indexed.
+    const bitmap_index_value* column_values(long column_index, long& value_count) const
+    {
+        for (long index = 0; m_data != NULL && index < header().index_count; index++)
+        {
+            if (directory()[index].column_index == column_index)
+            {
+                value_count = directory()[index].value_count;
+                return reinterpret_cast<const bitmap_index_value*>(m_data + directory()[index].values_offset);
+            }
+        }
+        return NULL;
+    }
+
+    // The rows holding a value of an indexed column.
+    void value_bitmap(const bitmap_index_value& value, row_bitmap& bitmap) const
+    {
+        const bitmap_index_container* entries = reinterpret_cast<const bitmap_index_container*>(m_data + value.containers_offset);
+        std::vector<bitmap_container>& containers = bitmap.containers();
+        containers.resize(value.container_count);
+        for (uint32_t container_index = 0; container_index < value.container_count; container_index++)
+        {
+            const bitmap_index_container& entry = entries[container_index];
+            bitmap_container& container = containers[container_index];
+            container.key = entry.key;
+            container.cardinality = entry.cardinality;
+            if (entry.cardinality > bitmap_array_limit)
+            {
+                const uint64_t* words = reinterpret_cast<const uint64_t*>(m_data + entry.data_offset);
+                container.words.assign(words, words + bitmap_words_per_block);
+            }
+            else
+            {
+                const uint16_t* offsets = reinterpret_cast<const uint16_t*>(m_data + entry.data_offset);
+                container.offsets.assign(offsets, offsets + entry.cardinality);
+            }
+        }
+    }
+
+private:
+    const bitmap_index_header& header() const { return *reinterpret_cast<const bitmap_index_header*>(m_data); }
+    const bitmap_index_column* directory() const { return reinterpret_cast<const bitmap_index_column*>(m_data + sizeof(bitmap_index_header)); }
+
+    const char* m_data;
+    size_t m_size;
+};
+
+inline bool meets_comparison(int value, comparison op, int constant)
+{
+    switch (op)
+    {
+    case compare_eq:
+        return value == constant;
+    case compare_neq:
+        return value != constant;
+    case compare_lt:
+        return value < constant;
+    case compare_le:
+        return value <= constant;
+    case compare_gt:
+        return value > constant;
+    default:
+        return value >= constant;
+    }
+}
+
+// Find the rows (from 0, in order) that meet the conditions from the bitmap index, reading only the rows found.
+// A condition on an indexed column is the OR of the bitmaps of the values that meet it.
+// Only conditions selective enough to beat a scan are taken from the index (at most a quarter of the rows);
+// with AND at least one must be, and the rest of the conditions are then checked on the rows it finds;
+// with OR all of them must be. Returns false if the index cannot answer the query, so the matrix must be scanned.
+inline bool bitmap_rows(const mapped_big_matrix& matrix, const bitmap_index& index, const std::vector<column_condition>& conditions,
+                        bool any, std::vector<long>& rows)
+{
+    std::vector<const column_condition*> indexed;
+    std::vector<const column_condition*> checked;
+    std::vector<std::vector<const bitmap_index_value*> > indexed_values;
+    std::vector<long> indexed_cardinalities;
+    for (size_t condition_index = 0; condition_index < conditions.size(); condition_index++)
+    {
+        const column_condition& condition = conditions[condition_index];
+        long value_count = 0;
+        const bitmap_index_value* values = index.column_values(condition.column_index, value_count);
+        std::vector<const bitmap_index_value*> matching;
+        long cardinality = 0;
+        for (long value_index = 0; values != NULL && value_index < value_count; value_index++)
+        {
+            if (meets_comparison(values[value_index].value, condition.op, condition.value))
+            {
+                matching.push_back(&values[value_index]);
+                cardinality += values[value_index].cardinality;
+            }
+        }
+        if (values != NULL && cardinality <= matrix.row_count() / 4)
+        {
+            indexed.push_back(&condition);
+            indexed_values.push_back(matching);
+            indexed_cardinalities.push_back(cardinality);
+        }
+        else
+        {
+            checked.push_back(&condition);
+        }
+    }
+    if (indexed.empty() || (any && !checked.empty()))
+    {
+        return false;
+    }
+
+    // AND the most selective conditions first, so the intermediate bitmaps stay small.
+    std::vector<size_t> order(indexed.size());
+    for (size_t order_index = 0; order_index < order.size(); order_index++)
+    {
+        order[order_index] = order_index;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return indexed_cardinalities[a] < indexed_cardinalities[b]; });
+
+    row_bitmap result;
+    row_bitmap condition_bitmap;
+    row_bitmap value_bitmap;
+    for (size_t order_index = 0; order_index < order.size(); order_index++)
+    {
+        const std::vector<const bitmap_index_value*>& matching = indexed_values[order[order_index]];
+        condition_bitmap = row_bitmap();
+        for (size_t value_index = 0; value_index < matching.size(); value_index++)
+        {
+            index.value_bitmap(*matching[value_index], value_bitmap);
+            condition_bitmap = value_index == 0 ? value_bitmap : row_bitmap::unite(condition_bitmap, value_bitmap);
+        }
+        result = order_index == 0 ? condition_bitmap
+            : any ? row_bitmap::unite(result, condition_bitmap) : row_bitmap::intersect(result, condition_bitmap);
+    }
+    result.to_rows(rows);
+
+    if (!checked.empty())
+    {
+        size_t kept = 0;
+        for (size_t row_index = 0; row_index < rows.size(); row_index++)
+        {
+            bool meets = true;
+            for (size_t condition_index = 0; condition_index < checked.size() && meets; condition_index++)
+            {
+                const column_condition& condition = *checked[condition_index];
+                meets = meets_comparison(matrix.value(condition.column_index, rows[row_index]), condition.op, condition.value);
+            }
+            rows[kept] = rows[row_index];
+            kept += meets;
+        }
+        rows.resize(kept);
+    }
+    return true;
+}
+
+// Build the bitmap index of a matrix from its descriptor file, next to its backing file.
+// Used by the tools after they have written a matrix.
+inline bool build_bitmap_index_for(const std::string& descriptor_file_name, const std::string& column_list, int thread_count,
+                                   std::string& bitmap_file_name, std::vector<std::string>& skipped_columns)
+{
+    mapped_big_matrix matrix;
+    std::string error;
+    if (!matrix.open(descriptor_file_name, error))
+    {
+        return false;
+    }
+    bitmap_file_name = bitmap_index_path_for(matrix.backing_path());
+    return write_bitmap_index(matrix, column_list, thread_count, bitmap_file_name, skipped_columns);
+}
+
+#endif // BITMAP_INDEX_H
@@ -1,11 +1,16 @@
-/* gcc -W clean_to_ascii.c -o clean_to_ascii */
+/* gcc -W -O2 clean_to_ascii.c -o clean_to_ascii -pthread -lbz2 -lz */
+/* Add -mavx2 (or -mssse3) on hosts that support it to filter 32 bytes at a time, see ascii_filter.h. */
 /* Run it with: $ ./clean_to_ascii [source-filename] [destination_filename] */
+/* The source file may be the compressed download (e.g. 2001.csv.bz2 or .gz),
+   it is decompressed on its own thread while the bytes are filtered. */
 
-#include <ctype.h>
 #include <stdio.h>      /* printf */
 #include <time.h>       /* time_t, struct tm, time, localtime, strftime */
 #include <locale.h>     /* struct lconv, setlocale, localeconv */
 
+#include "decompressing_reader.h"
+#include "ascii_filter.h"
+
 int main(int argc, char **argv)
 {
 	time_t start_time;
@@ -13,6 +18,8 @@ int main(int argc, char **argv)
 	struct tm * timeinfo;
 	char buffer [80];
 	double duration_secs;
+	struct timespec start_clock;
+	struct timespec end_clock;
 
 	struct lconv * lc;
 
@@ -20,12 +27,13 @@ int main(int argc, char **argv)
 	{
 		printf ("Locale: %s\n", setlocale(LC_ALL, NULL));
 		time ( &start_time );
+		clock_gettime(CLOCK_MONOTONIC, &start_clock);
 		timeinfo = localtime ( &start_time );
 		strftime (buffer,80,"%c", timeinfo);
 		printf ("Date is: %s\n", buffer);
         
 		char* source_file = argv[1];
-		FILE *fin = fopen(source_file, "rb");
+		decompressing_reader *fin = decompressing_reader_open(source_file, 4 << 20, 4);
         if (NULL == fin)
         {
             printf ("Null input file pointer from path: %s.\n", source_file);
@@ -40,25 +48,46 @@ int main(int argc, char **argv)
             return 1;
         }
         
-		int c;
-		while ((c = fgetc(fin)) != EOF)
+		/* Each decompressed block is filtered in place and written out whole. */
+		ascii_filter_init();
+		char *block;
+		long block_size;
+		int write_failed = 0;
+		while (!write_failed && (block_size = decompressing_reader_next(fin, &block)) > 0)
 		{
-			if (isprint(c) || c == '\n')
-			{
-				fputc(c, fout);
-			}
+			size_t kept = ascii_filter_block(block, block_size, block);
+			write_failed = (fwrite(block, 1, kept, fout) != kept);
+			free(block);
 		}
         
-        fclose(fin);
-		fclose(fout);
+        if (write_failed)
+        {
+            printf ("Failed to write destination file: %s.\n", destination_file);
+            decompressing_reader_close(fin);
+            fclose(fout);
+            return 1;
+        }
+        if (decompressing_reader_close(fin) != 0)
+        {
+            printf ("Corrupt or truncated input file: %s.\n", source_file);
+            fclose(fout);
+            return 1;
+        }
+		if (fclose(fout) != 0)
+		{
+			printf ("Failed to write destination file: %s.\n", destination_file);
+			return 1;
+		}
 
 		time ( &end_time );
 		timeinfo = localtime ( &end_time );
 		strftime (buffer, 80, "%c", timeinfo);
 		printf ("Date is: %s\n",buffer);
 		
-		duration_secs = difftime(end_time, start_time);
-		printf ("Duration/sec: %.f\n", duration_secs);
+		/* The wall clock only has whole seconds, so the duration comes from the monotonic clock. */
+		clock_gettime(CLOCK_MONOTONIC, &end_clock);
+		duration_secs = (end_clock.tv_sec - start_clock.tv_sec) + (end_clock.tv_nsec - start_clock.tv_nsec) / 1e9;
+		printf ("Duration/sec: %.3f\n", duration_secs);
 
 		printf ("Locale: %s\n", setlocale(LC_ALL, "") );
 		return 0;
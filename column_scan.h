@@ -0,0 +1,532 @@
+// Parallel scans of the columns of a file-backed big.matrix, the native equivalent of bigmemory's mwhich():
+// find the rows whose values meet a list of comparisons (ANDed or ORed together),
+// then fetch chosen columns at those rows in one batched pass per column.
+
+// The backing file is memory mapped read-only, so a scan reads the columns straight from the page cache.
+// The rows are scanned in blocks of scan_block_row_count rows, shared out among the threads.
+// Each comparison turns a block of a column into a bit per row, 32 rows to a word,
+// with AVX2 compares for integer columns (compile with -mavx2), and the words of the comparisons
+// are ANDed or ORed together before the rows are picked out, so later comparisons never branch per row.
+// char and short columns, as written by map_fields --column-types=narrow, are compared the same way
+// with a plain loop that the compiler vectorizes.
+// When the matrix has a zone map (see zone_map.h) a comparison that no value of a block can meet,
+// or that every value of it meets, is settled for the whole block without reading the column.
+
+// Typical use:
+//     mapped_big_matrix matrix;
+//     matrix.open("all.matrix.desc", error);
+//     std::vector<column_condition> conditions(1, column_condition(matrix.column_index("ActualElapsedTime"), compare_ge, 1800));
+//     std::vector<long> rows;
+//     scan_rows(matrix, conditions, false, thread_count, rows);
+//     std::vector<int> flight_numbers;
+//     gather_column(matrix, matrix.column_index("FlightNum"), rows, thread_count, flight_numbers);
+
+// Used from query_matrix.cpp, bitmap_index.h and group_aggregate.h.
+
+#ifndef COLUMN_SCAN_H
+#define COLUMN_SCAN_H
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "big_matrix_descriptor.h"
+#include "zone_map.h"
+
+// Rows per scan block: 2048 words of 32 rows, one zone of the zone map.
+const long scan_block_row_count = zone_block_row_count;
+
+// The comparisons of mwhich(), by the names it takes.
+enum comparison
+{
+    compare_eq,
+    compare_neq,
+    compare_lt,
+    compare_le,
+    compare_gt,
+    compare_ge,
+    comparison_count
+};
+
+const char* const comparison_names[comparison_count] = {"eq", "neq", "lt", "le", "gt", "ge"};
+
+// One comparison of a column's values with a constant, e.g. ActualElapsedTime ge 1800.
+struct column_condition
+{
+    long column_index;
+    comparison op;
+    int value;
+
+    column_condition(long column_index_, comparison op_, int value_) : column_index(column_index_), op(op_), value(value_) {}
+};
+
+// A file-backed big.matrix of char, short or integer values, memory mapped read-only.
+class mapped_big_matrix
+{
+public:
+    mapped_big_matrix() : m_data(NULL), m_size(0), m_element_size(0) {}
+    ~mapped_big_matrix() { close(); }
+
+    // Map the backing file of a descriptor file, e.g. all.matrix.desc.
+    bool open(const std::string& descriptor_file_path, std::string& error)
+    {
+        if (!read_big_matrix_descriptor(descriptor_file_path, m_descriptor, error))
+        {
+            return false;
+        }
+        if (m_descriptor.type_name != "char" && m_descriptor.type_name != "short" && m_descriptor.type_name != "integer")
+        {
+            error = "only char, short and integer matrices can be scanned";
+            return false;
+        }
+        m_element_size = big_matrix_element_size(m_descriptor.type_name);
+        m_backing_path = find_big_matrix_backing_path(descriptor_file_path, m_descriptor);
+
+        int file_descriptor = ::open(m_backing_path.c_str(), O_RDONLY);
+        struct stat file_status;
+        if (file_descriptor < 0 || fstat(file_descriptor, &file_status) != 0)
+        {
+            if (file_descriptor >= 0)
+            {
+                ::close(file_descriptor);
+            }
+            error = "cannot open the backing file " + m_backing_path;
+            return false;
+        }
+        m_size = (size_t)m_descriptor.row_count * m_descriptor.column_count * m_element_size;
+        if ((size_t)file_status.st_size < m_size)
+        {
+            ::close(file_descriptor);
+            error = "the backing file " + m_backing_path + " is smaller than its descriptor says";
+            return false;
+        }
+        if (m_size > 0)
+        {
+            void* mapping = mmap(NULL, m_size, PROT_READ, MAP_SHARED, file_descriptor, 0);
+            if (mapping == MAP_FAILED)
+            {
+                ::close(file_descriptor);
+                error = "cannot map the backing file " + m_backing_path;
+                return false;
+            }
+            m_data = static_cast<const char*>(mapping);
+        }
+        ::close(file_descriptor);
+
+        // The zone map is optional, a matrix without one is scanned in full.
+        zone_map_header header;
+        if (!read_zone_map(zone_map_path_for(m_backing_path), m_descriptor.row_count, m_descriptor.column_count, header, m_zones))
+        {
+            m_zones.clear();
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (m_data != NULL)
+        {
+            munmap(const_cast<char*>(m_data), m_size);
+            m_data = NULL;
+        }
+        m_size = 0;
+    }
+
+    // The index of a column from its name, or from its number counted from 1 as in R. -1 if there is no such column.
+    long column_index(const std::string& name) const
+    {
+        for (size_t column_index = 0; column_index < m_descriptor.column_names.size(); column_index++)
+        {
+            if (m_descriptor.column_names[column_index] == name)
+            {
+                return column_index;
+            }
+        }
+        char* end;
+        long number = strtol(name.c_str(), &end, 10);
+        if (!name.empty() && *end == '\0' && number >= 1 && number <= m_descriptor.column_count)
+        {
+            return number - 1;
+        }
+        return -1;
+    }
+
+    // The name of a column, or V1, V2, ... as R names the columns of a matrix without names.
+    std::string column_name(long column_index) const
+    {
+        if ((size_t)column_index < m_descriptor.column_names.size())
+        {
+            return m_descriptor.column_names[column_index];
+        }
+        return "V" + std::to_string(column_index + 1);
+    }
+
+    // The values of a column, row_count() of them of element_size() bytes each.
+    const char* column_data(long column_index) const { return m_data + (size_t)column_index * m_descriptor.row_count * m_element_size; }
+
+    // One value, widened to int.
+    int value(long column_index, long row_index) const
+    {
+        const char* column = column_data(column_index);
+        switch (m_element_size)
+        {
+        case 1:
+            return reinterpret_cast<const int8_t*>(column)[row_index];
+        case 2:
+            return reinterpret_cast<const int16_t*>(column)[row_index];
+        default:
+            return reinterpret_cast<const int32_t*>(column)[row_index];
+        }
+    }
+
+    // The zone map record of a block of a column, or NULL if there is no zone map
+    // or the block was not completely written when it was made.
+    const zone_record* zone(long column_index, long block_index) const
+    {
+        if (m_zones.empty())
+        {
+            return NULL;
+        }
+        const zone_record& record = m_zones[column_index * zone_block_count(m_descriptor.row_count) + block_index];
+        return record.row_count == (uint32_t)zone_block_rows(m_descriptor.row_count, block_index) ? &record : NULL;
+    }
+
+    bool has_zone_map() const { return !m_zones.empty(); }
+    long row_count() const { return m_descriptor.row_count; }
+    long column_count() const { return m_descriptor.column_count; }
+    size_t element_size() const { return m_element_size; }
+    const big_matrix_descriptor& descriptor() const { return m_descriptor; }
+    const std::string& backing_path() const { return m_backing_path; }
+
+private:
+    big_matrix_descriptor m_descriptor;
+    std::string m_backing_path;
+    const char* m_data;
+    size_t m_size;
+    size_t m_element_size;
+    std::vector<zone_record> m_zones;
+};
+
+template <comparison OP, typename T>
+inline bool compare_value(T value, int constant)
+{
+    switch (OP)
+    {
+    case compare_eq:
+        return value == constant;
+    case compare_neq:
+        return value != constant;
+    case compare_lt:
+        return value < constant;
+    case compare_le:
+        return value <= constant;
+    case compare_gt:
+        return value > constant;
+    default:
+        return value >= constant;
+    }
+}
+
+// What a zone map record says about a comparison on its block:
+// -1 if no value can meet it, 1 if every value meets it, 0 if the values must be compared.
+inline int zone_outcome(const zone_record& zone, comparison op, int constant)
+{
+    switch (op)
+    {
+    case compare_eq:
+        return constant < zone.min_value || constant > zone.max_value ? -1 : zone.min_value == constant && zone.max_value == constant ? 1 : 0;
+    case compare_neq:
+        return zone.min_value == constant && zone.max_value == constant ? -1 : constant < zone.min_value || constant > zone.max_value ? 1 : 0;
+    case compare_lt:
+        return zone.min_value >= constant ? -1 : zone.max_value < constant ? 1 : 0;
+    case compare_le:
+        return zone.min_value > constant ? -1 : zone.max_value <= constant ? 1 : 0;
+    case compare_gt:
+        return zone.max_value <= constant ? -1 : zone.min_value > constant ? 1 : 0;
+    default:
+        return zone.max_value < constant ? -1 : zone.min_value >= constant ? 1 : 0;
+    }
+}
+
+// Parse a condition written column:comparison:value, e.g. ActualElapsedTime:ge:1800 or 12:ge:1800.
+inline bool parse_column_condition(const mapped_big_matrix& matrix, const std::string& text, std::vector<column_condition>& conditions)
+{
+    std::string::size_type first_colon = text.find(':');
+    std::string::size_type second_colon = first_colon == std::string::npos ? std::string::npos : text.find(':', first_colon + 1);
+    if (second_colon == std::string::npos)
+    {
+        return false;
+    }
+    long column_index = matrix.column_index(text.substr(0, first_colon));
+    std::string comparison_name = text.substr(first_colon + 1, second_colon - first_colon - 1);
+    int op = 0;
+    while (op < comparison_count && comparison_name != comparison_names[op])
+    {
+        op++;
+    }
+    std::string value_text = text.substr(second_colon + 1);
+    char* end;
+    long value = strtol(value_text.c_str(), &end, 10);
+    if (column_index < 0 || op == comparison_count || value_text.empty() || *end != '\0' || value < INT_MIN || value > INT_MAX)
+    {
+        return false;
+    }
+    conditions.push_back(column_condition(column_index, comparison(op), int(value)));
+    return true;
+}
+
+#if defined(__AVX2__)
+// Compare 8 int32 values with the constant, giving a bit per value.
+template <comparison OP>
+inline uint32_t compare_8_values(const int32_t* values, __m256i constant)
+{
+    __m256i vector = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+    __m256i result;
+    switch (OP)
+    {
+    case compare_eq:
+    case compare_neq:
+        result = _mm256_cmpeq_epi32(vector, constant);
+        break;
+    case compare_gt:
+    case compare_le:
+        result = _mm256_cmpgt_epi32(vector, constant);
+        break;
+    default:
+        result = _mm256_cmpgt_epi32(constant, vector);
+        break;
+    }
+    uint32_t bits = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(result));
+    // neq, le and ge are the complements of eq, gt and lt.
+    return (OP == compare_neq || OP == compare_le || OP == compare_ge) ? ~bits & 0xFF : bits;
+}
+#endif
+
+// Compare count values with the constant into words of 32 bits, one bit per value, low bit first.
+template <comparison OP, typename T>
+void compare_into_words(const T* values, long count, int constant, uint32_t* words)
+{
+    long position = 0;
+#if defined(__AVX2__)
+    if (sizeof(T) == 4)
+    {
+        const int32_t* integers = reinterpret_cast<const int32_t*>(values);
+        __m256i constant_vector = _mm256_set1_epi32(constant);
+        for (; position + 32 <= count; position += 32)
+        {
+            words[position / 32] = compare_8_values<OP>(integers + position, constant_vector)
+                | compare_8_values<OP>(integers + position + 8, constant_vector) << 8
+                | compare_8_values<OP>(integers + position + 16, constant_vector) << 16
+                | compare_8_values<OP>(integers + position + 24, constant_vector) << 24;
+        }
+    }
+#endif
+    for (; position < count; position += 32)
+    {
+        long word_count = count - position < 32 ? count - position : 32;
+        uint32_t word = 0;
+        for (long index = 0; index < word_count; index++)
+        {
+            word |= uint32_t(compare_value<OP>(values[position + index], constant)) << index;
+        }
+        words[position / 32] = word;
+    }
+}
+
+template <typename T>
+void compare_into_words(const T* values, long count, comparison op, int constant, uint32_t* words)
+{
+    switch (op)
+    {
+    case compare_eq:
+        compare_into_words<compare_eq>(values, count, constant, words);
+        break;
+    case compare_neq:
+        compare_into_words<compare_neq>(values, count, constant, words);
+        break;
+    case compare_lt:
+        compare_into_words<compare_lt>(values, count, constant, words);
+        break;
+    case compare_le:
+        compare_into_words<compare_le>(values, count, constant, words);
+        break;
+    case compare_gt:
+        compare_into_words<compare_gt>(values, count, constant, words);
+        break;
+    default:
+        compare_into_words<compare_ge>(values, count, constant, words);
+        break;
+    }
+}
+
+// Evaluate the conditions on the rows of one block into words, a bit per row.
+// With any set a row needs to meet one of the conditions, otherwise all of them.
+// Returns false if the zone map settled the block without reading any column.
+inline bool scan_block(const mapped_big_matrix& matrix, const std::vector<column_condition>& conditions, bool any,
+                       long block_index, long row_count, std::vector<uint32_t>& words, std::vector<uint32_t>& condition_words)
+{
+    long first_row = block_index * scan_block_row_count;
+    long word_count = (row_count + 31) / 32;
+    auto fill_words = [&](bool value)
+    {
+        for (long word_index = 0; word_index < word_count; word_index++)
+        {
+            words[word_index] = !value ? 0 : row_count - word_index * 32 >= 32 ? ~0u : (1u << (row_count - word_index * 32)) - 1;
+        }
+    };
+    words.resize(word_count);
+    if (conditions.empty())
+    {
+        // No conditions: every row.
+        fill_words(true);
+        return true;
+    }
+
+    // A condition the zone map settles either settles the block (false for AND, true for OR)
+    // or drops out of it (true for AND, false for OR).
+    std::vector<const column_condition*> unsettled;
+    for (size_t condition_index = 0; condition_index < conditions.size(); condition_index++)
+    {
+        const column_condition& condition = conditions[condition_index];
+        const zone_record* zone = matrix.zone(condition.column_index, block_index);
+        int outcome = zone != NULL ? zone_outcome(*zone, condition.op, condition.value) : 0;
+        if (outcome == (any ? 1 : -1))
+        {
+            fill_words(any);
+            return false;
+        }
+        if (outcome == 0)
+        {
+            unsettled.push_back(&condition);
+        }
+    }
+    if (unsettled.empty())
+    {
+        fill_words(!any);
+        return false;
+    }
+
+    fill_words(!any);
+    condition_words.resize(word_count);
+    for (size_t condition_index = 0; condition_index < unsettled.size(); condition_index++)
+    {
+        const column_condition& condition = *unsettled[condition_index];
+        const char* column = matrix.column_data(condition.column_index);
+        switch (matrix.element_size())
+        {
+        case 1:
+            compare_into_words(reinterpret_cast<const int8_t*>(column) + first_row, row_count, condition.op, condition.value, &condition_words[0]);
+            break;
+        case 2:
+            compare_into_words(reinterpret_cast<const int16_t*>(column) + first_row, row_count, condition.op, condition.value, &condition_words[0]);
+            break;
+        default:
+            compare_into_words(reinterpret_cast<const int32_t*>(column) + first_row, row_count, condition.op, condition.value, &condition_words[0]);
+            break;
+        }
+        for (long word_index = 0; word_index < word_count; word_index++)
+        {
+            words[word_index] = any ? words[word_index] | condition_words[word_index] : words[word_index] & condition_words[word_index];
+        }
+    }
+    return true;
+}
+
+// Find the rows (from 0, in order) that meet the conditions, scanning blocks of rows on thread_count threads.
+// Returns the number of blocks the zone map settled without reading them.
+inline long scan_rows(const mapped_big_matrix& matrix, const std::vector<column_condition>& conditions, bool any,
+                      int thread_count, std::vector<long>& rows)
+{
+    long block_count = (matrix.row_count() + scan_block_row_count - 1) / scan_block_row_count;
+    std::vector<std::vector<long> > block_rows(block_count);
+    std::atomic<long> next_block(0);
+    std::atomic<long> settled_block_count(0);
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            std::vector<uint32_t> words;
+            std::vector<uint32_t> condition_words;
+            long block_index;
+            while ((block_index = next_block.fetch_add(1)) < block_count)
+            {
+                long first_row = block_index * scan_block_row_count;
+                long row_count = std::min(scan_block_row_count, matrix.row_count() - first_row);
+                if (!scan_block(matrix, conditions, any, block_index, row_count, words, condition_words))
+                {
+                    settled_block_count.fetch_add(1, std::memory_order_relaxed);
+                }
+                std::vector<long>& hits = block_rows[block_index];
+                for (size_t word_index = 0; word_index < words.size(); word_index++)
+                {
+                    uint32_t word = words[word_index];
+                    while (word != 0)
+                    {
+                        hits.push_back(first_row + word_index * 32 + __builtin_ctz(word));
+                        word &= word - 1;
+                    }
+                }
+            }
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+    }
+
+    size_t hit_count = 0;
+    for (long block_index = 0; block_index < block_count; block_index++)
+    {
+        hit_count += block_rows[block_index].size();
+    }
+    rows.clear();
+    rows.reserve(hit_count);
+    for (long block_index = 0; block_index < block_count; block_index++)
+    {
+        rows.insert(rows.end(), block_rows[block_index].begin(), block_rows[block_index].end());
+    }
+    return settled_block_count;
+}
+
+// Fetch the values of one column at the given rows, widened to int, on thread_count threads.
+// The rows are in order, so each thread walks its share of the column front to back.
+inline void gather_column(const mapped_big_matrix& matrix, long column_index, const std::vector<long>& rows,
+                          int thread_count, std::vector<int>& values)
+{
+    values.resize(rows.size());
+    const size_t share_size = (rows.size() + thread_count - 1) / thread_count;
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        size_t begin = std::min(rows.size(), thread_index * share_size);
+        size_t end = std::min(rows.size(), begin + share_size);
+        workers.push_back(std::thread([&matrix, &rows, &values, column_index, begin, end]()
+        {
+            for (size_t index = begin; index < end; index++)
+            {
+                values[index] = matrix.value(column_index, rows[index]);
+            }
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+    }
+}
+
+#endif // COLUMN_SCAN_H
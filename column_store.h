@@ -0,0 +1,651 @@
+// A block-compressed column store of the converted airline data, an alternative to the raw int32 big.matrix
+// written by map_fields --format=columnstore. Many columns are mostly the missing value (the delay causes before 2003)
+// or repeat the same few values, so they shrink to a small fraction of 4 bytes a value.
+
+// Each column is cut into blocks of at most column_store_block_row_count rows, and each block is encoded
+// in whichever of these takes the least space:
+//     frame of reference  the block's smallest value, then every value less that, bit-packed
+//     delta               the first value and the smallest difference between neighbours, then every difference less that, bit-packed
+//     run length          the runs of equal values, their values and lengths each as a frame of reference, bit-packed
+// A block of one repeated value, e.g. a column of missing values, packs to 0 bits a value: just its header.
+// The bits are packed 8 lanes wide: value i of a group of 256 is in lane i % 8, and word k of the 8 lanes lies
+// in 8 consecutive 32 bit words, so an AVX2 decoder unpacks 8 values with each shift and mask (compile with -mavx2).
+
+// The file, e.g. 2008.columns, is a column_store_header, the encoded blocks, the column names (one per line),
+// and the block directory: a column_block_entry per block, ordered by column and first row,
+// so any range of rows of any column is found and decoded without reading the rest of the file.
+// materialize_matrix.cpp turns a column store back into a plain big.matrix for R.
+
+// Used from map_string_fields.cpp and materialize_matrix.cpp.
+
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+const long column_store_block_row_count = 65536;
+
+// Values are bit-packed in groups of this many, 32 to each of 8 lanes.
+const long packed_group_size = 256;
+
+enum column_block_encoding
+{
+    frame_of_reference_encoding,
+    delta_encoding,
+    run_length_encoding
+};
+
+struct column_store_header
+{
+    char magic[8];              // "COLSTOR1"
+    int64_t row_count;
+    int64_t column_count;
+    int64_t block_count;
+    int64_t names_offset;       // The column names, one per line.
+    int64_t names_size;
+    int64_t directory_offset;
+    int32_t missing_value;
+    int32_t reserved;
+};
+
+struct column_block_entry
+{
+    int64_t column_index;
+    int64_t first_row;
+    int64_t offset;
+    uint32_t row_count;
+    uint32_t size;
+};
+
+// The headers of the encoded blocks, followed by their packed values.
+struct frame_of_reference_block
+{
+    uint8_t encoding;
+    uint8_t width;
+    uint16_t reserved;
+    int32_t reference;
+};
+
+struct delta_block
+{
+    uint8_t encoding;
+    uint8_t width;
+    uint16_t reserved;
+    int32_t first_value;
+    int32_t min_delta;
+    int32_t reserved2;
+};
+
+struct run_length_block
+{
+    uint8_t encoding;
+    uint8_t value_width;
+    uint8_t length_width;
+    uint8_t reserved;
+    int32_t run_count;
+    int32_t value_reference;
+    int32_t length_reference;
+};
+
+const char column_store_magic[8] = {'C', 'O', 'L', 'S', 'T', 'O', 'R', '1'};
+
+// The bits needed for offsets up to range.
+inline int packed_width(uint32_t range)
+{
+    return range == 0 ? 0 : 32 - __builtin_clz(range);
+}
+
+// The bytes taken by count values packed width bits each, in whole groups.
+inline size_t packed_size(long count, int width)
+{
+    return (count + packed_group_size - 1) / packed_group_size * width * 32;
+}
+
+// Pack count offsets of width bits each into words, zeroed and packed_size(count, width) bytes long.
+inline void pack_values(const uint32_t* offsets, long count, int width, uint32_t* words)
+{
+    if (width == 0)
+    {
+        return;
+    }
+    for (long index = 0; index < count; index++)
+    {
+        long group = index / packed_group_size;
+        long lane = index % 8;
+        long bit = (index % packed_group_size) / 8 * width;
+        uint32_t* lane_words = words + group * width * 8 + lane;
+        uint64_t value = offsets[index];
+        lane_words[(bit >> 5) * 8] |= uint32_t(value << (bit & 31));
+        if ((bit & 31) + width > 32)
+        {
+            lane_words[((bit >> 5) + 1) * 8] |= uint32_t(value >> (32 - (bit & 31)));
+        }
+    }
+}
+
+// Unpack one group of 256 values of width bits, adding reference to each.
+inline void unpack_group(const uint32_t* words, int width, uint32_t reference, int32_t* values)
+{
+    if (width == 0)
+    {
+        std::fill(values, values + packed_group_size, int32_t(reference));
+        return;
+    }
+    const uint32_t mask = width == 32 ? ~0u : (1u << width) - 1;
+#if defined(__AVX2__)
+    const __m256i mask_vector = _mm256_set1_epi32(int(mask));
+    const __m256i reference_vector = _mm256_set1_epi32(int(reference));
+    for (int row = 0; row < 32; row++)
+    {
+        int bit = row * width;
+        int shift = bit & 31;
+        const uint32_t* low_words = words + (bit >> 5) * 8;
+        __m256i value = _mm256_srl_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(low_words)), _mm_cvtsi32_si128(shift));
+        if (shift + width > 32)
+        {
+            __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(low_words + 8));
+            value = _mm256_or_si256(value, _mm256_sll_epi32(high, _mm_cvtsi32_si128(32 - shift)));
+        }
+        value = _mm256_add_epi32(_mm256_and_si256(value, mask_vector), reference_vector);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + row * 8), value);
+    }
+#else
+    for (int row = 0; row < 32; row++)
+    {
+        int bit = row * width;
+        int shift = bit & 31;
+        const uint32_t* low_words = words + (bit >> 5) * 8;
+        for (int lane = 0; lane < 8; lane++)
+        {
+            uint32_t value = low_words[lane] >> shift;
+            if (shift + width > 32)
+            {
+                value |= low_words[lane + 8] << (32 - shift);
+            }
+            values[row * 8 + lane] = int32_t((value & mask) + reference);
+        }
+    }
+#endif
+}
+
+// Unpack count values of width bits, adding reference to each.
+inline void unpack_values(const uint32_t* words, long count, int width, uint32_t reference, int32_t* values)
+{
+    long whole_groups = count / packed_group_size;
+    for (long group = 0; group < whole_groups; group++)
+    {
+        unpack_group(words + group * width * 8, width, reference, values + group * packed_group_size);
+    }
+    if (count % packed_group_size != 0)
+    {
+        int32_t last_group[packed_group_size];
+        unpack_group(words + whole_groups * width * 8, width, reference, last_group);
+        std::copy(last_group, last_group + count % packed_group_size, values + whole_groups * packed_group_size);
+    }
+}
+
+// Unpack the single value at index.
+inline uint32_t unpack_value(const uint32_t* words, int width, long index)
+{
+    if (width == 0)
+    {
+        return 0;
+    }
+    long bit = (index % packed_group_size) / 8 * width;
+    const uint32_t* lane_words = words + index / packed_group_size * width * 8 + index % 8;
+    uint64_t value = lane_words[(bit >> 5) * 8] >> (bit & 31);
+    if ((bit & 31) + width > 32)
+    {
+        value |= uint64_t(lane_words[((bit >> 5) + 1) * 8]) << (32 - (bit & 31));
+    }
+    return uint32_t(value) & (width == 32 ? ~0u : (1u << width) - 1);
+}
+
+// Encode a block of count values of one column into block, in the encoding that takes the least space.
+inline void encode_column_block(const int32_t* values, long count, std::vector<char>& block)
+{
+    // Frame of reference.
+    int32_t min_value = count > 0 ? values[0] : 0;
+    int32_t max_value = min_value;
+    for (long index = 0; index < count; index++)
+    {
+        min_value = std::min(min_value, values[index]);
+        max_value = std::max(max_value, values[index]);
+    }
+    int value_width = packed_width(uint32_t(max_value) - uint32_t(min_value));
+    size_t frame_of_reference_size = sizeof(frame_of_reference_block) + packed_size(count, value_width);
+
+    // Delta, when the differences between neighbours fit an int32.
+    int64_t min_delta = INT32_MAX;
+    int64_t max_delta = INT32_MIN;
+    for (long index = 1; index < count; index++)
+    {
+        int64_t delta = int64_t(values[index]) - values[index - 1];
+        min_delta = std::min(min_delta, delta);
+        max_delta = std::max(max_delta, delta);
+    }
+    min_delta = count > 1 ? min_delta : 0;
+    max_delta = count > 1 ? max_delta : 0;
+    bool delta_fits = min_delta >= INT32_MIN && max_delta - min_delta <= UINT32_MAX;
+    int delta_width = delta_fits ? packed_width(uint32_t(max_delta - min_delta)) : 32;
+    size_t delta_size = delta_fits ? sizeof(delta_block) + packed_size(count - 1, delta_width) : SIZE_MAX;
+
+    // Run length.
+    long run_count = 0;
+    uint32_t max_length = 0;
+    uint32_t min_length = UINT32_MAX;
+    for (long index = 0; index < count; )
+    {
+        long run_end = index + 1;
+        while (run_end < count && values[run_end] == values[index])
+        {
+            run_end++;
+        }
+        min_length = std::min(min_length, uint32_t(run_end - index));
+        max_length = std::max(max_length, uint32_t(run_end - index));
+        run_count++;
+        index = run_end;
+    }
+    min_length = run_count > 0 ? min_length : 0;
+    int length_width = packed_width(max_length - min_length);
+    size_t run_length_size = sizeof(run_length_block) + packed_size(run_count, value_width) + packed_size(run_count, length_width);
+
+    std::vector<uint32_t> offsets;
+    if (frame_of_reference_size <= delta_size && frame_of_reference_size <= run_length_size)
+    {
+        block.assign(frame_of_reference_size, 0);
+        frame_of_reference_block header = {frame_of_reference_encoding, uint8_t(value_width), 0, min_value};
+        memcpy(&block[0], &header, sizeof(header));
+        offsets.resize(count);
+        for (long index = 0; index < count; index++)
+        {
+            offsets[index] = uint32_t(values[index]) - uint32_t(min_value);
+        }
+        pack_values(offsets.data(), count, value_width, reinterpret_cast<uint32_t*>(&block[sizeof(header)]));
+    }
+    else if (delta_size <= run_length_size)
+    {
+        block.assign(delta_size, 0);
+        delta_block header = {delta_encoding, uint8_t(delta_width), 0, values[0], int32_t(min_delta), 0};
+        memcpy(&block[0], &header, sizeof(header));
+        offsets.resize(count - 1);
+        for (long index = 1; index < count; index++)
+        {
+            offsets[index - 1] = uint32_t(int64_t(values[index]) - values[index - 1] - min_delta);
+        }
+        pack_values(offsets.data(), count - 1, delta_width, reinterpret_cast<uint32_t*>(&block[sizeof(header)]));
+    }
+    else
+    {
+        block.assign(run_length_size, 0);
+        run_length_block header = {run_length_encoding, uint8_t(value_width), uint8_t(length_width), 0,
+                                   int32_t(run_count), min_value, int32_t(min_length)};
+        memcpy(&block[0], &header, sizeof(header));
+        std::vector<uint32_t> lengths;
+        offsets.reserve(run_count);
+        lengths.reserve(run_count);
+        for (long index = 0; index < count; )
+        {
+            long run_end = index + 1;
+            while (run_end < count && values[run_end] == values[index])
+            {
+                run_end++;
+            }
+            offsets.push_back(uint32_t(values[index]) - uint32_t(min_value));
+            lengths.push_back(uint32_t(run_end - index) - min_length);
+            index = run_end;
+        }
+        uint32_t* value_words = reinterpret_cast<uint32_t*>(&block[sizeof(header)]);
+        pack_values(offsets.data(), run_count, value_width, value_words);
+        pack_values(lengths.data(), run_count, length_width,
+                    reinterpret_cast<uint32_t*>(&block[sizeof(header) + packed_size(run_count, value_width)]));
+    }
+}
+
+// Decode a block of count values. scratch is reused between calls for the runs of run length blocks.
+inline void decode_column_block(const char* block, long count, int32_t* values, std::vector<int32_t>& scratch)
+{
+    switch (uint8_t(block[0]))
+    {
+    case frame_of_reference_encoding:
+    {
+        frame_of_reference_block header;
+        memcpy(&header, block, sizeof(header));
+        unpack_values(reinterpret_cast<const uint32_t*>(block + sizeof(header)), count, header.width, uint32_t(header.reference), values);
+        break;
+    }
+    case delta_encoding:
+    {
+        delta_block header;
+        memcpy(&header, block, sizeof(header));
+        if (count == 0)
+        {
+            break;
+        }
+        values[0] = header.first_value;
+        unpack_values(reinterpret_cast<const uint32_t*>(block + sizeof(header)), count - 1, header.width, uint32_t(header.min_delta), values + 1);
+        for (long index = 1; index < count; index++)
+        {
+            values[index] = int32_t(uint32_t(values[index - 1]) + uint32_t(values[index]));
+        }
+        break;
+    }
+    default:
+    {
+        run_length_block header;
+        memcpy(&header, block, sizeof(header));
+        scratch.resize(2 * header.run_count);
+        int32_t* run_values = scratch.data();
+        int32_t* run_lengths = scratch.data() + header.run_count;
+        const uint32_t* value_words = reinterpret_cast<const uint32_t*>(block + sizeof(header));
+        unpack_values(value_words, header.run_count, header.value_width, uint32_t(header.value_reference), run_values);
+        unpack_values(reinterpret_cast<const uint32_t*>(block + sizeof(header) + packed_size(header.run_count, header.value_width)),
+                      header.run_count, header.length_width, uint32_t(header.length_reference), run_lengths);
+        long row = 0;
+        for (int32_t run_index = 0; run_index < header.run_count && row < count; run_index++)
+        {
+            long run_end = std::min(count, row + run_lengths[run_index]);
+            std::fill(values + row, values + run_end, run_values[run_index]);
+            row = run_end;
+        }
+        break;
+    }
+    }
+}
+
+// Writes a column store file from any number of threads, each block appended where an atomic
+// end of file offset says, and its directory entry gathered under a lock until close().
+class column_store_writer
+{
+public:
+    column_store_writer() : m_file_descriptor(-1), m_column_count(0), m_missing_value(0), m_end(sizeof(column_store_header)), m_failed(false) {}
+    ~column_store_writer()
+    {
+        if (m_file_descriptor >= 0)
+        {
+            ::close(m_file_descriptor);
+        }
+    }
+
+    bool create(const char* column_store_file_name, long column_count, int missing_value)
+    {
+        m_file_descriptor = ::open(column_store_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        m_column_count = column_count;
+        m_missing_value = missing_value;
+        return m_file_descriptor >= 0;
+    }
+
+    // Encode and append count values of a column, starting at first_row, using block as the encoding buffer.
+    bool write_block(long column_index, long first_row, const int32_t* values, long count, std::vector<char>& block)
+    {
+        encode_column_block(values, count, block);
+        int64_t offset = m_end.fetch_add(block.size());
+        if (!write_all(block.data(), block.size(), offset))
+        {
+            m_failed = true;
+            return false;
+        }
+        column_block_entry entry = {column_index, first_row, offset, uint32_t(count), uint32_t(block.size())};
+        std::lock_guard<std::mutex> lock(m_directory_mutex);
+        m_directory.push_back(entry);
+        return true;
+    }
+
+    // Write the column names, the directory and the header, and close the file, first forcing it out to disk with sync.
+    bool close(long row_count, const std::vector<std::string>& column_names, bool sync = false)
+    {
+        std::sort(m_directory.begin(), m_directory.end(), [](const column_block_entry& left, const column_block_entry& right)
+        {
+            return left.column_index != right.column_index ? left.column_index < right.column_index : left.first_row < right.first_row;
+        });
+        std::string names;
+        for (size_t column_index = 0; column_index < column_names.size(); column_index++)
+        {
+            names += column_names[column_index] + "\n";
+        }
+        column_store_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, column_store_magic, sizeof(header.magic));
+        header.row_count = row_count;
+        header.column_count = m_column_count;
+        header.block_count = m_directory.size();
+        header.names_offset = m_end;
+        header.names_size = names.size();
+        header.directory_offset = (header.names_offset + header.names_size + 7) / 8 * 8;
+        header.missing_value = m_missing_value;
+        bool ok = !m_failed
+            && write_all(names.data(), names.size(), header.names_offset)
+            && write_all(m_directory.data(), m_directory.size() * sizeof(column_block_entry), header.directory_offset)
+            && write_all(&header, sizeof(header), 0)
+            && ftruncate(m_file_descriptor, header.directory_offset + m_directory.size() * sizeof(column_block_entry)) == 0
+            && (!sync || fsync(m_file_descriptor) == 0);
+        ok = (::close(m_file_descriptor) == 0) && ok;
+        m_file_descriptor = -1;
+        m_end = header.directory_offset + m_directory.size() * sizeof(column_block_entry);
+        return ok;
+    }
+
+    // The bytes written so far, the whole file once closed.
+    int64_t size() const { return m_end; }
+
+private:
+    bool write_all(const void* data, size_t size, int64_t offset)
+    {
+        const char* position = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            ssize_t written = pwrite(m_file_descriptor, position, size, offset);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return false;
+            }
+            position += written;
+            size -= written;
+            offset += written;
+        }
+        return true;
+    }
+
+    int m_file_descriptor;
+    long m_column_count;
+    int m_missing_value;
+    std::atomic<int64_t> m_end;
+    std::atomic<bool> m_failed;
+    std::mutex m_directory_mutex;
+    std::vector<column_block_entry> m_directory;
+};
+
+// A column store file, memory mapped read-only. Blocks are decoded on demand;
+// the last block decoded is kept, so reading a column in order decodes each block once.
+// A reader is for one thread at a time, as the kept block is shared.
+class column_store_reader
+{
+public:
+    column_store_reader() : m_data(NULL), m_size(0), m_cached_block(-1) {}
+    ~column_store_reader() { close(); }
+
+    bool open(const std::string& column_store_file_name, std::string& error)
+    {
+        int file_descriptor = ::open(column_store_file_name.c_str(), O_RDONLY);
+        struct stat file_status;
+        if (file_descriptor < 0 || fstat(file_descriptor, &file_status) != 0)
+        {
+            if (file_descriptor >= 0)
+            {
+                ::close(file_descriptor);
+            }
+            error = "cannot open the file";
+            return false;
+        }
+        m_size = file_status.st_size;
+        void* mapping = m_size >= sizeof(column_store_header) ? mmap(NULL, m_size, PROT_READ, MAP_SHARED, file_descriptor, 0) : MAP_FAILED;
+        ::close(file_descriptor);
+        if (mapping == MAP_FAILED)
+        {
+            m_size = 0;
+            error = "cannot map the file";
+            return false;
+        }
+        m_data = static_cast<const char*>(mapping);
+        memcpy(&m_header, m_data, sizeof(m_header));
+        if (memcmp(m_header.magic, column_store_magic, sizeof(m_header.magic)) != 0
+            || m_header.names_offset + m_header.names_size > (int64_t)m_size
+            || m_header.directory_offset + m_header.block_count * (int64_t)sizeof(column_block_entry) > (int64_t)m_size)
+        {
+            close();
+            error = "not a column store file";
+            return false;
+        }
+        m_column_names.clear();
+        std::stringstream names(std::string(m_data + m_header.names_offset, m_header.names_size));
+        std::string name;
+        while (std::getline(names, name))
+        {
+            m_column_names.push_back(name);
+        }
+
+        // Each column's blocks must tile its rows, so every row is found in exactly one block.
+        const column_block_entry* entries = directory();
+        m_column_blocks.assign(m_header.column_count + 1, 0);
+        long block_index = 0;
+        for (long column_index = 0; column_index < m_header.column_count; column_index++)
+        {
+            m_column_blocks[column_index] = block_index;
+            long next_row = 0;
+            for (; block_index < m_header.block_count && entries[block_index].column_index == column_index; block_index++)
+            {
+                if (entries[block_index].first_row != next_row || entries[block_index].offset + entries[block_index].size > (int64_t)m_size)
+                {
+                    close();
+                    error = "the block directory does not cover the rows of column " + std::to_string(column_index + 1);
+                    return false;
+                }
+                next_row += entries[block_index].row_count;
+            }
+            if (next_row != m_header.row_count)
+            {
+                close();
+                error = "the block directory does not cover the rows of column " + std::to_string(column_index + 1);
+                return false;
+            }
+        }
+        m_column_blocks[m_header.column_count] = block_index;
+        return true;
+    }
+
+    void close()
+    {
+        if (m_data != NULL)
+        {
+            munmap(const_cast<char*>(m_data), m_size);
+            m_data = NULL;
+        }
+        m_size = 0;
+        m_cached_block = -1;
+    }
+
+    long row_count() const { return m_header.row_count; }
+    long column_count() const { return m_header.column_count; }
+    int missing_value() const { return m_header.missing_value; }
+    const std::vector<std::string>& column_names() const { return m_column_names; }
+    size_t file_size() const { return m_size; }
+
+    long block_count() const { return m_header.block_count; }
+    const column_block_entry& block(long block_index) const { return directory()[block_index]; }
+
+    // Decode one block into values, block(block_index).row_count of them.
+    void decode_block(long block_index, int32_t* values, std::vector<int32_t>& scratch) const
+    {
+        const column_block_entry& entry = directory()[block_index];
+        decode_column_block(m_data + entry.offset, entry.row_count, values, scratch);
+    }
+
+    // Read count values of a column starting at first_row.
+    void read(long column_index, long first_row, long count, int32_t* values)
+    {
+        while (count > 0)
+        {
+            long block_index = find_block(column_index, first_row);
+            const int32_t* block_values = cached_block(block_index);
+            const column_block_entry& entry = directory()[block_index];
+            long offset = first_row - entry.first_row;
+            long taken = std::min(count, long(entry.row_count) - offset);
+            std::copy(block_values + offset, block_values + offset + taken, values);
+            values += taken;
+            first_row += taken;
+            count -= taken;
+        }
+    }
+
+    // One value. Frame of reference blocks are read in place, the others are decoded whole.
+    int32_t value(long column_index, long row_index)
+    {
+        long block_index = find_block(column_index, row_index);
+        const column_block_entry& entry = directory()[block_index];
+        if (block_index != m_cached_block && uint8_t(m_data[entry.offset]) == frame_of_reference_encoding)
+        {
+            frame_of_reference_block header;
+            memcpy(&header, m_data + entry.offset, sizeof(header));
+            const uint32_t* words = reinterpret_cast<const uint32_t*>(m_data + entry.offset + sizeof(header));
+            return int32_t(unpack_value(words, header.width, row_index - entry.first_row) + uint32_t(header.reference));
+        }
+        return cached_block(block_index)[row_index - entry.first_row];
+    }
+
+private:
+    const column_block_entry* directory() const { return reinterpret_cast<const column_block_entry*>(m_data + m_header.directory_offset); }
+
+    // The block of a column holding a row.
+    long find_block(long column_index, long row_index) const
+    {
+        const column_block_entry* begin = directory() + m_column_blocks[column_index];
+        const column_block_entry* end = directory() + m_column_blocks[column_index + 1];
+        const column_block_entry* found = std::upper_bound(begin, end, row_index,
+            [](long row, const column_block_entry& entry) { return row < entry.first_row; });
+        return (found - directory()) - 1;
+    }
+
+    const int32_t* cached_block(long block_index)
+    {
+        if (block_index != m_cached_block)
+        {
+            m_cached_values.resize(directory()[block_index].row_count);
+            decode_block(block_index, m_cached_values.data(), m_scratch);
+            m_cached_block = block_index;
+        }
+        return m_cached_values.data();
+    }
+
+    const char* m_data;
+    size_t m_size;
+    column_store_header m_header;
+    std::vector<std::string> m_column_names;
+    std::vector<long> m_column_blocks;      // The first block of each column in the directory.
+    long m_cached_block;
+    std::vector<int32_t> m_cached_values;
+    std::vector<int32_t> m_scratch;
+};
+
+#endif // COLUMN_STORE_H
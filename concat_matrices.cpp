@@ -0,0 +1,378 @@
+// Concatenate the yearly file-backed big.matrices into one, e.g. all.matrix,
+// without going through R. This replaces the row by row copy in tutorial_bigmemory_4.R.
+
+// Each yearly matrix is described by its descriptor file (YYYY.desc), which gives its row count.
+// The rows of the combined matrix are the rows of each year in turn, so in the column-major
+// backing file column c of year y lands at row offset (rows of the years before y) of column c.
+// The combined backing file is preallocated at its final size, then every (year, column) slice
+// is copied straight from file to file by a pool of threads, with copy_file_range() where the
+// file system supports it and pread()/pwrite() where it does not. Finally the combined descriptor is written.
+
+// If every yearly matrix has a zone map (YYYY.matrix.zones, see zone_map.h) the combined zone map is built too.
+// The yearly blocks do not line up with the blocks of the combined rows, so it is built from the values
+// as they pass through pread()/pwrite(), rather than with copy_file_range().
+// Likewise if every yearly matrix has a bitmap index (YYYY.matrix.bitmaps, see bitmap_index.h),
+// the same columns of the combined matrix are indexed once it is written.
+
+// The yearly matrices must have the same type and column count; char, short, integer, float and double
+// matrices can all be concatenated, e.g. the 2008.short.matrix groups written with --column-types=narrow.
+
+// To compile this c++ program on linux:
+//     g++ -W -std=c++17 -O2 -pthread concat_matrices.cpp -o concat_matrices
+// Run it with:
+//     $ ./concat_matrices [--threads N] [destination_filename] [source_descriptor_filename]...
+// e.g.
+//     $ ./concat_matrices --threads 8 big_matrices/all.matrix big_matrices/{1987..2008}.desc
+// which writes big_matrices/all.matrix and the descriptor big_matrices/all.matrix.desc
+// used by tutorial_bigmemory_5.R and tutorial_bigmemory_6.R.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "big_matrix_descriptor.h"
+#include "bitmap_index.h"
+#include "zone_map.h"
+
+// A yearly matrix to copy in.
+struct source_matrix
+{
+    std::string descriptor_path;
+    std::string backing_path;
+    big_matrix_descriptor descriptor;
+    long first_row;     // Row offset in the combined matrix.
+    int file_descriptor;
+};
+
+// Copy size bytes from one file offset to another, in the kernel when the file system allows it.
+// Otherwise the bytes are read into buffer and passed to record(data, size, destination_offset) on the way.
+template <class RECORD>
+bool copy_range(int source_file, off_t source_offset, int destination_file, off_t destination_offset, size_t size,
+                std::vector<char>& buffer, bool& use_copy_file_range, RECORD record)
+{
+    while (size > 0 && use_copy_file_range)
+    {
+        loff_t input_offset = source_offset;
+        loff_t output_offset = destination_offset;
+        ssize_t copied = copy_file_range(source_file, &input_offset, destination_file, &output_offset, size, 0);
+        if (copied < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (copied <= 0)
+        {
+            // Not supported between these files (e.g. EXDEV, ENOSYS, EINVAL), or a short source file:
+            // carry on with plain reads and writes, which report the real error if there is one.
+            use_copy_file_range = false;
+            break;
+        }
+        source_offset += copied;
+        destination_offset += copied;
+        size -= copied;
+    }
+
+    while (size > 0)
+    {
+        // Fill the buffer completely, so the values handed to record() are whole.
+        size_t piece_size = std::min(size, buffer.size());
+        size_t read_size = 0;
+        while (read_size < piece_size)
+        {
+            ssize_t count = pread(source_file, &buffer[read_size], piece_size - read_size, source_offset + read_size);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            read_size += count;
+        }
+        record(&buffer[0], piece_size, destination_offset);
+
+        size_t written_size = 0;
+        while (written_size < piece_size)
+        {
+            ssize_t count = pwrite(destination_file, &buffer[written_size], piece_size - written_size, destination_offset + written_size);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            written_size += count;
+        }
+        source_offset += piece_size;
+        destination_offset += piece_size;
+        size -= piece_size;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int thread_count = 1;
+    std::vector<char*> arguments;
+    for (int argument_index = 1; argument_index < argc; argument_index++)
+    {
+        std::string argument = argv[argument_index];
+        if (argument == "--threads" && argument_index + 1 < argc)
+        {
+            argument = std::string("--threads=") + argv[++argument_index];
+        }
+        if (argument.compare(0, 10, "--threads=") == 0)
+        {
+            thread_count = atoi(argument.c_str() + 10);
+            if (thread_count < 1)
+            {
+                std::cout << "Invalid thread count: " << argument << std::endl;
+                return 1;
+            }
+        }
+        else if (argument.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option: " << argument << std::endl;
+            return 1;
+        }
+        else
+        {
+            arguments.push_back(argv[argument_index]);
+        }
+    }
+
+    if (arguments.size() < 2)
+    {
+        std::cout << "Use: ./concat_matrices [--threads N] [destination_filename] [source_descriptor_filename]..." << std::endl;
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start_clock = std::chrono::steady_clock::now();
+
+    // Read the yearly descriptors and lay the years out one after another.
+
+    std::vector<source_matrix> sources(arguments.size() - 1);
+    long total_row_count = 0;
+    for (size_t source_index = 0; source_index < sources.size(); source_index++)
+    {
+        source_matrix& source = sources[source_index];
+        source.descriptor_path = arguments[source_index + 1];
+        std::string error;
+        if (!read_big_matrix_descriptor(source.descriptor_path, source.descriptor, error))
+        {
+            std::cout << "Invalid descriptor file " << source.descriptor_path << ": " << error << std::endl;
+            return 1;
+        }
+        const big_matrix_descriptor& first = sources[0].descriptor;
+        if (source.descriptor.type_name != first.type_name || source.descriptor.column_count != first.column_count)
+        {
+            std::cout << "Descriptor file " << source.descriptor_path << " does not match " << sources[0].descriptor_path
+                << ": " << source.descriptor.column_count << " " << source.descriptor.type_name << " columns instead of "
+                << first.column_count << " " << first.type_name << std::endl;
+            return 1;
+        }
+        if (!source.descriptor.column_names.empty() && !first.column_names.empty() && source.descriptor.column_names != first.column_names)
+        {
+            std::cout << "Warning: the column names of " << source.descriptor_path << " differ from " << sources[0].descriptor_path << std::endl;
+        }
+
+        source.backing_path = find_big_matrix_backing_path(source.descriptor_path, source.descriptor);
+        source.file_descriptor = open(source.backing_path.c_str(), O_RDONLY);
+        struct stat status;
+        if (source.file_descriptor < 0 || fstat(source.file_descriptor, &status) != 0)
+        {
+            std::cout << "Null input file pointer from path: " << source.backing_path << std::endl;
+            return 1;
+        }
+        off_t expected_size = (off_t)source.descriptor.row_count * source.descriptor.column_count
+            * big_matrix_element_size(source.descriptor.type_name);
+        if (status.st_size < expected_size)
+        {
+            std::cout << "Backing file " << source.backing_path << " is " << status.st_size
+                << " bytes, smaller than its descriptor says: " << expected_size << std::endl;
+            return 1;
+        }
+
+        source.first_row = total_row_count;
+        total_row_count += source.descriptor.row_count;
+        std::cout << "Source: " << source.backing_path << ", rows " << source.first_row + 1 << " to " << total_row_count << std::endl;
+    }
+
+    const big_matrix_descriptor& layout = sources[0].descriptor;
+    const long column_count = layout.column_count;
+    const size_t element_size = big_matrix_element_size(layout.type_name);
+    std::cout << "Row count: " << total_row_count << ", column count: " << column_count << ", type: " << layout.type_name << std::endl;
+
+    // Zone maps are kept for the types that map_fields writes, and only built if every year has one.
+    bool build_zone_map = layout.type_name == "char" || layout.type_name == "short" || layout.type_name == "integer";
+    int missing_value = 0;
+    for (size_t source_index = 0; source_index < sources.size() && build_zone_map; source_index++)
+    {
+        const source_matrix& source = sources[source_index];
+        zone_map_header header;
+        std::vector<zone_record> records;
+        build_zone_map = read_zone_map(zone_map_path_for(source.backing_path), source.descriptor.row_count,
+                                       source.descriptor.column_count, header, records)
+            && (source_index == 0 || header.missing_value == missing_value);
+        missing_value = header.missing_value;
+    }
+    zone_map_builder zones;
+    if (build_zone_map)
+    {
+        zones.reset(total_row_count, column_count, missing_value);
+    }
+
+    // Preallocate the combined backing file so the copies never extend it.
+
+    char* destination_file_name = arguments[0];
+    std::cout << "Destination file path: " << destination_file_name << std::endl;
+    int destination_file = open(destination_file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (destination_file < 0)
+    {
+        std::cout << "Null output file pointer from path: " << destination_file_name << std::endl;
+        return 1;
+    }
+    off_t destination_size = (off_t)total_row_count * column_count * element_size;
+    int allocation_status = posix_fallocate(destination_file, 0, destination_size);
+    if (allocation_status != 0 && ftruncate(destination_file, destination_size) != 0)
+    {
+        std::cout << "Failed to allocate " << destination_size << " bytes for: " << destination_file_name << std::endl;
+        return 1;
+    }
+
+    // Copy the (source, column) slices in parallel, each to its place in the combined file.
+
+    std::cout << "Thread count: " << thread_count << std::endl;
+    const size_t slice_count = sources.size() * column_count;
+    std::atomic<size_t> next_slice(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            std::vector<char> buffer(8 << 20);
+            bool use_copy_file_range = !build_zone_map;
+            size_t slice_index;
+            while (!failed && (slice_index = next_slice.fetch_add(1)) < slice_count)
+            {
+                const source_matrix& source = sources[slice_index % sources.size()];
+                long column_index = slice_index / sources.size();
+                off_t source_offset = (off_t)column_index * source.descriptor.row_count * element_size;
+                off_t destination_offset = ((off_t)column_index * total_row_count + source.first_row) * element_size;
+                auto record = [&](const char* data, size_t size, off_t offset)
+                {
+                    long first_row = offset / element_size - column_index * total_row_count;
+                    switch (element_size)
+                    {
+                    case 1:
+                        zones.record(column_index, first_row, reinterpret_cast<const int8_t*>(data), size);
+                        break;
+                    case 2:
+                        zones.record(column_index, first_row, reinterpret_cast<const int16_t*>(data), size / 2);
+                        break;
+                    default:
+                        zones.record(column_index, first_row, reinterpret_cast<const int32_t*>(data), size / 4);
+                        break;
+                    }
+                };
+                if (!copy_range(source.file_descriptor, source_offset, destination_file, destination_offset,
+                                source.descriptor.row_count * element_size, buffer, use_copy_file_range, record))
+                {
+                    failed = true;
+                }
+            }
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+    }
+    for (size_t source_index = 0; source_index < sources.size(); source_index++)
+    {
+        close(sources[source_index].file_descriptor);
+    }
+    if (close(destination_file) != 0 || failed)
+    {
+        std::cout << "Failed to copy into the destination file: " << destination_file_name << std::endl;
+        return 1;
+    }
+
+    // The combined descriptor, named as tutorial_bigmemory_4.R names it: all.matrix -> all.matrix.desc
+
+    std::string descriptor_file_name = std::string(destination_file_name) + ".desc";
+    std::cout << "Descriptor file path: " << descriptor_file_name << std::endl;
+    if (!write_big_matrix_descriptor(descriptor_file_name, destination_file_name, total_row_count,
+                                     layout.column_names, layout.type_name.c_str()))
+    {
+        std::cout << "Null output file pointer from path: " << descriptor_file_name << std::endl;
+        return 1;
+    }
+
+    // A zone map left from an earlier run would no longer match the matrix.
+    std::string zone_map_file_name = zone_map_path_for(destination_file_name);
+    if (build_zone_map)
+    {
+        std::cout << "Zone map file path: " << zone_map_file_name << std::endl;
+        if (!zones.write(zone_map_file_name))
+        {
+            std::cout << "Null output file pointer from path: " << zone_map_file_name << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        unlink(zone_map_file_name.c_str());
+    }
+    double copy_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+
+    // The bitmap index of the columns the yearly matrices are indexed on, which the first one's index names.
+    std::string bitmap_columns;
+    bool build_bitmaps = true;
+    for (size_t source_index = 0; source_index < sources.size() && build_bitmaps; source_index++)
+    {
+        const source_matrix& source = sources[source_index];
+        bitmap_index index;
+        build_bitmaps = index.open(bitmap_index_path_for(source.backing_path), source.descriptor.row_count, source.descriptor.column_count);
+        std::vector<long> indexed_columns = index.column_indexes();
+        for (size_t index_column = 0; index_column < indexed_columns.size() && source_index == 0; index_column++)
+        {
+            bitmap_columns += (index_column > 0 ? "," : "") + std::to_string(indexed_columns[index_column] + 1);
+        }
+    }
+    std::string bitmap_file_name = bitmap_index_path_for(destination_file_name);
+    unlink(bitmap_file_name.c_str());
+    if (build_bitmaps)
+    {
+        std::vector<std::string> skipped_columns;
+        std::cout << "Bitmap index file path: " << bitmap_file_name << std::endl;
+        if (!build_bitmap_index_for(descriptor_file_name, bitmap_columns, thread_count, bitmap_file_name, skipped_columns))
+        {
+            std::cout << "Null output file pointer from path: " << bitmap_file_name << std::endl;
+            return 1;
+        }
+        for (size_t column_index = 0; column_index < skipped_columns.size(); column_index++)
+        {
+            std::cout << "Too many values to index column: " << skipped_columns[column_index] << std::endl;
+        }
+    }
+
+    double duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+    printf ("Duration/sec: %.3f\n", duration_secs);
+    printf ("Copy rate MB/s: %.1f\n", destination_size / 1e6 / (copy_secs > 0 ? copy_secs : 1e-9));
+    return 0;
+}
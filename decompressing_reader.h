@@ -0,0 +1,368 @@
+/* Streaming decompression of the raw airline data files (YYYY.csv.bz2, or .gz)
+   so they can be read without first unpacking them onto disk.
+
+   A reader thread decompresses the file into blocks of about block_size bytes
+   and hands them to the consumer through a bounded queue,
+   so decompression runs on its own core overlapping with whatever the consumer does.
+   The format is picked from the leading magic bytes: "BZh" for bzip2, 1f 8b for gzip,
+   anything else is passed through unchanged.
+   Concatenated streams (as written by pbzip2 or cat a.gz b.gz) are read to the end.
+
+   Used from both clean_to_ascii.c and map_string_fields.cpp, so it is plain C.
+   Link with: -pthread -lbz2 -lz
+
+   Typical use:
+       decompressing_reader* reader = decompressing_reader_open(path, 4 << 20, 4);
+       char* block;
+       long size;
+       while ((size = decompressing_reader_next(reader, &block)) > 0)
+       {
+           ... use block[0 .. size) ...
+           free(block);
+       }
+       if (decompressing_reader_close(reader) != 0) ... the file was truncated or corrupt ...
+*/
+
+#ifndef DECOMPRESSING_READER_H
+#define DECOMPRESSING_READER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <bzlib.h>
+#include <zlib.h>
+
+enum decompressing_reader_format
+{
+    DECOMPRESSING_READER_PLAIN = 0,
+    DECOMPRESSING_READER_BZIP2 = 1,
+    DECOMPRESSING_READER_GZIP = 2
+};
+
+typedef struct decompressed_block
+{
+    char* data;
+    long size;
+} decompressed_block;
+
+typedef struct decompressing_reader
+{
+    FILE* file;
+    int format;
+    size_t block_size;
+
+    /* Bounded ring of decompressed blocks between the reader thread and the consumer. */
+    decompressed_block* queue;
+    int queue_capacity;
+    int queue_head;
+    int queue_count;
+    int finished;       /* The reader thread has queued its last block. */
+    int failed;         /* The compressed data was corrupt or could not be read. */
+    int cancelled;      /* The consumer closed the reader early. */
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_t thread;
+} decompressing_reader;
+
+/* Peek at the magic bytes of a file to find its compression format, -1 if it cannot be opened. */
+static int decompressing_reader_detect_format(const char* file_name)
+{
+    unsigned char magic[3] = {0, 0, 0};
+    FILE* file = fopen(file_name, "rb");
+    if (NULL == file)
+    {
+        return -1;
+    }
+    size_t magic_size = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    if (magic_size == 3 && magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h')
+    {
+        return DECOMPRESSING_READER_BZIP2;
+    }
+    if (magic_size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    {
+        return DECOMPRESSING_READER_GZIP;
+    }
+    return DECOMPRESSING_READER_PLAIN;
+}
+
+/* Queue a full block, waiting while the queue is full. Returns 0 if the consumer has gone away. */
+static int decompressing_reader_push(decompressing_reader* reader, char* data, long size)
+{
+    pthread_mutex_lock(&reader->mutex);
+    while (reader->queue_count == reader->queue_capacity && !reader->cancelled)
+    {
+        pthread_cond_wait(&reader->not_full, &reader->mutex);
+    }
+    if (reader->cancelled)
+    {
+        pthread_mutex_unlock(&reader->mutex);
+        free(data);
+        return 0;
+    }
+    int tail = (reader->queue_head + reader->queue_count) % reader->queue_capacity;
+    reader->queue[tail].data = data;
+    reader->queue[tail].size = size;
+    reader->queue_count++;
+    pthread_cond_signal(&reader->not_empty);
+    pthread_mutex_unlock(&reader->mutex);
+    return 1;
+}
+
+/* The reader thread: decompress the whole file into blocks. */
+static void* decompressing_reader_run(void* argument)
+{
+    decompressing_reader* reader = (decompressing_reader*)argument;
+    size_t input_size = 1 << 20;
+    char* input = (char*)malloc(input_size);
+    char* output = (char*)malloc(reader->block_size);
+    size_t input_offset = 0;
+    size_t input_available = 0;
+    size_t output_used = 0;
+    int failed = (NULL == input || NULL == output);
+    int cancelled = 0;
+    int input_ended = 0;
+    int stream_open = 0;
+    bz_stream bzip2_stream;
+    z_stream gzip_stream;
+
+    while (!failed)
+    {
+        /* Refill the compressed input once it has all been consumed. */
+        if (input_available == 0 && !input_ended)
+        {
+            input_offset = 0;
+            input_available = fread(input, 1, input_size, reader->file);
+            if (input_available == 0)
+            {
+                input_ended = 1;
+                failed = ferror(reader->file) != 0;
+                continue;
+            }
+        }
+
+        size_t output_space = reader->block_size - output_used;
+        size_t produced = 0;
+        if (reader->format == DECOMPRESSING_READER_PLAIN)
+        {
+            if (input_available == 0)
+            {
+                break;
+            }
+            produced = output_space < input_available ? output_space : input_available;
+            memcpy(output + output_used, input + input_offset, produced);
+            input_offset += produced;
+            input_available -= produced;
+        }
+        else
+        {
+            if (!stream_open)
+            {
+                if (input_available == 0)
+                {
+                    /* Clean end after the last stream. */
+                    break;
+                }
+                if (reader->format == DECOMPRESSING_READER_BZIP2)
+                {
+                    memset(&bzip2_stream, 0, sizeof(bzip2_stream));
+                    failed = BZ2_bzDecompressInit(&bzip2_stream, 0, 0) != BZ_OK;
+                }
+                else
+                {
+                    memset(&gzip_stream, 0, sizeof(gzip_stream));
+                    failed = inflateInit2(&gzip_stream, 15 + 16) != Z_OK;
+                }
+                if (failed)
+                {
+                    break;
+                }
+                stream_open = 1;
+            }
+
+            int stream_ended;
+            int stream_failed;
+            size_t input_left;
+            if (reader->format == DECOMPRESSING_READER_BZIP2)
+            {
+                bzip2_stream.next_in = input + input_offset;
+                bzip2_stream.avail_in = input_available;
+                bzip2_stream.next_out = output + output_used;
+                bzip2_stream.avail_out = output_space;
+                int status = BZ2_bzDecompress(&bzip2_stream);
+                input_left = bzip2_stream.avail_in;
+                produced = output_space - bzip2_stream.avail_out;
+                stream_ended = (status == BZ_STREAM_END);
+                stream_failed = (status != BZ_OK && status != BZ_STREAM_END);
+                if (stream_ended || stream_failed)
+                {
+                    BZ2_bzDecompressEnd(&bzip2_stream);
+                }
+            }
+            else
+            {
+                gzip_stream.next_in = (Bytef*)(input + input_offset);
+                gzip_stream.avail_in = input_available;
+                gzip_stream.next_out = (Bytef*)(output + output_used);
+                gzip_stream.avail_out = output_space;
+                int status = inflate(&gzip_stream, Z_NO_FLUSH);
+                input_left = gzip_stream.avail_in;
+                produced = output_space - gzip_stream.avail_out;
+                stream_ended = (status == Z_STREAM_END);
+                stream_failed = (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR);
+                if (stream_ended || stream_failed)
+                {
+                    inflateEnd(&gzip_stream);
+                }
+            }
+            input_offset += input_available - input_left;
+            input_available = input_left;
+            if (stream_ended || stream_failed)
+            {
+                /* Another stream may follow this one. */
+                stream_open = 0;
+            }
+            /* The file ending part way through a stream leaves the decompressor stuck. */
+            failed = stream_failed || (stream_open && input_ended && input_available == 0 && produced == 0);
+        }
+        output_used += produced;
+
+        /* Hand over each full block. */
+        if (output_used == reader->block_size)
+        {
+            if (!decompressing_reader_push(reader, output, output_used))
+            {
+                output = NULL;
+                cancelled = 1;
+                break;
+            }
+            output = (char*)malloc(reader->block_size);
+            failed = (NULL == output);
+            output_used = 0;
+        }
+    }
+
+    if (stream_open)
+    {
+        if (reader->format == DECOMPRESSING_READER_BZIP2)
+        {
+            BZ2_bzDecompressEnd(&bzip2_stream);
+        }
+        else
+        {
+            inflateEnd(&gzip_stream);
+        }
+        failed = failed || !cancelled;
+    }
+
+    /* And the final partial block. */
+    if (!failed && !cancelled && output_used > 0)
+    {
+        decompressing_reader_push(reader, output, output_used);
+        output = NULL;
+    }
+    free(output);
+    free(input);
+
+    pthread_mutex_lock(&reader->mutex);
+    reader->finished = 1;
+    reader->failed = failed;
+    pthread_cond_broadcast(&reader->not_empty);
+    pthread_mutex_unlock(&reader->mutex);
+    return NULL;
+}
+
+/* Open a (possibly compressed) file and start decompressing it on its own thread.
+   block_size is the size of the decompressed blocks handed out,
+   queue_length the number of blocks that may be waiting for the consumer. */
+static decompressing_reader* decompressing_reader_open(const char* file_name, size_t block_size, int queue_length)
+{
+    int format = decompressing_reader_detect_format(file_name);
+    if (format < 0)
+    {
+        return NULL;
+    }
+    decompressing_reader* reader = (decompressing_reader*)calloc(1, sizeof(decompressing_reader));
+    if (NULL == reader)
+    {
+        return NULL;
+    }
+    reader->file = fopen(file_name, "rb");
+    reader->format = format;
+    reader->block_size = block_size;
+    reader->queue_capacity = queue_length > 0 ? queue_length : 1;
+    reader->queue = (decompressed_block*)calloc(reader->queue_capacity, sizeof(decompressed_block));
+    if (NULL == reader->file || NULL == reader->queue)
+    {
+        if (reader->file != NULL)
+        {
+            fclose(reader->file);
+        }
+        free(reader->queue);
+        free(reader);
+        return NULL;
+    }
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->not_empty, NULL);
+    pthread_cond_init(&reader->not_full, NULL);
+    pthread_create(&reader->thread, NULL, decompressing_reader_run, reader);
+    return reader;
+}
+
+/* Wait for the next decompressed block. The caller owns *block and must free() it.
+   Returns the block size, 0 at the end of the data or -1 if the data is corrupt. */
+static long decompressing_reader_next(decompressing_reader* reader, char** block)
+{
+    long size;
+    pthread_mutex_lock(&reader->mutex);
+    while (reader->queue_count == 0 && !reader->finished)
+    {
+        pthread_cond_wait(&reader->not_empty, &reader->mutex);
+    }
+    if (reader->queue_count == 0)
+    {
+        *block = NULL;
+        size = reader->failed ? -1 : 0;
+    }
+    else
+    {
+        *block = reader->queue[reader->queue_head].data;
+        size = reader->queue[reader->queue_head].size;
+        reader->queue_head = (reader->queue_head + 1) % reader->queue_capacity;
+        reader->queue_count--;
+        pthread_cond_signal(&reader->not_full);
+    }
+    pthread_mutex_unlock(&reader->mutex);
+    return size;
+}
+
+/* Stop the reader thread and release everything. Returns non-zero if the data was corrupt. */
+static int decompressing_reader_close(decompressing_reader* reader)
+{
+    pthread_mutex_lock(&reader->mutex);
+    reader->cancelled = 1;
+    pthread_cond_broadcast(&reader->not_full);
+    pthread_mutex_unlock(&reader->mutex);
+    pthread_join(reader->thread, NULL);
+
+    int failed = reader->failed;
+    while (reader->queue_count > 0)
+    {
+        free(reader->queue[reader->queue_head].data);
+        reader->queue_head = (reader->queue_head + 1) % reader->queue_capacity;
+        reader->queue_count--;
+    }
+    pthread_cond_destroy(&reader->not_full);
+    pthread_cond_destroy(&reader->not_empty);
+    pthread_mutex_destroy(&reader->mutex);
+    fclose(reader->file);
+    free(reader->queue);
+    free(reader);
+    return failed;
+}
+
+#endif /* DECOMPRESSING_READER_H */
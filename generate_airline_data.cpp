@@ -0,0 +1,444 @@
+// Generate a synthetic airline data file in the 29 column format of:
+// http://stat-computing.org/dataexpo/2009/the-data.html
+// together with matching carriers.csv, airports.csv and plane-data.csv reference files,
+// so map_fields can be benchmarked and checked without the real data set.
+
+// The output is fully determined by the options, including the seed,
+// so the same file can be regenerated anywhere to compare timings.
+// Rows are in date order through the year as in the real files,
+// codes are drawn with a skew towards the low indices so a few carriers and airports dominate,
+// and a fraction of codes can be left out of the reference data to exercise the missing value path.
+// The unknown codes are drawn from a pool of --unknown-codes=N codes per column just past the reference data,
+// so a large pool gives the high cardinality unknowns that --extend-dictionaries has to number.
+
+// To compile this c++ program on linux:
+//     g++ -W -std=c++17 -O2 generate_airline_data.cpp -o generate_airline_data
+// Run it with:
+//     $ ./generate_airline_data [--rows=N] [--seed=N] [--year=N] [--na-rate=P] [--unknown-rate=P] [--unknown-codes=N]
+//           [--carriers=N] [--airports=N] [--aircraft=N] [destination_filename] [reference_data_path]
+// e.g. 7 million rows like a real year, with the reference files written to ./reference/:
+//     $ ./generate_airline_data --rows=7000000 2008.csv reference/
+// and then:
+//     $ ./map_fields --benchmark 2008.csv 2008.csv.mapped reference/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <charconv>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// splitmix64, so the sequence does not depend on the standard library's distributions.
+class random_source
+{
+public:
+    explicit random_source(uint64_t seed) : m_state(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [low, high].
+    long uniform(long low, long high)
+    {
+        return low + (long)(next() % (uint64_t)(high - low + 1));
+    }
+
+    // Uniform in [0, 1).
+    double fraction()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // In [0, count), skewed towards 0: the square of a uniform fraction.
+    long skewed(long count)
+    {
+        double u = fraction();
+        return (long)(u * u * count);
+    }
+
+private:
+    uint64_t m_state;
+};
+
+// The code of the index'th carrier, airport or aircraft.
+// Carriers are 2 alphanumeric characters, airports 3 letters, tail numbers N, 3 digits and 2 letters.
+std::string carrier_code(long index)
+{
+    const char alphanumeric[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::string code;
+    code += alphanumeric[(index / 36) % 36];
+    code += alphanumeric[index % 36];
+    return code;
+}
+
+std::string airport_code(long index)
+{
+    std::string code;
+    code += char('A' + (index / (26 * 26)) % 26);
+    code += char('A' + (index / 26) % 26);
+    code += char('A' + index % 26);
+    return code;
+}
+
+std::string aircraft_code(long index)
+{
+    char code[8];
+    snprintf(code, sizeof(code), "N%03ld%c%c", (index / (26 * 26)) % 1000, char('A' + (index / 26) % 26), char('A' + index % 26));
+    return code;
+}
+
+// Write the reference files for the first count codes of each kind.
+bool write_reference_data(const std::string& reference_data_path, long carrier_count, long airport_count, long aircraft_count)
+{
+    std::string carrier_file_name = reference_data_path + "carriers.csv";
+    FILE* carrier_file = fopen(carrier_file_name.c_str(), "w");
+    if (NULL == carrier_file)
+    {
+        std::cout << "Null output file pointer from path: " << carrier_file_name << std::endl;
+        return false;
+    }
+    fprintf(carrier_file, "Code,Description\n");
+    for (long index = 0; index < carrier_count; index++)
+    {
+        fprintf(carrier_file, "\"%s\",\"Carrier %ld\"\n", carrier_code(index).c_str(), index);
+    }
+    fclose(carrier_file);
+
+    std::string airport_file_name = reference_data_path + "airports.csv";
+    FILE* airport_file = fopen(airport_file_name.c_str(), "w");
+    if (NULL == airport_file)
+    {
+        std::cout << "Null output file pointer from path: " << airport_file_name << std::endl;
+        return false;
+    }
+    fprintf(airport_file, "\"iata\",\"airport\",\"city\",\"state\",\"country\",\"lat\",\"long\"\n");
+    for (long index = 0; index < airport_count; index++)
+    {
+        fprintf(airport_file, "\"%s\",\"Airport %ld\",\"City\",\"CA\",\"USA\",32.7,-117.1\n", airport_code(index).c_str(), index);
+    }
+    fclose(airport_file);
+
+    std::string aircraft_file_name = reference_data_path + "plane-data.csv";
+    FILE* aircraft_file = fopen(aircraft_file_name.c_str(), "w");
+    if (NULL == aircraft_file)
+    {
+        std::cout << "Null output file pointer from path: " << aircraft_file_name << std::endl;
+        return false;
+    }
+    fprintf(aircraft_file, "tailnum,type,manufacturer,issue_date,model,status,aircraft_type,engine_type,year\n");
+    for (long index = 0; index < aircraft_count; index++)
+    {
+        fprintf(aircraft_file, "%s,Corporation,BOEING,11/14/1986,737,Valid,Fixed Wing,Turbo-Fan,1986\n", aircraft_code(index).c_str());
+    }
+    fclose(aircraft_file);
+    return true;
+}
+
+// Builds one csv row at a time in a buffer.
+class row_builder
+{
+public:
+    explicit row_builder(random_source& random, double na_rate) : m_random(random), m_na_rate(na_rate) {}
+
+    void clear() { m_row.clear(); }
+
+    void add(long value)
+    {
+        char digits[24];
+        char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        separate();
+        m_row.append(digits, end);
+    }
+
+    void add(const std::string& text)
+    {
+        separate();
+        m_row += text;
+    }
+
+    // A value that is NA at the configured rate.
+    void add_or_na(long value)
+    {
+        if (m_random.fraction() < m_na_rate)
+        {
+            add(std::string("NA"));
+        }
+        else
+        {
+            add(value);
+        }
+    }
+
+    const std::string& row() { m_row += '\n'; return m_row; }
+
+private:
+    void separate()
+    {
+        if (!m_row.empty())
+        {
+            m_row += ',';
+        }
+    }
+
+    random_source& m_random;
+    double m_na_rate;
+    std::string m_row;
+};
+
+// A local time as hhmm, a given number of minutes after another one.
+long add_minutes(long hhmm, long minutes)
+{
+    long total = (hhmm / 100) * 60 + hhmm % 100 + minutes;
+    total = ((total % 1440) + 1440) % 1440;
+    return (total / 60) * 100 + total % 60;
+}
+
+int main(int argc, char **argv)
+{
+    long row_count = 100000;
+    uint64_t seed = 2009;
+    long year = 2008;
+    double na_rate = 0.05;
+    double unknown_rate = 0.001;
+    long unknown_code_count = 1000;
+    long carrier_count = 20;
+    long airport_count = 300;
+    long aircraft_count = 5000;
+
+    // Options start with "--", the rest are positional arguments.
+    std::vector<char*> arguments;
+    for (int argument_index = 1; argument_index < argc; argument_index++)
+    {
+        std::string argument = argv[argument_index];
+        std::string::size_type equals_position = argument.find('=');
+        std::string name = argument.substr(0, equals_position);
+        const char* value = equals_position == std::string::npos ? "" : argv[argument_index] + equals_position + 1;
+        if (argument.compare(0, 2, "--") != 0)
+        {
+            arguments.push_back(argv[argument_index]);
+        }
+        else if (name == "--rows")
+        {
+            row_count = atol(value);
+        }
+        else if (name == "--seed")
+        {
+            seed = strtoull(value, NULL, 10);
+        }
+        else if (name == "--year")
+        {
+            year = atol(value);
+        }
+        else if (name == "--na-rate")
+        {
+            na_rate = atof(value);
+        }
+        else if (name == "--unknown-rate")
+        {
+            unknown_rate = atof(value);
+        }
+        else if (name == "--unknown-codes")
+        {
+            unknown_code_count = atol(value);
+        }
+        else if (name == "--carriers")
+        {
+            carrier_count = atol(value);
+        }
+        else if (name == "--airports")
+        {
+            airport_count = atol(value);
+        }
+        else if (name == "--aircraft")
+        {
+            aircraft_count = atol(value);
+        }
+        else
+        {
+            std::cout << "Unknown option: " << argument << std::endl;
+            return 1;
+        }
+    }
+
+    if ((arguments.size() != 1 && arguments.size() != 2) || row_count < 0 || unknown_code_count < 1
+        || carrier_count < 1 || carrier_count > 36 * 36 || airport_count < 1 || airport_count > 26 * 26 * 26
+        || aircraft_count < 1 || aircraft_count > 1000 * 26 * 26)
+    {
+        std::cout << "Use: ./generate_airline_data [--rows=N] [--seed=N] [--year=N] [--na-rate=P] [--unknown-rate=P] [--unknown-codes=N] "
+            "[--carriers=N] [--airports=N] [--aircraft=N] [destination_filename] [reference_data_path]" << std::endl;
+        std::cout << "Code counts are limited to 1296 carriers, 17576 airports and 676000 aircraft." << std::endl;
+        return 1;
+    }
+
+    if (arguments.size() == 2)
+    {
+        std::string reference_data_path = arguments[1];
+        std::cout << "Reference data folder path: " << reference_data_path << std::endl;
+        if (!write_reference_data(reference_data_path, carrier_count, airport_count, aircraft_count))
+        {
+            return 1;
+        }
+    }
+
+    char* destination_file_name = arguments[0];
+    std::cout << "Destination file path: " << destination_file_name << std::endl;
+    FILE* destination_file = fopen(destination_file_name, "w");
+    if (NULL == destination_file)
+    {
+        std::cout << "Null output file pointer from path: " << destination_file_name << std::endl;
+        return 1;
+    }
+    std::vector<char> output_buffer(1 << 20);
+    setvbuf(destination_file, &output_buffer[0], _IOFBF, output_buffer.size());
+    fputs("Year,Month,DayofMonth,DayOfWeek,DepTime,CRSDepTime,ArrTime,CRSArrTime,"
+        "UniqueCarrier,FlightNum,TailNum,ActualElapsedTime,CRSElapsedTime,AirTime,ArrDelay,DepDelay,"
+        "Origin,Dest,Distance,TaxiIn,TaxiOut,Cancelled,CancellationCode,Diverted,"
+        "CarrierDelay,WeatherDelay,NASDelay,SecurityDelay,LateAircraftDelay\n", destination_file);
+
+    random_source random(seed);
+    row_builder row(random, na_rate);
+    const char* cancellation_codes[] = {"A", "B", "C", "D"};
+    const int month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    // At the unknown rate, the index of a code past the known_count in the reference data,
+    // one of the pool of unknown codes that fit below code_limit, otherwise -1.
+    auto unknown_code = [&](long known_count, long code_limit) -> long
+    {
+        long pool_count = code_limit - known_count < unknown_code_count ? code_limit - known_count : unknown_code_count;
+        if (pool_count < 1 || random.fraction() >= unknown_rate)
+        {
+            return -1;
+        }
+        return known_count + random.uniform(0, pool_count - 1);
+    };
+
+    for (long row_index = 0; row_index < row_count; row_index++)
+    {
+        // Spread the rows evenly over the days of the year.
+        long day_of_year = row_count > 0 ? row_index * 365 / row_count : 0;
+        int month = 0;
+        while (day_of_year >= month_days[month])
+        {
+            day_of_year -= month_days[month];
+            month++;
+        }
+        long day_of_month = day_of_year + 1;
+        long day_of_week = (row_index * 365 / row_count) % 7 + 1;
+
+        // Each code is unknown to the reference data at the unknown rate, independently of the others.
+        long carrier = unknown_code(carrier_count, 36 * 36);
+        if (carrier < 0)
+        {
+            carrier = random.skewed(carrier_count);
+        }
+        long origin = random.skewed(airport_count);
+        long destination = (origin + 1 + random.skewed(airport_count - 1 > 0 ? airport_count - 1 : 1)) % airport_count;
+        long unknown_origin = unknown_code(airport_count, 26 * 26 * 26);
+        long unknown_destination = unknown_code(airport_count, 26 * 26 * 26);
+        origin = unknown_origin < 0 ? origin : unknown_origin;
+        destination = unknown_destination < 0 ? destination : unknown_destination;
+        long aircraft = unknown_code(aircraft_count, 1000 * 26 * 26);
+        if (aircraft < 0)
+        {
+            aircraft = random.uniform(0, aircraft_count - 1);
+        }
+
+        bool cancelled = random.fraction() < 0.02;
+        bool diverted = !cancelled && random.fraction() < 0.002;
+        long crs_dep_time = add_minutes(500, random.uniform(0, 19 * 60));
+        long crs_elapsed_time = random.uniform(30, 400);
+        long crs_arr_time = add_minutes(crs_dep_time, crs_elapsed_time);
+        long dep_delay = random.uniform(-10, 10) + (random.fraction() < 0.2 ? random.uniform(0, 180) : 0);
+        long arr_delay = dep_delay + random.uniform(-15, 15);
+        long taxi_out = random.uniform(5, 40);
+        long taxi_in = random.uniform(2, 20);
+        long actual_elapsed_time = crs_elapsed_time + arr_delay - dep_delay;
+        long air_time = actual_elapsed_time - taxi_out - taxi_in;
+        bool delay_causes = arr_delay >= 15;
+
+        row.clear();
+        row.add(year);
+        row.add(month + 1);
+        row.add(day_of_month);
+        row.add(day_of_week);
+        if (cancelled)
+        {
+            row.add(std::string("NA"));
+        }
+        else
+        {
+            row.add_or_na(add_minutes(crs_dep_time, dep_delay));
+        }
+        row.add(crs_dep_time);
+        if (cancelled || diverted)
+        {
+            row.add(std::string("NA"));
+        }
+        else
+        {
+            row.add_or_na(add_minutes(crs_arr_time, arr_delay));
+        }
+        row.add(crs_arr_time);
+
+        row.add(carrier_code(carrier));
+        row.add(random.uniform(1, 9999));
+        row.add(random.fraction() < na_rate ? std::string("NA") : aircraft_code(aircraft));
+        if (cancelled || diverted)
+        {
+            row.add(std::string("NA"));
+            row.add(crs_elapsed_time);
+            row.add(std::string("NA"));
+            row.add(std::string("NA"));
+            row.add(cancelled ? std::string("NA") : std::to_string(dep_delay));
+        }
+        else
+        {
+            row.add_or_na(actual_elapsed_time);
+            row.add(crs_elapsed_time);
+            row.add_or_na(air_time);
+            row.add_or_na(arr_delay);
+            row.add_or_na(dep_delay);
+        }
+
+        row.add(airport_code(origin));
+        row.add(airport_code(destination));
+        row.add(random.uniform(50, 4900));
+        row.add_or_na(taxi_in);
+        row.add_or_na(taxi_out);
+
+        row.add(cancelled ? 1 : 0);
+        row.add(cancelled ? std::string(cancellation_codes[random.uniform(0, 3)]) : std::string("NA"));
+        row.add(diverted ? 1 : 0);
+        long delay_cause = random.uniform(0, 4);
+        for (int cause = 0; cause < 5; cause++)
+        {
+            if (delay_causes)
+            {
+                row.add(cause == delay_cause ? arr_delay : 0);
+            }
+            else
+            {
+                row.add(std::string("NA"));
+            }
+        }
+
+        const std::string& line = row.row();
+        fwrite(line.data(), 1, line.size(), destination_file);
+    }
+
+    bool written = (fclose(destination_file) == 0);
+    if (!written)
+    {
+        std::cout << "Failed to write destination file: " << destination_file_name << std::endl;
+        return 1;
+    }
+    std::cout << "Row count: " << row_count << std::endl;
+    return 0;
+}
@@ -0,0 +1,352 @@
+// Group-by aggregation over a file-backed big.matrix, the native equivalent of bigtabulate's bigtsummary()
+// and of tapply() over the columns of all.matrix, e.g. the mean ArrDelay by UniqueCarrier by Month.
+
+// map_fields maps the carriers, airports and other codes to small dense integers, so the groups need no hashing:
+// each combination of group values is a slot in plain arrays, slot = sum of (value - smallest value) * stride
+// over the group columns, the first group column varying slowest so the slots come out in sorted order.
+// Each thread scans blocks of rows (the blocks of column_scan.h, which the filter conditions are evaluated on),
+// computes the slots of the block's rows once per grouping, then adds every aggregate column into its own
+// count/sum/min/max accumulators. The threads' accumulators are merged once the scan is done.
+// Several groupings and any number of aggregate columns are answered by one pass over the matrix.
+
+// The value ranges of the group columns come from the matrix's zone map when it has one, otherwise from a scan.
+// The missing value (-1 as map_fields writes it) is counted apart: it is a group of its own in a group column,
+// and in an aggregate column it is left out of the count, sum, min and max and counted as missing instead.
+
+// Typical use:
+//     std::vector<group_by> groupings(1);
+//     plan_group_by(matrix, {matrix.column_index("UniqueCarrier"), matrix.column_index("Month")}, thread_count, groupings[0], error);
+//     aggregate_rows(matrix, groupings, {matrix.column_index("ArrDelay")}, -1, conditions, false, thread_count, settled_block_count);
+//     groupings[0].totals.sums[aggregate_index * groupings[0].slot_count + slot] ...
+
+// Used from aggregate_matrix.cpp.
+
+#ifndef GROUP_AGGREGATE_H
+#define GROUP_AGGREGATE_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "column_scan.h"
+
+// The accumulators of all the threads together may take this much memory at most.
+const long dense_accumulator_byte_limit = 2L << 30;
+
+// The accumulators of one grouping, one slot per combination of group values.
+// The aggregate accumulators are aggregate by aggregate, slot_count() long each.
+struct group_accumulators
+{
+    std::vector<int64_t> row_counts;    // The rows in the group.
+    std::vector<int64_t> counts;        // The values that are not missing.
+    std::vector<int64_t> sums;
+    std::vector<int32_t> min_values;
+    std::vector<int32_t> max_values;
+
+    void reset(long slot_count, size_t aggregate_count)
+    {
+        row_counts.assign(slot_count, 0);
+        counts.assign(slot_count * aggregate_count, 0);
+        sums.assign(slot_count * aggregate_count, 0);
+        min_values.assign(slot_count * aggregate_count, INT_MAX);
+        max_values.assign(slot_count * aggregate_count, INT_MIN);
+    }
+
+    void merge(const group_accumulators& other)
+    {
+        for (size_t slot = 0; slot < row_counts.size(); slot++)
+        {
+            row_counts[slot] += other.row_counts[slot];
+        }
+        for (size_t index = 0; index < counts.size(); index++)
+        {
+            counts[index] += other.counts[index];
+            sums[index] += other.sums[index];
+            min_values[index] = other.min_values[index] < min_values[index] ? other.min_values[index] : min_values[index];
+            max_values[index] = other.max_values[index] > max_values[index] ? other.max_values[index] : max_values[index];
+        }
+    }
+
+    // Bytes per slot for aggregate_count aggregates.
+    static long slot_size(size_t aggregate_count) { return sizeof(int64_t) + aggregate_count * (2 * sizeof(int64_t) + 2 * sizeof(int32_t)); }
+};
+
+// One grouping: its columns, the dense key space of their values, and once aggregated its results.
+struct group_by
+{
+    std::vector<long> column_indexes;
+    std::vector<int> min_values;        // The smallest value of each group column.
+    std::vector<long> value_counts;     // The range of values of each group column.
+    std::vector<long> strides;
+    long slot_count;
+    group_accumulators totals;
+
+    group_by() : slot_count(1) {}
+
+    // The value of a group column in a slot.
+    int group_value(long slot, size_t group_column) const
+    {
+        return int(min_values[group_column] + (slot / strides[group_column]) % value_counts[group_column]);
+    }
+};
+
+// The smallest and largest values of a column, from the zone map when every block of it is there,
+// otherwise by scanning it on thread_count threads.
+inline void column_value_range(const mapped_big_matrix& matrix, long column_index, int thread_count, int& min_value, int& max_value)
+{
+    long block_count = zone_block_count(matrix.row_count());
+    min_value = INT_MAX;
+    max_value = INT_MIN;
+    bool from_zone_map = matrix.has_zone_map();
+    for (long block_index = 0; block_index < block_count && from_zone_map; block_index++)
+    {
+        const zone_record* zone = matrix.zone(column_index, block_index);
+        from_zone_map = zone != NULL;
+        if (from_zone_map)
+        {
+            min_value = zone->min_value < min_value ? zone->min_value : min_value;
+            max_value = zone->max_value > max_value ? zone->max_value : max_value;
+        }
+    }
+    if (from_zone_map)
+    {
+        return;
+    }
+
+    std::atomic<long> next_block(0);
+    std::vector<int> thread_min_values(thread_count, INT_MAX);
+    std::vector<int> thread_max_values(thread_count, INT_MIN);
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&, thread_index]()
+        {
+            int low = INT_MAX;
+            int high = INT_MIN;
+            long block_index;
+            while ((block_index = next_block.fetch_add(1)) < block_count)
+            {
+                long first_row = block_index * zone_block_row_count;
+                long end_row = first_row + zone_block_rows(matrix.row_count(), block_index);
+                for (long row_index = first_row; row_index < end_row; row_index++)
+                {
+                    int value = matrix.value(column_index, row_index);
+                    low = value < low ? value : low;
+                    high = value > high ? value : high;
+                }
+            }
+            thread_min_values[thread_index] = low;
+            thread_max_values[thread_index] = high;
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+        min_value = thread_min_values[thread_index] < min_value ? thread_min_values[thread_index] : min_value;
+        max_value = thread_max_values[thread_index] > max_value ? thread_max_values[thread_index] : max_value;
+    }
+}
+
+// Lay out the dense key space of a grouping by the given columns (none for a single group of every row).
+inline bool plan_group_by(const mapped_big_matrix& matrix, const std::vector<long>& column_indexes, int thread_count,
+                          group_by& grouping, std::string& error)
+{
+    grouping.column_indexes = column_indexes;
+    grouping.min_values.assign(column_indexes.size(), 0);
+    grouping.value_counts.assign(column_indexes.size(), 1);
+    grouping.strides.assign(column_indexes.size(), 1);
+    grouping.slot_count = 1;
+    for (size_t group_column = column_indexes.size(); group_column-- > 0; )
+    {
+        int min_value;
+        int max_value;
+        column_value_range(matrix, column_indexes[group_column], thread_count, min_value, max_value);
+        if (matrix.row_count() == 0)
+        {
+            min_value = max_value = 0;
+        }
+        grouping.min_values[group_column] = min_value;
+        grouping.value_counts[group_column] = long(max_value) - min_value + 1;
+        grouping.strides[group_column] = grouping.slot_count;
+        if (grouping.value_counts[group_column] > LONG_MAX / grouping.slot_count)
+        {
+            grouping.slot_count = LONG_MAX;
+        }
+        else
+        {
+            grouping.slot_count *= grouping.value_counts[group_column];
+        }
+        if (grouping.slot_count > INT32_MAX)
+        {
+            error = "the values of the group columns span too many groups to count them in dense arrays";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Add the selected rows of one block into the accumulators of a grouping.
+// The slots of the rows are computed column by column into slots, then each aggregate column is added in.
+// Returns false if a group value lies outside the planned range, i.e. the zone map no longer matches the matrix.
+template <typename T>
+bool aggregate_block(const mapped_big_matrix& matrix, const group_by& grouping, const std::vector<long>& aggregate_columns,
+                     int missing_value, long first_row, const std::vector<uint32_t>& selection, std::vector<uint32_t>& slots,
+                     group_accumulators& accumulators)
+{
+    const size_t selected_count = selection.size();
+    slots.assign(selected_count, 0);
+    for (size_t group_column = 0; group_column < grouping.column_indexes.size(); group_column++)
+    {
+        const T* values = reinterpret_cast<const T*>(matrix.column_data(grouping.column_indexes[group_column])) + first_row;
+        const long min_value = grouping.min_values[group_column];
+        const unsigned long value_count = grouping.value_counts[group_column];
+        const uint32_t stride = uint32_t(grouping.strides[group_column]);
+        bool in_range = true;
+        for (size_t index = 0; index < selected_count; index++)
+        {
+            unsigned long offset = (unsigned long)(long(values[selection[index]]) - min_value);
+            in_range &= offset < value_count;
+            slots[index] += uint32_t(offset) * stride;
+        }
+        if (!in_range)
+        {
+            return false;
+        }
+    }
+
+    for (size_t index = 0; index < selected_count; index++)
+    {
+        accumulators.row_counts[slots[index]]++;
+    }
+    for (size_t aggregate_index = 0; aggregate_index < aggregate_columns.size(); aggregate_index++)
+    {
+        const T* values = reinterpret_cast<const T*>(matrix.column_data(aggregate_columns[aggregate_index])) + first_row;
+        const size_t base = aggregate_index * grouping.slot_count;
+        int64_t* counts = &accumulators.counts[base];
+        int64_t* sums = &accumulators.sums[base];
+        int32_t* min_values = &accumulators.min_values[base];
+        int32_t* max_values = &accumulators.max_values[base];
+        for (size_t index = 0; index < selected_count; index++)
+        {
+            int value = values[selection[index]];
+            if (value == missing_value)
+            {
+                continue;
+            }
+            uint32_t slot = slots[index];
+            counts[slot]++;
+            sums[slot] += value;
+            min_values[slot] = value < min_values[slot] ? value : min_values[slot];
+            max_values[slot] = value > max_values[slot] ? value : max_values[slot];
+        }
+    }
+    return true;
+}
+
+// Aggregate the rows meeting the conditions (all of them, or with any set one of them; every row if there are none)
+// into the totals of every grouping, on thread_count threads, each with its own accumulators.
+// Returns the number of rows aggregated, or -1 if a group value lies outside its planned range.
+// settled_block_count is set to the number of blocks the zone map settled without reading the condition columns.
+inline long aggregate_rows(const mapped_big_matrix& matrix, std::vector<group_by>& groupings, const std::vector<long>& aggregate_columns,
+                           int missing_value, const std::vector<column_condition>& conditions, bool any, int thread_count,
+                           long& settled_block_count)
+{
+    long block_count = zone_block_count(matrix.row_count());
+    std::vector<std::vector<group_accumulators> > thread_accumulators(thread_count, std::vector<group_accumulators>(groupings.size()));
+    std::atomic<long> next_block(0);
+    std::atomic<long> settled_blocks(0);
+    std::atomic<long> aggregated_rows(0);
+    std::atomic<bool> out_of_range(false);
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&, thread_index]()
+        {
+            std::vector<group_accumulators>& accumulators = thread_accumulators[thread_index];
+            for (size_t grouping_index = 0; grouping_index < groupings.size(); grouping_index++)
+            {
+                accumulators[grouping_index].reset(groupings[grouping_index].slot_count, aggregate_columns.size());
+            }
+            std::vector<uint32_t> words;
+            std::vector<uint32_t> condition_words;
+            std::vector<uint32_t> selection;
+            std::vector<uint32_t> slots;
+            long rows = 0;
+            long block_index;
+            while (!out_of_range && (block_index = next_block.fetch_add(1)) < block_count)
+            {
+                long first_row = block_index * scan_block_row_count;
+                long row_count = zone_block_rows(matrix.row_count(), block_index);
+                if (!scan_block(matrix, conditions, any, block_index, row_count, words, condition_words))
+                {
+                    settled_blocks.fetch_add(1, std::memory_order_relaxed);
+                }
+                selection.clear();
+                for (size_t word_index = 0; word_index < words.size(); word_index++)
+                {
+                    uint32_t word = words[word_index];
+                    while (word != 0)
+                    {
+                        selection.push_back(word_index * 32 + __builtin_ctz(word));
+                        word &= word - 1;
+                    }
+                }
+                if (selection.empty())
+                {
+                    continue;
+                }
+                rows += selection.size();
+                for (size_t grouping_index = 0; grouping_index < groupings.size(); grouping_index++)
+                {
+                    bool aggregated;
+                    switch (matrix.element_size())
+                    {
+                    case 1:
+                        aggregated = aggregate_block<int8_t>(matrix, groupings[grouping_index], aggregate_columns, missing_value,
+                                                             first_row, selection, slots, accumulators[grouping_index]);
+                        break;
+                    case 2:
+                        aggregated = aggregate_block<int16_t>(matrix, groupings[grouping_index], aggregate_columns, missing_value,
+                                                              first_row, selection, slots, accumulators[grouping_index]);
+                        break;
+                    default:
+                        aggregated = aggregate_block<int32_t>(matrix, groupings[grouping_index], aggregate_columns, missing_value,
+                                                              first_row, selection, slots, accumulators[grouping_index]);
+                        break;
+                    }
+                    if (!aggregated)
+                    {
+                        out_of_range = true;
+                    }
+                }
+            }
+            aggregated_rows.fetch_add(rows);
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+    }
+    settled_block_count = settled_blocks;
+    if (out_of_range)
+    {
+        return -1;
+    }
+
+    for (size_t grouping_index = 0; grouping_index < groupings.size(); grouping_index++)
+    {
+        group_accumulators& totals = groupings[grouping_index].totals;
+        totals = std::move(thread_accumulators[0][grouping_index]);
+        for (int thread_index = 1; thread_index < thread_count; thread_index++)
+        {
+            totals.merge(thread_accumulators[thread_index][grouping_index]);
+            thread_accumulators[thread_index][grouping_index] = group_accumulators();
+        }
+    }
+    return aggregated_rows;
+}
+
+#endif // GROUP_AGGREGATE_H
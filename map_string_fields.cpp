@@ -17,11 +17,52 @@
 //     http://stat-computing.org/dataexpo/2009/plane-data.csv
 
 // To compile this c++ program on Macos X:
-//     gcc -W map_string_fields.cpp -o map_fields  -stdlib=libstdc++ -lstdc++ 
+//     gcc -W -std=c++17 map_string_fields.cpp -o map_fields  -stdlib=libstdc++ -lstdc++ -lbz2 -lz
 // To compile this c++ program on linux:
-//     g++ -W map_string_fields.cpp -o map_fields
+//     g++ -W -std=c++17 -O2 -pthread map_string_fields.cpp -o map_fields -lbz2 -lz
+// Add -mavx2 on hosts that support it to scan for delimiters 32 bytes at a time.
 // Run it with: 
 //     $ ./map_fields [source-filename] [destination_filename]
+// or, to write a bigmemory file-backed big.matrix directly instead of csv:
+//     $ ./map_fields --format=bigmatrix [source-filename] [destination_filename.matrix]
+// which also writes the descriptor file destination_filename.desc for attach.big.matrix,
+// and the zone map destination_filename.matrix.zones (see zone_map.h) used by query_matrix.cpp to skip blocks of rows.
+// The low-cardinality columns, e.g. UniqueCarrier, Origin, Month and Cancelled, also get the bitmap index
+// destination_filename.matrix.bitmaps (see bitmap_index.h), which query_matrix.cpp answers selective conditions from.
+// --bitmaps=column,... indexes other columns instead, --bitmaps=none none at all.
+// Or, to write the block-compressed column store (see column_store.h), a fraction of the size of the big.matrix:
+//     $ ./map_fields --format=columnstore [source-filename] [destination_filename.columns]
+// which materialize_matrix.cpp turns into a plain big.matrix when R needs one.
+// Add --column-types=narrow to store each column in the narrowest bigmemory type that holds it
+// (the narrow types of the columns of the csv_schema, see airline_schema), as a group of big.matrices destination_filename.{char,short,integer}.matrix
+// each with its own descriptor. Single columns can be overridden, e.g. --column-types=narrow,TailNum:short
+// Add --threads N to convert chunks of the source file on N cores.
+// The source file may also be the compressed download, e.g. 2008.csv.bz2 (or .gz),
+// which is decompressed on its own thread as it is converted.
+// With --extend-dictionaries, carrier, tail number and airport codes that are missing
+// from the reference data get new integers instead of the missing value,
+// and the extended mappings are saved as destination_filename.{carriers,aircraft,airports,cancellation_codes}.csv
+// csv output is written from a background thread in large buffers, 16MB unless set with --write-buffer=MB.
+// --fsync=end forces the output to disk before exiting, --fsync=buffer after every buffer (csv only).
+// Add --derived-times to append the columns CRSDepMinutes and DepMinutes (minutes since 1970) and DayIndex
+// (days since 1970) computed from the date and departure times, see "Derived time columns" below.
+// Add --clean to strip non-ASCII bytes as clean_to_ascii.c does while converting,
+// so the raw download can be converted without writing a cleaned copy first.
+// Add --benchmark to time the tokenize, integer decode, lookup and write stages separately on one thread,
+// reported in MB/s and rows/s of the source; generate_airline_data.cpp writes synthetic source files for it.
+// Add --stats to time the stages of the conversion itself, on all its threads, and count the NA fields,
+// the codes missing from each reference table and the malformed rows (see "Run statistics" below),
+// or --stats=json to also write them to destination_filename.stats.json.
+// With --stats a progress line is also printed every minute, or every --progress=seconds with or without it (0 for none).
+// To compile the reference data once into a binary dictionary file shared by every job:
+//     $ ./map_fields --build-dictionaries [dictionary_filename] [reference_data_path]
+// and then convert with --dictionaries=dictionary_filename instead of a reference data path.
+// To write all the years into one combined big.matrix, e.g. all.matrix, plan it once:
+//     $ ./map_fields --plan-combined=all.layout [--column-types=...] [--clean] [--derived-times] all.matrix 1987.csv.bz2 ... 2008.csv.bz2
+// which creates all.matrix and all.matrix.desc, and then convert each year into its rows of it:
+//     $ ./map_fields --layout=all.layout 2008.csv.bz2 all.matrix [reference_data_path]
+// The bitmap index of a combined matrix is built once all of its rows are written, with:
+//     $ ./query_matrix --build-bitmaps all.matrix.desc
 
 // See: http://stackoverflow.com/questions/1120140/how-can-i-read-and-parse-csv-files-in-c
 // The boost fusion approach used here is problematical, as it needs a bit,
@@ -31,13 +72,40 @@
 // and is limited in the number of fields it can handle conveniently.
 // It also does not handle the CSV format in a general way.
 
+// The source file is memory mapped and split into fields in place,
+// see the "Memory mapped csv source" section below.
+// The data rows are decoded through the compile-time csv_schema declared at the top of main(),
+// boost fusion is now only used to read the reference data files.
+
 // TODO RR: clean up the includes.
 #include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <string_view>
+#include <charconv>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <tr1/unordered_map>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <limits.h>
+#include <stdlib.h>
+
 #include <boost/fusion/sequence.hpp>
 #include <boost/fusion/include/sequence.hpp>
 #include <boost/fusion/adapted/boost_tuple.hpp>
@@ -50,10 +118,25 @@
 #include <boost/fusion/include/vector.hpp>
 #include <boost/fusion/container/vector/vector_fwd.hpp>
 #include <boost/fusion/include/vector_fwd.hpp>
-#include <boost/lexical_cast.hpp>
 
 #include <boost/fusion/algorithm/iteration/accumulate.hpp>
 #include <boost/fusion/include/accumulate.hpp>
+#include <boost/fusion/algorithm/iteration/for_each.hpp>
+#include <boost/fusion/include/for_each.hpp>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "decompressing_reader.h"
+#include "ascii_filter.h"
+#include "big_matrix_descriptor.h"
+#include "zone_map.h"
+#include "bitmap_index.h"
+#include "column_store.h"
 
 namespace fusion = boost::fusion;
 
@@ -118,6 +201,38 @@ struct quoted_string_field
     }
 };
 
+// Count of integer fields that were neither a number nor a missing value.
+// These are stored as the missing value rather than stopping the conversion.
+std::atomic<long> malformed_field_count(0);
+
+// Decode a signed decimal integer in place, without copying the field.
+// "NA" and "" give the missing value, anything else that is not
+// entirely a number (or is out of int range) is counted as malformed.
+template <int MISSING_VALUE_FLAG>
+inline int decode_integer(std::string_view text)
+{
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    if (begin == end || (text.size() == 2 && begin[0] == 'N' && begin[1] == 'A'))
+    {
+        return MISSING_VALUE_FLAG;
+    }
+    if (*begin == '+' && end - begin > 1 && begin[1] >= '0' && begin[1] <= '9')
+    {
+        // Accepted by lexical_cast but not by from_chars, which would then take "+-5" as -5.
+        begin++;
+    }
+
+    int decoded;
+    std::from_chars_result result = std::from_chars(begin, end, decoded);
+    if (result.ec != std::errc() || result.ptr != end)
+    {
+        malformed_field_count.fetch_add(1, std::memory_order_relaxed);
+        return MISSING_VALUE_FLAG;
+    }
+    return decoded;
+}
+
 // struct to extract an integer field that may have string "missing values".
 // Looks for an 0 or positive integer value, 
 // but if it finds a "NA" or "" it interprets it as a "-1",
@@ -130,16 +245,27 @@ struct integer_field
 
     // Read a string until a CSV delimiter is found.
     friend std::istream& operator >> (std::istream& input_stream, integer_field& csvi) {
-        csvi.value = MISSING_VALUE_FLAG;   // Default 
         std::string buffer;
         extract_field(input_stream, buffer);
-        if( buffer != "NA" )
-        {
-            csvi.value = boost::lexical_cast<int>(buffer);
-        }
+        csvi.parse(buffer);
         return input_stream;
     }
 
+    // Interpret a field already split out of the source buffer.
+    void parse(std::string_view text)
+    {
+        value = decode(text);
+    }
+
+    static int decode(std::string_view text)
+    {
+        return decode_integer<MISSING_VALUE_FLAG>(text);
+    }
+
+    // Not looked up in a table.
+    static constexpr bool is_lookup = false;
+    static const char* table_name() { return NULL; }
+
     // Write a csv integer string.
     friend std::ostream& operator << (std::ostream& output_stream, integer_field const& csvi) 
     {
@@ -147,30 +273,442 @@ struct integer_field
     }
 };
 
+// =========================================================
+// Lookup tables keyed on the short string codes.
+// The codes have a small known shape: 1 char cancellation codes, 2-3 char carriers,
+// 3-4 char IATA airports, tail numbers of at most 6 chars.
+// Codes of up to 8 characters are packed into a uint64_t so a lookup is
+// an integer hash and compare with no std::string built or hashed.
+
+// With --extend-dictionaries codes missing from the reference data are added
+// to the tables as they are met, with new ids following the largest loaded id.
+// Any number of threads can look up and add codes at once: the slots are atomics,
+// a new code is claimed with a compare-and-swap and a lookup of a known code takes no lock.
+
+// Pack a code of 1 to 8 characters into a non-zero uint64_t, or return 0 if it does not fit.
+inline uint64_t pack_key(std::string_view text)
+{
+    uint64_t key = 0;
+    if (text.empty() || text.size() > sizeof(key))
+    {
+        return 0;
+    }
+    memcpy(&key, text.data(), text.size());
+    return key;
+}
+
+// Recover the code from a packed key.
+inline std::string unpack_key(uint64_t key)
+{
+    char text[sizeof(key)];
+    memcpy(text, &key, sizeof(key));
+    size_t size = 0;
+    while (size < sizeof(key) && text[size] != '\0')
+    {
+        size++;
+    }
+    return std::string(text, size);
+}
+
+// Slot value of a code claimed by one thread that has not yet been given its id.
+const int pending_id = INT_MIN;
+
+// One code and its id, as the tables are built from and as stored in the binary dictionary file.
+struct dictionary_entry
+{
+    uint64_t key;       // Packed code.
+    int32_t id;
+    int32_t unused;
+};
+
+// Open addressing (linear probing) table from packed keys to integer ids.
+// Sized to at most half full so probes are short, and small enough to stay in cache.
+// An extensible table is sized up front for the codes that may be added, as it cannot grow in place.
+class packed_key_table
+{
+public:
+    static const size_t extension_capacity = 1 << 16;
+
+    packed_key_table() : m_keys(NULL), m_values(NULL), m_capacity(0), m_mask(0), m_count(0) {}
+    ~packed_key_table() { delete[] m_keys; delete[] m_values; }
+
+    // Any packed code has a slot.
+    static bool holds(uint64_t) { return true; }
+
+    // Build from a list of packed codes and their ids.
+    void build(const dictionary_entry* entries, size_t entry_count, bool extensible)
+    {
+        size_t capacity = 16;
+        while (capacity < 2 * (entry_count + (extensible ? extension_capacity : 0)))
+        {
+            capacity *= 2;
+        }
+        delete[] m_keys;
+        delete[] m_values;
+        m_keys = new std::atomic<uint64_t>[capacity];
+        m_values = new std::atomic<int>[capacity];
+        for (size_t slot = 0; slot < capacity; slot++)
+        {
+            m_keys[slot].store(0, std::memory_order_relaxed);
+            m_values[slot].store(pending_id, std::memory_order_relaxed);
+        }
+        m_capacity = capacity;
+        m_mask = capacity - 1;
+        m_count = 0;
+
+        for (size_t entry_index = 0; entry_index < entry_count; entry_index++)
+        {
+            uint64_t key = entries[entry_index].key;
+            size_t slot = hash(key);
+            while (m_keys[slot].load(std::memory_order_relaxed) != 0 && m_keys[slot].load(std::memory_order_relaxed) != key)
+            {
+                slot = (slot + 1) & m_mask;
+            }
+            if (m_keys[slot].load(std::memory_order_relaxed) == 0)
+            {
+                m_count++;
+            }
+            m_keys[slot].store(key, std::memory_order_relaxed);
+            m_values[slot].store(entries[entry_index].id, std::memory_order_relaxed);
+        }
+    }
+
+    // Look up a packed key, giving missing_value if it is not present.
+    int find(uint64_t key, int missing_value) const
+    {
+        if (m_capacity == 0)
+        {
+            return missing_value;
+        }
+        for (size_t slot = hash(key); ; slot = (slot + 1) & m_mask)
+        {
+            uint64_t slot_key = m_keys[slot].load(std::memory_order_acquire);
+            if (slot_key == key)
+            {
+                return wait_for_id(slot);
+            }
+            if (slot_key == 0)
+            {
+                return missing_value;
+            }
+        }
+    }
+
+    // Look up a packed key, adding it with the id next_id hands out if it is not present.
+    // Gives missing_value only if the table is too full to take more codes.
+    int find_or_insert(uint64_t key, std::atomic<int>& next_id, int missing_value, bool& inserted)
+    {
+        inserted = false;
+        for (size_t slot = hash(key); ; slot = (slot + 1) & m_mask)
+        {
+            uint64_t slot_key = m_keys[slot].load(std::memory_order_acquire);
+            if (slot_key == key)
+            {
+                return wait_for_id(slot);
+            }
+            if (slot_key == 0)
+            {
+                if (m_count.load(std::memory_order_relaxed) * 4 >= m_capacity * 3)
+                {
+                    return missing_value;
+                }
+                if (m_keys[slot].compare_exchange_strong(slot_key, key, std::memory_order_acq_rel))
+                {
+                    m_count.fetch_add(1, std::memory_order_relaxed);
+                    int id = next_id.fetch_add(1, std::memory_order_relaxed);
+                    m_values[slot].store(id, std::memory_order_release);
+                    inserted = true;
+                    return id;
+                }
+                // Another thread took the slot first, possibly for this same code.
+                if (slot_key == key)
+                {
+                    return wait_for_id(slot);
+                }
+            }
+        }
+    }
+
+    // Visit every (code, id) pair.
+    template <class VISIT>
+    void for_each_entry(VISIT visit) const
+    {
+        for (size_t slot = 0; slot < m_capacity; slot++)
+        {
+            uint64_t key = m_keys[slot].load(std::memory_order_acquire);
+            if (key != 0)
+            {
+                visit(key, wait_for_id(slot));
+            }
+        }
+    }
+
+private:
+    size_t hash(uint64_t key) const
+    {
+        // Fibonacci hashing: the multiply mixes all the code's characters into the high bits.
+        return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & m_mask;
+    }
+
+    // A slot's key is published before its id, wait out that short window.
+    int wait_for_id(size_t slot) const
+    {
+        int id;
+        while ((id = m_values[slot].load(std::memory_order_acquire)) == pending_id)
+        {
+            std::this_thread::yield();
+        }
+        return id;
+    }
+
+    std::atomic<uint64_t>* m_keys;   // 0 marks an empty slot.
+    std::atomic<int>* m_values;
+    size_t m_capacity;
+    size_t m_mask;
+    std::atomic<size_t> m_count;
+};
+
+// Direct index table for codes of one or two characters: the code itself is the index.
+class direct_key_table
+{
+public:
+    static const size_t capacity = 1 << 16;
+
+    direct_key_table() : m_values(new std::atomic<int>[capacity]) {}
+    ~direct_key_table() { delete[] m_values; }
+
+    // Longer codes are left to the unpacked lookup table.
+    static bool holds(uint64_t key) { return key < capacity; }
+
+    void build(const dictionary_entry* entries, size_t entry_count, bool)
+    {
+        for (size_t index = 0; index < capacity; index++)
+        {
+            m_values[index].store(absent_id, std::memory_order_relaxed);
+        }
+        for (size_t entry_index = 0; entry_index < entry_count; entry_index++)
+        {
+            if (entries[entry_index].key < capacity)
+            {
+                m_values[entries[entry_index].key].store(entries[entry_index].id, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    int find(uint64_t key, int missing_value) const
+    {
+        if (key >= capacity)
+        {
+            return missing_value;
+        }
+        int id = wait_for_id(key);
+        return id != absent_id ? id : missing_value;
+    }
+
+    int find_or_insert(uint64_t key, std::atomic<int>& next_id, int missing_value, bool& inserted)
+    {
+        inserted = false;
+        if (key >= capacity)
+        {
+            return missing_value;
+        }
+        int id = m_values[key].load(std::memory_order_acquire);
+        if (id == absent_id && m_values[key].compare_exchange_strong(id, pending_id, std::memory_order_acq_rel))
+        {
+            id = next_id.fetch_add(1, std::memory_order_relaxed);
+            m_values[key].store(id, std::memory_order_release);
+            inserted = true;
+            return id;
+        }
+        return wait_for_id(key);
+    }
+
+    template <class VISIT>
+    void for_each_entry(VISIT visit) const
+    {
+        for (size_t index = 1; index < capacity; index++)
+        {
+            int id = wait_for_id(index);
+            if (id != absent_id)
+            {
+                visit((uint64_t)index, id);
+            }
+        }
+    }
+
+private:
+    static const int absent_id = INT_MIN + 1;
+
+    int wait_for_id(size_t index) const
+    {
+        int id;
+        while ((id = m_values[index].load(std::memory_order_acquire)) == pending_id)
+        {
+            std::this_thread::yield();
+        }
+        return id;
+    }
+
+    std::atomic<int>* m_values;
+};
+
 // struct to extract an string field that is then transformed into an integer".
 // Looks for an 0 or positive integer value, but if it finds a "NA" it interprets it as a "-1",
 // or more generally a specified numerical missing value constant
 // outside the normal range of values, e.g. -99, -2000000, MAX_INT etc..
+// The marker class T picks the packed table type used for the parse() fast path,
+// s_lookup_table remains the reference copy and covers codes too long to pack, or too long for the table type.
+// An extensible packed table that fills up refuses further codes, which are counted in s_refused_count.
 template <class T, int MISSING_VALUE_FLAG>
 struct lookup_field
 {
     int value;
     static std::tr1::unordered_map<std::string, int> s_lookup_table;
+    static typename T::table_type s_packed_table;
+    static bool s_has_unpacked_keys;
+    static bool s_extend;
+    static std::atomic<int> s_next_id;
+    static std::atomic<long> s_added_count;
+    static std::atomic<long> s_refused_count;
+    static std::mutex s_unpacked_mutex;
+
+    // Build the packed table once s_lookup_table is loaded.
+    // If extend is set, unknown codes are added with new ids instead of being mapped to missing.
+    static void index_lookup_table(bool extend)
+    {
+        std::vector<dictionary_entry> entries;
+        long unpacked_count = 0;
+        for (std::tr1::unordered_map<std::string, int>::const_iterator it = s_lookup_table.begin(); it != s_lookup_table.end(); ++it)
+        {
+            dictionary_entry entry = { pack_key(it->first), it->second, 0 };
+            if (entry.key == 0 || !T::table_type::holds(entry.key))
+            {
+                unpacked_count++;
+                continue;
+            }
+            entries.push_back(entry);
+        }
+        index_dictionary_entries(entries.empty() ? NULL : &entries[0], entries.size(), extend);
+        s_has_unpacked_keys = unpacked_count > 0;
+        for (std::tr1::unordered_map<std::string, int>::const_iterator it = s_lookup_table.begin(); it != s_lookup_table.end(); ++it)
+        {
+            s_next_id = it->second >= s_next_id ? it->second + 1 : (int)s_next_id;
+        }
+    }
+
+    // Build the packed table straight from packed codes, e.g. from a mapped binary dictionary file.
+    // Codes the table type cannot hold go to s_lookup_table instead.
+    static void index_dictionary_entries(const dictionary_entry* entries, size_t entry_count, bool extend)
+    {
+        s_extend = extend;
+        s_has_unpacked_keys = false;
+        s_packed_table.build(entries, entry_count, extend);
+        int largest_id = 0;
+        for (size_t entry_index = 0; entry_index < entry_count; entry_index++)
+        {
+            largest_id = entries[entry_index].id > largest_id ? entries[entry_index].id : largest_id;
+            if (!T::table_type::holds(entries[entry_index].key))
+            {
+                s_lookup_table[unpack_key(entries[entry_index].key)] = entries[entry_index].id;
+                s_has_unpacked_keys = true;
+            }
+        }
+        s_next_id = largest_id + 1;
+        s_added_count = 0;
+        s_refused_count = 0;
+    }
     
     // Read a string until a CSV delimiter is found.
     friend std::istream& operator >> (std::istream& input_stream, lookup_field& csvi) {
-        csvi.value = MISSING_VALUE_FLAG;   // Default 
         std::string buffer;
         extract_field(input_stream, buffer);
-        if( buffer != "NA" )
+        csvi.parse(buffer);
+        return input_stream;
+    }
+
+    // Interpret a field already split out of the source buffer.
+    void parse(std::string_view text)
+    {
+        value = decode(text);
+    }
+
+    static constexpr bool is_lookup = true;
+    static const char* table_name() { return T::name; }
+
+    static int decode(std::string_view text)
+    {
+        static const uint64_t missing_key = pack_key("NA");
+        uint64_t key = pack_key(text);
+        if (key == missing_key)
+        {
+            return MISSING_VALUE_FLAG;
+        }
+        if (key != 0 && T::table_type::holds(key))
+        {
+            if (!s_extend)
+            {
+                return s_packed_table.find(key, MISSING_VALUE_FLAG);
+            }
+            bool inserted;
+            int value = s_packed_table.find_or_insert(key, s_next_id, MISSING_VALUE_FLAG, inserted);
+            if (inserted)
+            {
+                s_added_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            else if (value == MISSING_VALUE_FLAG)
+            {
+                // The ids are never the missing value, the table is full.
+                s_refused_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            return value;
+        }
+
+        int value = MISSING_VALUE_FLAG;   // Default 
+        if (s_extend && !text.empty())
+        {
+            // Codes too long to pack are rare enough to take a lock.
+            std::lock_guard<std::mutex> lock(s_unpacked_mutex);
+            std::pair<std::tr1::unordered_map<std::string, int>::iterator, bool> item = 
+                s_lookup_table.insert(std::make_pair(std::string(text), 0));
+            if (item.second)
+            {
+                item.first->second = s_next_id++;
+                s_added_count++;
+            }
+            value = item.first->second;
+        }
+        else if (s_has_unpacked_keys && !text.empty())
         {
-            std::tr1::unordered_map<std::string, int>::const_iterator item_location = lookup_field::s_lookup_table.find(buffer);
+            std::tr1::unordered_map<std::string, int>::const_iterator item_location = lookup_field::s_lookup_table.find(std::string(text));
             if (item_location != lookup_field::s_lookup_table.end())
             {
-                csvi.value = item_location->second;
+                value = item_location->second;
             }
         }
-        return input_stream;
+        return value;
+    }
+
+    // Write out the (possibly extended) dictionary as "Code,Index" csv, in index order.
+    static bool write_dictionary(const std::string& dictionary_file_name)
+    {
+        std::map<int, std::string> codes;
+        s_packed_table.for_each_entry([&](uint64_t key, int id) { codes[id] = unpack_key(key); });
+        for (std::tr1::unordered_map<std::string, int>::const_iterator it = s_lookup_table.begin(); it != s_lookup_table.end(); ++it)
+        {
+            uint64_t key = pack_key(it->first);
+            if (key == 0 || !T::table_type::holds(key) || !s_extend)
+            {
+                codes[it->second] = it->first;
+            }
+        }
+
+        std::ofstream dictionary_file(dictionary_file_name.c_str());
+        dictionary_file << "Code,Index" << std::endl;
+        for (std::map<int, std::string>::const_iterator it = codes.begin(); it != codes.end(); ++it)
+        {
+            dictionary_file << it->second << "," << it->first << '\n';
+        }
+        return dictionary_file.good();
     }
 
     // Write a csv integer string.
@@ -180,16 +718,32 @@ struct lookup_field
     }
 };
 
-// The static field was declared above, now it must be declared.
+// The static fields were declared above, now they must be defined.
 template <class T, int MISSING_VALUE_FLAG>
 std::tr1::unordered_map<std::string, int> lookup_field<T, MISSING_VALUE_FLAG>::s_lookup_table = std::tr1::unordered_map<std::string, int>();
+template <class T, int MISSING_VALUE_FLAG>
+typename T::table_type lookup_field<T, MISSING_VALUE_FLAG>::s_packed_table;
+template <class T, int MISSING_VALUE_FLAG>
+bool lookup_field<T, MISSING_VALUE_FLAG>::s_has_unpacked_keys = false;
+template <class T, int MISSING_VALUE_FLAG>
+bool lookup_field<T, MISSING_VALUE_FLAG>::s_extend = false;
+template <class T, int MISSING_VALUE_FLAG>
+std::atomic<int> lookup_field<T, MISSING_VALUE_FLAG>::s_next_id(0);
+template <class T, int MISSING_VALUE_FLAG>
+std::atomic<long> lookup_field<T, MISSING_VALUE_FLAG>::s_added_count(0);
+template <class T, int MISSING_VALUE_FLAG>
+std::atomic<long> lookup_field<T, MISSING_VALUE_FLAG>::s_refused_count(0);
+template <class T, int MISSING_VALUE_FLAG>
+std::mutex lookup_field<T, MISSING_VALUE_FLAG>::s_unpacked_mutex;
 
 // Marker classes so the above template produces a new class, 
 // with a new static lookup table, for each usage.
-struct unique_carrier_id {};
-struct aircraft_id {};
-struct airport_id {};
-struct cancellation_code_id {};
+// Each also picks the table type suited to the length of its codes,
+// and names the table as the dictionary files do.
+struct unique_carrier_id { typedef packed_key_table table_type; static constexpr const char* name = "carriers"; };
+struct aircraft_id { typedef packed_key_table table_type; static constexpr const char* name = "aircraft"; };
+struct airport_id { typedef packed_key_table table_type; static constexpr const char* name = "airports"; };
+struct cancellation_code_id { typedef direct_key_table table_type; static constexpr const char* name = "cancellation_codes"; };
 
 // =========================================================
 // Load lookup tables from disk or just define them in-line.
@@ -312,295 +866,3415 @@ void load_cancellation_codes(std::tr1::unordered_map<std::string, int>& cancella
 }
 
 // =========================================================
-// Coordinate the processing of the source file and output to the destination file.
-// 1. Read the reference data files.
-// 2. Parse and transform the csv file rows into typed vectors.
-// 3. Output the typed vectors into a new destination file.
-
-/*  
-For reference:
- 
-Field names (29 columns): 
-
-    Name    Description
-    1   Year                1987-2008
-    2   Month               1-12
-    3   DayofMonth          1-31
-    4   DayOfWeek           1 (Monday) - 7 (Sunday)
-    5   DepTime             actual departure time (local, hhmm)
-    6   CRSDepTime          scheduled departure time (local, hhmm)
-    7   ArrTime             actual arrival time (local, hhmm)
-    8   CRSArrTime          scheduled arrival time (local, hhmm)
-    
-    9   UniqueCarrier       unique carrier code
-    10  FlightNum           flight number
-    11  TailNum             plane tail number, looks like N497WN.
-    12  ActualElapsedTime   in minutes
-    13  CRSElapsedTime      in minutes
-    14  AirTime             in minutes
-    15  ArrDelay            arrival delay, in minutes
-    16  DepDelay            departure delay, in minutes
-    
-    17  Origin              origin IATA airport code
-    18  Dest                destination IATA airport code
-    19  Distance            in miles
-    20  TaxiIn              taxi in time, in minutes
-    21  TaxiOut             taxi out time in minutes
-    
-    22  Cancelled           was the flight cancelled?
-    23  CancellationCode    reason for cancellation (A = carrier, B = weather, C = NAS, D = security)
-    24  Diverted            1 = yes, 0 = no
-    25  CarrierDelay        in minutes
-    26  WeatherDelay        in minutes
-    27  NASDelay            in minutes
-    28  SecurityDelay       in minutes
-    
-    29  LateAircraftDelay   in minutes
-        
-Example data for one line of csv file.
-The layout matches the typedefs for field groups below.
-    1987,10,14,3,741,730,912,849,
-    PS,1451,NA,91,79,NA,23,11,
-    SAN,SFO,447,NA,NA,
-    0,NA,0,NA,NA,NA,NA,
-    NA
-*/
+// Memory mapped csv source.
+// The whole source file is mapped read-only and split into lines and fields in place.
+// Fields are handed out as std::string_view spans into the mapping, 
+// so nothing is copied or allocated per field.
 
-int main(int argc, char **argv)
+class mapped_file
 {
-	// Timing
-	
-    time_t start_time;
-    time_t end_time;
-    struct tm * timeinfo;
-    char buffer [80];
-    double duration_secs;
+public:
+    mapped_file() : m_data(NULL), m_size(0) {}
+    ~mapped_file() { close(); }
 
-    struct lconv * lc;
+    bool open(const char* file_name)
+    {
+        int file_descriptor = ::open(file_name, O_RDONLY);
+        if (file_descriptor < 0)
+        {
+            return false;
+        }
+        struct stat file_status;
+        if (fstat(file_descriptor, &file_status) != 0)
+        {
+            ::close(file_descriptor);
+            return false;
+        }
+        m_size = file_status.st_size;
+        if (m_size > 0)
+        {
+            void* mapping = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+            if (mapping == MAP_FAILED)
+            {
+                ::close(file_descriptor);
+                return false;
+            }
+            m_data = static_cast<const char*>(mapping);
+            // The file is read front to back exactly once.
+            madvise(mapping, m_size, MADV_SEQUENTIAL);
+        }
+        ::close(file_descriptor);
+        return true;
+    }
+
+    void close()
+    {
+        if (m_data != NULL)
+        {
+            munmap(const_cast<char*>(m_data), m_size);
+            m_data = NULL;
+        }
+        m_size = 0;
+    }
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data;
+    size_t m_size;
+};
+
+// Return the end of the line that starts at position, i.e. the '\n' or end.
+inline const char* find_line_end(const char* position, const char* end)
+{
+    const char* line_end = static_cast<const char*>(memchr(position, '\n', end - position));
+    return line_end != NULL ? line_end : end;
+}
+
+// Split one line (without its '\n') at the commas into at most max_fields spans.
+// Commas are found a whole vector at a time: the compare mask gives the comma positions
+// of the block, which are then peeled off with count-trailing-zeros.
+// Returns the number of fields found, which may exceed max_fields.
+inline int split_fields(const char* line_begin, const char* line_end, std::string_view* fields, int max_fields)
+{
+    int field_count = 0;
+    const char* field_begin = line_begin;
+    const char* position = line_begin;
+
+#if defined(__AVX2__)
+    const __m256i commas = _mm256_set1_epi8(',');
+    for (; position + 32 <= line_end; position += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(position));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, commas));
+        while (mask != 0)
+        {
+            const char* comma = position + __builtin_ctz(mask);
+            if (field_count < max_fields)
+            {
+                fields[field_count] = std::string_view(field_begin, comma - field_begin);
+            }
+            field_count++;
+            field_begin = comma + 1;
+            mask &= mask - 1;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i commas_16 = _mm_set1_epi8(',');
+    for (; position + 16 <= line_end; position += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, commas_16));
+        while (mask != 0)
+        {
+            const char* comma = position + __builtin_ctz(mask);
+            if (field_count < max_fields)
+            {
+                fields[field_count] = std::string_view(field_begin, comma - field_begin);
+            }
+            field_count++;
+            field_begin = comma + 1;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    // Scalar tail, or the whole line on hosts without SSE2.
+    for (; position < line_end; position++)
+    {
+        if (*position == ',')
+        {
+            if (field_count < max_fields)
+            {
+                fields[field_count] = std::string_view(field_begin, position - field_begin);
+            }
+            field_count++;
+            field_begin = position + 1;
+        }
+    }
+
+    if (field_count < max_fields)
+    {
+        fields[field_count] = std::string_view(field_begin, line_end - field_begin);
+    }
+    return field_count + 1;
+}
+
+// =========================================================
+// Compile-time csv schema.
+// A csv_schema lists the columns of a file in order, each as column<NAME, FIELD, NARROW_TYPE>:
+// its name in the header, the field type that decodes it into an int, and the narrowest
+// big.matrix type that holds it, for --column-types=narrow. The row parser is generated
+// from the list as one straight run of decodes with no field groups,
+// so adding a column, or describing a new kind of file, is a change to the schema alone.
+// Names are pointers to constexpr char arrays, as string literals cannot be template arguments before C++20.
+
+// The bigmemory element types a column can be stored as.
+// The smallest value of each type is bigmemory's NA, so it is left out of the usable range.
+enum column_type
+{
+    char_column,
+    short_column,
+    integer_column,
+    column_type_count
+};
+
+struct column_type_info
+{
+    const char* name;
+    size_t element_size;
+    int min_value;
+    int max_value;
+};
+
+const column_type_info column_types[column_type_count] =
+{
+    {"char", 1, -127, 127},
+    {"short", 2, -32767, 32767},
+    {"integer", 4, INT_MIN + 1, INT_MAX}
+};
+
+template <const char* NAME, class FIELD, column_type NARROW_TYPE = integer_column>
+struct column
+{
+    typedef FIELD field_type;
+    static constexpr const char* name = NAME;
+    static constexpr column_type narrow_type = NARROW_TYPE;
+};
+
+template <class... COLUMNS>
+struct csv_schema
+{
+    static constexpr int column_count = sizeof...(COLUMNS);
+    static constexpr const char* column_names[column_count] = {COLUMNS::name...};
+    static constexpr column_type narrow_types[column_count] = {COLUMNS::narrow_type...};
+
+    // Decode the split fields of a row into values, one per column.
+    static void parse_row(const std::string_view* fields, int* values)
+    {
+        parse_columns(fields, values, std::make_index_sequence<column_count>());
+    }
+
+    // Decode only the columns looked up in tables (LOOKUPS true) or only the others,
+    // so that the two can be timed apart. Both together decode the row as parse_row() does.
+    template <bool LOOKUPS>
+    static void parse_row_part(const std::string_view* fields, int* values)
+    {
+        parse_column_part<LOOKUPS>(fields, values, std::make_index_sequence<column_count>());
+    }
+
+    // The name of the table each column is looked up in, NULL for those that are not.
+    static void lookup_table_names(const char** table_names)
+    {
+        int column_index = 0;
+        ((table_names[column_index++] = COLUMNS::field_type::table_name()), ...);
+    }
+
+private:
+    template <size_t... INDEX>
+    static void parse_columns(const std::string_view* fields, int* values, std::index_sequence<INDEX...>)
+    {
+        ((values[INDEX] = COLUMNS::field_type::decode(fields[INDEX])), ...);
+    }
+
+    template <bool LOOKUPS, size_t... INDEX>
+    static void parse_column_part(const std::string_view* fields, int* values, std::index_sequence<INDEX...>)
+    {
+        ((COLUMNS::field_type::is_lookup == LOOKUPS ? void(values[INDEX] = COLUMNS::field_type::decode(fields[INDEX])) : void()), ...);
+    }
+};
+
+// The header names of the airline data columns, see the field list above main().
+namespace airline_column_names
+{
+    constexpr char year[] = "Year";
+    constexpr char month[] = "Month";
+    constexpr char day_of_month[] = "DayofMonth";
+    constexpr char day_of_week[] = "DayOfWeek";
+    constexpr char dep_time[] = "DepTime";
+    constexpr char crs_dep_time[] = "CRSDepTime";
+    constexpr char arr_time[] = "ArrTime";
+    constexpr char crs_arr_time[] = "CRSArrTime";
+    constexpr char unique_carrier[] = "UniqueCarrier";
+    constexpr char flight_num[] = "FlightNum";
+    constexpr char tail_num[] = "TailNum";
+    constexpr char actual_elapsed_time[] = "ActualElapsedTime";
+    constexpr char crs_elapsed_time[] = "CRSElapsedTime";
+    constexpr char air_time[] = "AirTime";
+    constexpr char arr_delay[] = "ArrDelay";
+    constexpr char dep_delay[] = "DepDelay";
+    constexpr char origin[] = "Origin";
+    constexpr char destination[] = "Dest";
+    constexpr char distance[] = "Distance";
+    constexpr char taxi_in[] = "TaxiIn";
+    constexpr char taxi_out[] = "TaxiOut";
+    constexpr char cancelled[] = "Cancelled";
+    constexpr char cancellation_code[] = "CancellationCode";
+    constexpr char diverted[] = "Diverted";
+    constexpr char carrier_delay[] = "CarrierDelay";
+    constexpr char weather_delay[] = "WeatherDelay";
+    constexpr char nas_delay[] = "NASDelay";
+    constexpr char security_delay[] = "SecurityDelay";
+    constexpr char late_aircraft_delay[] = "LateAircraftDelay";
+}
+
+// A schema made of the columns of two schemas, one after the other, for their names and narrow types.
+template <class FIRST, class SECOND>
+struct concatenated_schema;
+
+template <class... FIRST, class... SECOND>
+struct concatenated_schema<csv_schema<FIRST...>, csv_schema<SECOND...> >
+{
+    typedef csv_schema<FIRST..., SECOND...> type;
+};
+
+// =========================================================
+// Derived time columns.
+// Year, Month and DayofMonth and the hhmm times are of no use for range queries or time arithmetic as they are,
+// so with --derived-times three columns are computed from each decoded row while it is still in cache,
+// and appended to it:
+//     CRSDepMinutes   the scheduled departure, in minutes since 1970-01-01 00:00
+//     DepMinutes      the actual departure, in minutes since 1970-01-01 00:00
+//     DayIndex        the flight date, in days since 1970-01-01
+// A window of time is then one range condition on one column, e.g. CRSDepMinutes:ge:... and CRSDepMinutes:lt:...
+// The times are the local times of the airports, as the data gives them, not UTC.
+// hhmm 2400 is midnight at the end of the day. An actual departure more than 12 hours after the scheduled one
+// on the clock is taken to be on the day before (left early before midnight),
+// more than 12 hours before it on the day after (delayed past midnight).
+
+// The date math is table driven and free of branches: the days before each year and each month come from
+// date_tables, the checks of the inputs are comparisons combined into flags, and the missing value
+// is selected by the flags rather than branched around.
+
+namespace derived_column_names
+{
+    constexpr char crs_dep_minutes[] = "CRSDepMinutes";
+    constexpr char dep_minutes[] = "DepMinutes";
+    constexpr char day_index[] = "DayIndex";
+}
+
+// The derived columns, as a schema for their names and narrow types. They are never parsed, so have no field type.
+// Minutes since 1970 need an integer, days fit a short until 2059.
+typedef csv_schema<
+    column<derived_column_names::crs_dep_minutes, void, integer_column>,
+    column<derived_column_names::dep_minutes, void, integer_column>,
+    column<derived_column_names::day_index, void, short_column>
+> derived_time_schema;
+
+const int derived_time_column_count = derived_time_schema::column_count;
+
+// The days from 1970-01-01 to the start of each year from 1970 and each month, built at compile time.
+struct date_tables
+{
+    static const int first_year = 1970;
+    static const int year_count = 256;
+
+    int days_before_year[year_count];
+    unsigned char is_leap_year[year_count];
+    int days_before_month[2][13];           // [leap year][month], month from 1.
+    int days_in_month[2][13];
+
+    constexpr date_tables() : days_before_year(), is_leap_year(), days_before_month(), days_in_month()
+    {
+        const int month_lengths[13] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        int days = 0;
+        for (int year_index = 0; year_index < year_count; year_index++)
+        {
+            int year = first_year + year_index;
+            is_leap_year[year_index] = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+            days_before_year[year_index] = days;
+            days += 365 + is_leap_year[year_index];
+        }
+        for (int leap = 0; leap < 2; leap++)
+        {
+            for (int month = 1; month <= 12; month++)
+            {
+                days_in_month[leap][month] = month_lengths[month] + (leap && month == 2);
+                days_before_month[leap][month] = month == 1 ? 0 : days_before_month[leap][month - 1] + days_in_month[leap][month - 1];
+            }
+        }
+    }
+};
+
+constexpr date_tables derived_date_tables;
+
+// Computes the derived columns from the decoded values of a row of SCHEMA, which must have the
+// Year, Month, DayofMonth, DepTime and CRSDepTime columns of the airline data.
+template <class SCHEMA>
+class derived_time_calculator
+{
+public:
+    explicit derived_time_calculator(int missing_value)
+        : m_missing_value(missing_value)
+    {
+        namespace names = airline_column_names;
+        m_year = column_index(names::year);
+        m_month = column_index(names::month);
+        m_day_of_month = column_index(names::day_of_month);
+        m_dep_time = column_index(names::dep_time);
+        m_crs_dep_time = column_index(names::crs_dep_time);
+    }
+
+    // Fill in the derived_time_column_count derived values from the values of a row.
+    void compute(const int* values, int* derived) const
+    {
+        const date_tables& tables = derived_date_tables;
+
+        // The date, checked before its parts index the tables; a bad date reads the first entries instead.
+        unsigned year_index = unsigned(values[m_year] - date_tables::first_year);
+        unsigned month = unsigned(values[m_month]);
+        bool date_valid = (year_index < unsigned(date_tables::year_count)) & (month - 1 < 12u);
+        year_index = date_valid ? year_index : 0;
+        month = date_valid ? month : 1;
+        int leap = tables.is_leap_year[year_index];
+        int day = values[m_day_of_month];
+        date_valid &= unsigned(day - 1) < unsigned(tables.days_in_month[leap][month]);
+        int day_index = tables.days_before_year[year_index] + tables.days_before_month[leap][month] + day - 1;
+
+        bool crs_valid;
+        bool dep_valid;
+        int crs_minutes = minutes_of_day(values[m_crs_dep_time], crs_valid);
+        int dep_minutes = minutes_of_day(values[m_dep_time], dep_valid);
+        int difference = dep_minutes - crs_minutes;
+        int day_adjustment = crs_valid * ((difference < -720) - (difference > 720));
+
+        derived[0] = date_valid & crs_valid ? day_index * 1440 + crs_minutes : m_missing_value;
+        derived[1] = date_valid & dep_valid ? (day_index + day_adjustment) * 1440 + dep_minutes : m_missing_value;
+        derived[2] = date_valid ? day_index : m_missing_value;
+    }
+
+private:
+    static int column_index(const char* name)
+    {
+        int index = 0;
+        while (index < SCHEMA::column_count && strcmp(SCHEMA::column_names[index], name) != 0)
+        {
+            index++;
+        }
+        return index;
+    }
+
+    // The minutes since midnight of an hhmm time, from 0 to 2400.
+    static int minutes_of_day(int hhmm, bool& valid)
+    {
+        int hours = hhmm / 100;
+        int minutes = hhmm - hours * 100;
+        valid = (unsigned(hhmm) <= 2400u) & (minutes < 60);
+        return hours * 60 + minutes;
+    }
+
+    int m_missing_value;
+    int m_year;
+    int m_month;
+    int m_day_of_month;
+    int m_dep_time;
+    int m_crs_dep_time;
+};
+
+// =========================================================
+// Reference data loading, from the csv files or from a precompiled binary dictionary file.
+// The binary dictionary file is built once with --build-dictionaries from the csv reference data
+// and then memory mapped read-only by every conversion, so each PBS array task starts
+// without parsing anything and all years are guaranteed the same ids.
+//
+// Dictionary file layout, all little-endian:
+//     header:     char magic[8] = "AIRDICT1", uint32 table count, uint32 unused
+//     directory:  per table: char name[24] (nul padded), uint64 entry offset, uint64 entry count
+//     entries:    per table: dictionary_entry {uint64 packed code, int32 id, int32 unused}, sorted by packed code
+
+// The code tables, as loaded from the csv reference data.
+struct reference_tables
+{
+    std::tr1::unordered_map<std::string, int> carriers;
+    std::tr1::unordered_map<std::string, int> aircraft;
+    std::tr1::unordered_map<std::string, int> airports;
+    std::tr1::unordered_map<std::string, int> cancellation_codes;
+};
+
+// Load carriers.csv, plane-data.csv and airports.csv from reference_data_path and define the cancellation codes.
+bool load_reference_data(const std::string& reference_data_path, reference_tables& tables)
+{
+    std::cout << "Reference data folder path: " <<  reference_data_path <<  std::endl;
+    std::cout << "(E.g. /path/to/reference/data/)" <<  std::endl;
+
+    char carrier_file_name[] = "carriers.csv";
+    std::cout << "Carriers file path: " <<  reference_data_path + carrier_file_name <<  std::endl;
+    std::ifstream carrier_file((reference_data_path + carrier_file_name).c_str());
+    if (!carrier_file.is_open())
+    {
+        std::cout << "Null input file pointer from path: " <<  reference_data_path + carrier_file_name <<  std::endl;
+        return false;
+    }
+
+    char aircraft_file_name[] = "plane-data.csv";
+    std::cout << "Aircraft file path: " <<  reference_data_path + aircraft_file_name <<  std::endl;
+    std::ifstream aircraft_file((reference_data_path + aircraft_file_name).c_str());
+    if (!aircraft_file.is_open())
+    {
+        std::cout << "Null input file pointer from path: " <<  reference_data_path + aircraft_file_name <<  std::endl;
+        return false;
+    }
+
+    char airport_file_name[] = "airports.csv";
+    std::cout << "Airport file path: " <<  reference_data_path + airport_file_name <<  std::endl;
+    std::ifstream airport_file((reference_data_path + airport_file_name).c_str());
+    if (!airport_file.is_open())
+    {
+        std::cout << "Null input file pointer from path: " <<  reference_data_path + airport_file_name <<  std::endl;
+        return false;
+    }
+
+    load_carriers(carrier_file, tables.carriers);
+    load_aircraft(aircraft_file, tables.aircraft);
+    load_airports(airport_file, tables.airports);
+    load_cancellation_codes(tables.cancellation_codes);
+    return true;
+}
+
+// Print a code table, so the job output records the mapping between codes and integers.
+void print_lookup_table(const std::tr1::unordered_map<std::string, int>& lookup_table)
+{
+    std::cout << lookup_table.size() << std::endl;
+    for (std::tr1::unordered_map<std::string, int>::const_iterator it = lookup_table.begin(); it != lookup_table.end(); ++it)
+    {
+        std::cout << (*it).first << "," << (*it).second << std::endl;
+    }
+}
+
+const char dictionary_file_magic[8] = {'A', 'I', 'R', 'D', 'I', 'C', 'T', '1'};
+
+struct dictionary_file_header
+{
+    char magic[8];
+    uint32_t table_count;
+    uint32_t unused;
+};
+
+struct dictionary_table_header
+{
+    char name[24];
+    uint64_t entry_offset;
+    uint64_t entry_count;
+};
+
+// Write the code tables to a binary dictionary file.
+// Codes longer than 8 characters cannot be packed and are left out, with a warning.
+bool write_dictionary_file(const char* dictionary_file_name, const reference_tables& tables)
+{
+    const char* table_names[] = {"carriers", "aircraft", "airports", "cancellation_codes"};
+    const std::tr1::unordered_map<std::string, int>* table_maps[] = {&tables.carriers, &tables.aircraft, &tables.airports, &tables.cancellation_codes};
+    const uint32_t table_count = 4;
+
+    std::vector<std::vector<dictionary_entry> > table_entries(table_count);
+    for (uint32_t table_index = 0; table_index < table_count; table_index++)
+    {
+        const std::tr1::unordered_map<std::string, int>& lookup_table = *table_maps[table_index];
+        for (std::tr1::unordered_map<std::string, int>::const_iterator it = lookup_table.begin(); it != lookup_table.end(); ++it)
+        {
+            dictionary_entry entry = { pack_key(it->first), it->second, 0 };
+            if (entry.key == 0)
+            {
+                std::cout << "Code too long for the dictionary file, left out: " << table_names[table_index] << " \"" << it->first << "\"" << std::endl;
+                continue;
+            }
+            table_entries[table_index].push_back(entry);
+        }
+        std::sort(table_entries[table_index].begin(), table_entries[table_index].end(),
+            [](const dictionary_entry& left, const dictionary_entry& right) { return left.key < right.key; });
+    }
+
+    dictionary_file_header header;
+    memcpy(header.magic, dictionary_file_magic, sizeof(header.magic));
+    header.table_count = table_count;
+    header.unused = 0;
+
+    std::vector<dictionary_table_header> directory(table_count);
+    uint64_t entry_offset = sizeof(header) + table_count * sizeof(dictionary_table_header);
+    for (uint32_t table_index = 0; table_index < table_count; table_index++)
+    {
+        memset(directory[table_index].name, 0, sizeof(directory[table_index].name));
+        strncpy(directory[table_index].name, table_names[table_index], sizeof(directory[table_index].name) - 1);
+        directory[table_index].entry_offset = entry_offset;
+        directory[table_index].entry_count = table_entries[table_index].size();
+        entry_offset += table_entries[table_index].size() * sizeof(dictionary_entry);
+        std::cout << "Dictionary " << table_names[table_index] << ": " << table_entries[table_index].size() << " codes" << std::endl;
+    }
+
+    std::ofstream dictionary_file(dictionary_file_name, std::ios::binary);
+    dictionary_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    dictionary_file.write(reinterpret_cast<const char*>(&directory[0]), table_count * sizeof(dictionary_table_header));
+    for (uint32_t table_index = 0; table_index < table_count; table_index++)
+    {
+        if (!table_entries[table_index].empty())
+        {
+            dictionary_file.write(reinterpret_cast<const char*>(&table_entries[table_index][0]), 
+                table_entries[table_index].size() * sizeof(dictionary_entry));
+        }
+    }
+    return dictionary_file.good();
+}
+
+// A binary dictionary file mapped read-only.
+class dictionary_file
+{
+public:
+    bool open(const char* dictionary_file_name)
+    {
+        if (!m_file.open(dictionary_file_name) || m_file.size() < sizeof(dictionary_file_header))
+        {
+            return false;
+        }
+        const dictionary_file_header* header = reinterpret_cast<const dictionary_file_header*>(m_file.data());
+        return memcmp(header->magic, dictionary_file_magic, sizeof(header->magic)) == 0
+            && sizeof(dictionary_file_header) + header->table_count * sizeof(dictionary_table_header) <= m_file.size();
+    }
+
+    // Find a table's sorted entries by name.
+    bool find_table(const char* name, const dictionary_entry*& entries, size_t& entry_count) const
+    {
+        const dictionary_file_header* header = reinterpret_cast<const dictionary_file_header*>(m_file.data());
+        const dictionary_table_header* directory = reinterpret_cast<const dictionary_table_header*>(header + 1);
+        for (uint32_t table_index = 0; table_index < header->table_count; table_index++)
+        {
+            if (strncmp(directory[table_index].name, name, sizeof(directory[table_index].name)) == 0)
+            {
+                if (directory[table_index].entry_offset + directory[table_index].entry_count * sizeof(dictionary_entry) > m_file.size())
+                {
+                    return false;
+                }
+                entries = reinterpret_cast<const dictionary_entry*>(m_file.data() + directory[table_index].entry_offset);
+                entry_count = directory[table_index].entry_count;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    mapped_file m_file;
+};
+
+// =========================================================
+// Output the mapped rows directly as a bigmemory file-backed big.matrix.
+// This skips the csv round trip through read.big.matrix in R.
+// The backing file is a plain column-major array of int32 values,
+// i.e. all of column 1, then all of column 2, etc. (separated = FALSE),
+// so the total row count must be known before the first value is written.
+
+// Count the lines in a range of a mapped csv file.
+// A final line without a trailing newline is counted too, as std::getline would.
+long count_lines(const char* begin, const char* end)
+{
+    long newline_count = 0;
+    const char* position = begin;
+    while ((position = static_cast<const char*>(memchr(position, '\n', end - position))) != NULL)
+    {
+        newline_count++;
+        position++;
+    }
+    return newline_count + (end > begin && end[-1] != '\n' ? 1 : 0);
+}
+
+// Split the csv header line into column names.
+std::vector<std::string> split_header(const std::string& header_line)
+{
+    std::vector<std::string> column_names;
+    std::stringstream header(header_line);
+    std::string column_name;
+    while (std::getline(header, column_name, ','))
+    {
+        if (!column_name.empty() && column_name[column_name.size() - 1] == '\r')
+        {
+            column_name.erase(column_name.size() - 1);
+        }
+        column_names.push_back(column_name);
+    }
+    return column_names;
+}
+
+// Insert the element type into a backing file path, for a group of big.matrices
+// that split the columns by type: 2008.matrix -> 2008.short.matrix
+std::string typed_backing_path_for(const std::string& backing_file_path, const char* type_name)
+{
+    std::string::size_type slash_position = backing_file_path.find_last_of('/');
+    std::string::size_type dot_position = backing_file_path.find_last_of('.');
+    if (dot_position == std::string::npos || (slash_position != std::string::npos && dot_position < slash_position))
+    {
+        return backing_file_path + "." + type_name;
+    }
+    return backing_file_path.substr(0, dot_position) + "." + type_name + backing_file_path.substr(dot_position);
+}
+
+// Fill in the type of each column of a schema from a --column-types specification:
+// "narrow" for the schema's narrow types, optionally followed by overrides
+// like "narrow,TailNum:short,Year:integer". Columns not mentioned are integer.
+template <class SCHEMA>
+bool parse_column_types(const std::string& specification, column_type* types)
+{
+    for (int column_index = 0; column_index < SCHEMA::column_count; column_index++)
+    {
+        types[column_index] = integer_column;
+    }
+    std::stringstream items(specification);
+    std::string item;
+    while (std::getline(items, item, ','))
+    {
+        if (item == "narrow")
+        {
+            for (int column_index = 0; column_index < SCHEMA::column_count; column_index++)
+            {
+                types[column_index] = SCHEMA::narrow_types[column_index];
+            }
+            continue;
+        }
+        std::string::size_type colon_position = item.find(':');
+        if (colon_position == std::string::npos)
+        {
+            return false;
+        }
+        std::string column_name = item.substr(0, colon_position);
+        std::string type_name = item.substr(colon_position + 1);
+        int column_index = 0;
+        while (column_index < SCHEMA::column_count && column_name != SCHEMA::column_names[column_index])
+        {
+            column_index++;
+        }
+        int type_index = 0;
+        while (type_index < column_type_count && type_name != column_types[type_index].name)
+        {
+            type_index++;
+        }
+        if (column_index == SCHEMA::column_count || type_index == column_type_count)
+        {
+            return false;
+        }
+        types[column_index] = column_type(type_index);
+    }
+    return true;
+}
+
+// Count of values that did not fit the type of their column.
+// These are stored as the missing value, like malformed fields.
+std::atomic<long> out_of_range_value_count(0);
+
+// When the output is forced out to disk with fsync():
+// never (left to the OS), once at the end, or after every buffer written.
+enum sync_policy
+{
+    sync_none,
+    sync_end,
+    sync_buffer
+};
+
+// The column-major backing file of a big.matrix, created at its final size.
+// Column segments are written with pwrite() at their offsets,
+// so any number of writers (threads) can fill in different rows at once.
+class big_matrix_file
+{
+public:
+    big_matrix_file() : m_file_descriptor(-1), m_row_count(0), m_column_count(0), m_type(integer_column) {}
+    ~big_matrix_file() { close(); }
+
+    // Create the backing file at its final size: row_count * column_count values of the given type.
+    bool create(const char* backing_file_name, long row_count, long column_count, column_type type)
+    {
+        m_file_descriptor = ::open(backing_file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_file_descriptor < 0)
+        {
+            return false;
+        }
+        m_row_count = row_count;
+        m_column_count = column_count;
+        m_type = type;
+        return ftruncate(m_file_descriptor, (off_t)row_count * column_count * element_size()) == 0;
+    }
+
+    // Open a backing file already created at its final size, e.g. a combined matrix shared by several writers.
+    // Fails if the file is not the size given by row_count, column_count and type.
+    bool open(const char* backing_file_name, long row_count, long column_count, column_type type)
+    {
+        m_file_descriptor = ::open(backing_file_name, O_RDWR);
+        if (m_file_descriptor < 0)
+        {
+            return false;
+        }
+        m_row_count = row_count;
+        m_column_count = column_count;
+        m_type = type;
+        struct stat file_status;
+        return fstat(m_file_descriptor, &file_status) == 0
+            && file_status.st_size == off_t(row_count * column_count * element_size());
+    }
+
+    // Write value_count values of one column, already in the file's element type, starting at first_row.
+    bool write_column_segment(long column_index, long first_row, const void* values, long value_count)
+    {
+        if (first_row + value_count > m_row_count)
+        {
+            // More rows than were counted, the file changed under us.
+            return false;
+        }
+        const char* position = static_cast<const char*>(values);
+        size_t size = value_count * element_size();
+        off_t offset = ((off_t)column_index * m_row_count + first_row) * element_size();
+        while (size > 0)
+        {
+            ssize_t written = pwrite(m_file_descriptor, position, size, offset);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            position += written;
+            size -= written;
+            offset += written;
+        }
+        return true;
+    }
+
+    // Close the file, first forcing it out to disk unless policy is sync_none.
+    // Column segments land at scattered offsets from several threads,
+    // so sync_buffer is taken as sync_end here.
+    bool close(sync_policy policy = sync_none)
+    {
+        bool ok = true;
+        if (m_file_descriptor >= 0)
+        {
+            ok = (policy == sync_none || fsync(m_file_descriptor) == 0);
+            ok = (::close(m_file_descriptor) == 0) && ok;
+            m_file_descriptor = -1;
+        }
+        return ok;
+    }
+
+    long row_count() const { return m_row_count; }
+    long column_count() const { return m_column_count; }
+    column_type type() const { return m_type; }
+    size_t element_size() const { return column_types[m_type].element_size; }
+
+    // The zone map of the values written, see zone_map.h.
+    zone_map_builder& zones() { return m_zones; }
+
+private:
+    int m_file_descriptor;
+    long m_row_count;
+    long m_column_count;
+    column_type m_type;
+    zone_map_builder m_zones;
+};
+
+// Where one column of the converted rows is stored: a column of one of the big.matrix files.
+struct matrix_column
+{
+    big_matrix_file* file;
+    long column_index;
+};
+
+// Accumulates a block of rows per column and writes each column segment
+// to its place in the backing file of that column, starting at a given row.
+// Columns stored as char or short are narrowed on the way out.
+class big_matrix_writer
+{
+public:
+    static const long block_row_count = 65536;
+
+    big_matrix_writer(const std::vector<matrix_column>& destinations, long first_row, long row_count, int missing_value)
+        : m_destinations(destinations), m_block_first_row(first_row), m_block_rows(0), m_missing_value(missing_value)
+    {
+        m_block_capacity = row_count < block_row_count ? row_count : block_row_count;
+        m_columns.assign(destinations.size(), std::vector<int>(m_block_capacity > 0 ? m_block_capacity : 1));
+    }
+
+    // Append one row of column_count values.
+    bool append_row(const int* values)
+    {
+        buffer_row(values);
+        return full() ? flush() : true;
+    }
+
+    // Buffer one row without writing the block out when it fills, for a caller that times the flush() apart.
+    void buffer_row(const int* values)
+    {
+        for (size_t column_index = 0; column_index < m_columns.size(); column_index++)
+        {
+            m_columns[column_index][m_block_rows] = values[column_index];
+        }
+        m_block_rows++;
+    }
+
+    bool full() const { return m_block_rows >= m_block_capacity; }
+
+    // Write the buffered block of rows out to each column's segment of the backing file,
+    // adding the values as stored to the file's zone map while they are still in cache.
+    bool flush()
+    {
+        for (size_t column_index = 0; column_index < m_columns.size() && m_block_rows > 0; column_index++)
+        {
+            const matrix_column& destination = m_destinations[column_index];
+            const int* values = &m_columns[column_index][0];
+            bool written;
+            switch (destination.file->type())
+            {
+            case char_column:
+                written = write_segment(destination, narrow<int8_t>(values, char_column));
+                break;
+            case short_column:
+                written = write_segment(destination, narrow<int16_t>(values, short_column));
+                break;
+            default:
+                written = write_segment(destination, values);
+                break;
+            }
+            if (!written)
+            {
+                return false;
+            }
+        }
+        m_block_first_row += m_block_rows;
+        m_block_rows = 0;
+        return true;
+    }
+
+private:
+    template <typename T>
+    bool write_segment(const matrix_column& destination, const T* values)
+    {
+        destination.file->zones().record(destination.column_index, m_block_first_row, values, m_block_rows);
+        return destination.file->write_column_segment(destination.column_index, m_block_first_row, values, m_block_rows);
+    }
+
+    // Narrow the buffered block of a column into m_narrowed, storing values outside the type's range as missing.
+    template <typename T>
+    const T* narrow(const int* values, column_type type)
+    {
+        m_narrowed.resize(m_block_rows * sizeof(T));
+        T* narrowed = reinterpret_cast<T*>(&m_narrowed[0]);
+        long out_of_range_count = 0;
+        for (long row_index = 0; row_index < m_block_rows; row_index++)
+        {
+            int value = values[row_index];
+            if (value < column_types[type].min_value || value > column_types[type].max_value)
+            {
+                value = m_missing_value;
+                out_of_range_count++;
+            }
+            narrowed[row_index] = T(value);
+        }
+        if (out_of_range_count > 0)
+        {
+            out_of_range_value_count.fetch_add(out_of_range_count, std::memory_order_relaxed);
+        }
+        return narrowed;
+    }
+
+    const std::vector<matrix_column>& m_destinations;
+    long m_block_first_row;
+    long m_block_rows;
+    long m_block_capacity;
+    int m_missing_value;
+    std::vector<std::vector<int> > m_columns;
+    std::vector<char> m_narrowed;
+};
+
+// Accumulates a block of rows per column, as big_matrix_writer does,
+// and appends each column's block to the column store, encoded.
+class column_store_chunk_writer
+{
+public:
+    column_store_chunk_writer(column_store_writer& store, long column_count, long first_row, long row_count)
+        : m_store(store), m_block_first_row(first_row), m_block_rows(0)
+    {
+        m_block_capacity = row_count < column_store_block_row_count ? row_count : column_store_block_row_count;
+        m_columns.assign(column_count, std::vector<int>(m_block_capacity > 0 ? m_block_capacity : 1));
+    }
+
+    // Append one row of column_count values.
+    bool append_row(const int* values)
+    {
+        buffer_row(values);
+        return full() ? flush() : true;
+    }
+
+    // Buffer one row without writing the block out when it fills, for a caller that times the flush() apart.
+    void buffer_row(const int* values)
+    {
+        for (size_t column_index = 0; column_index < m_columns.size(); column_index++)
+        {
+            m_columns[column_index][m_block_rows] = values[column_index];
+        }
+        m_block_rows++;
+    }
+
+    bool full() const { return m_block_rows >= m_block_capacity; }
+
+    // Encode and append the buffered block of each column.
+    bool flush()
+    {
+        for (size_t column_index = 0; column_index < m_columns.size() && m_block_rows > 0; column_index++)
+        {
+            if (!m_store.write_block(column_index, m_block_first_row, &m_columns[column_index][0], m_block_rows, m_encoded))
+            {
+                return false;
+            }
+        }
+        m_block_first_row += m_block_rows;
+        m_block_rows = 0;
+        return true;
+    }
+
+private:
+    column_store_writer& m_store;
+    long m_block_first_row;
+    long m_block_rows;
+    long m_block_capacity;
+    std::vector<std::vector<int> > m_columns;
+    std::vector<char> m_encoded;
+};
+
+// =========================================================
+// Asynchronous csv output.
+// The converted text is gathered into one of two large buffers. When that buffer is full
+// it is handed to a writer thread, which pwrite()s it at the next file offset
+// while the other buffer fills, so the conversion only waits on the file system
+// when the file system falls a whole buffer behind. On Lustre a few large writes
+// are far cheaper than many small ones.
+
+class async_file_writer
+{
+public:
+    async_file_writer()
+        : m_file_descriptor(-1), m_buffer_size(0), m_policy(sync_none), m_filling(0), m_filled(0),
+          m_offset(0), m_pending(false), m_pending_size(0), m_closing(false), m_failed(false) {}
+    ~async_file_writer() { close(); }
+
+    bool open(const char* file_name, size_t buffer_size, sync_policy policy)
+    {
+        m_file_descriptor = ::open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (m_file_descriptor < 0)
+        {
+            return false;
+        }
+        m_buffer_size = buffer_size > 0 ? buffer_size : 1;
+        m_policy = policy;
+        m_buffers[0].resize(m_buffer_size);
+        m_buffers[1].resize(m_buffer_size);
+        m_thread = std::thread([this]() { run(); });
+        return true;
+    }
+
+    // Copy bytes into the filling buffer, handing it over each time it fills.
+    bool write(const char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            size_t part = std::min(size, m_buffer_size - m_filled);
+            memcpy(&m_buffers[m_filling][m_filled], data, part);
+            m_filled += part;
+            data += part;
+            size -= part;
+            if (m_filled == m_buffer_size && !hand_over())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Write out what is left, wait for the writer thread and close the file.
+    // Returns false if any write failed.
+    bool close()
+    {
+        if (m_file_descriptor < 0)
+        {
+            return !m_failed;
+        }
+        bool ok = m_filled == 0 || hand_over();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closing = true;
+            m_changed.notify_all();
+        }
+        m_thread.join();
+        ok = ok && !m_failed;
+        ok = (m_policy == sync_none || fsync(m_file_descriptor) == 0) && ok;
+        ok = (::close(m_file_descriptor) == 0) && ok;
+        m_file_descriptor = -1;
+        m_failed = !ok;
+        return ok;
+    }
+
+private:
+    // Pass the filled buffer to the writer thread, once it has finished with the other one.
+    bool hand_over()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [&]() { return !m_pending || m_failed; });
+        if (m_failed)
+        {
+            return false;
+        }
+        m_pending = true;
+        m_pending_size = m_filled;
+        m_filling = 1 - m_filling;
+        m_filled = 0;
+        m_changed.notify_all();
+        return true;
+    }
+
+    // The writer thread: write each buffer handed over, at the next offset.
+    void run()
+    {
+        for (;;)
+        {
+            size_t size;
+            const char* position;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_changed.wait(lock, [&]() { return m_pending || m_closing; });
+                if (!m_pending)
+                {
+                    return;
+                }
+                size = m_pending_size;
+                position = &m_buffers[1 - m_filling][0];
+            }
+
+            bool ok = true;
+            while (size > 0 && ok)
+            {
+                ssize_t written = pwrite(m_file_descriptor, position, size, m_offset);
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                ok = written > 0;
+                if (ok)
+                {
+                    position += written;
+                    size -= written;
+                    m_offset += written;
+                }
+            }
+            ok = ok && (m_policy != sync_buffer || fdatasync(m_file_descriptor) == 0);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending = false;
+            m_failed = m_failed || !ok;
+            m_changed.notify_all();
+        }
+    }
+
+    int m_file_descriptor;
+    size_t m_buffer_size;
+    sync_policy m_policy;
+    std::vector<char> m_buffers[2];
+    int m_filling;              // The buffer being filled, the other one may be being written.
+    size_t m_filled;
+    off_t m_offset;             // Only used by the writer thread.
+    bool m_pending;             // The other buffer is waiting for, or in, the writer thread.
+    size_t m_pending_size;
+    bool m_closing;
+    bool m_failed;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+};
+
+// =========================================================
+// Multi-threaded conversion of a single source file.
+// The data rows are cut into chunks at newline boundaries, either straight out of
+// the mapped source file or out of the blocks coming from a decompressing_reader.
+// Each chunk is converted on a worker thread and the results are written out
+// in the original row order: csv text is handed back to the calling thread in chunk order,
+// big.matrix rows go straight to their precomputed offsets in the backing file.
+
+struct conversion_chunk
+{
+    const char* begin;
+    const char* end;
+    long first_row;         // Data row index of the first line in the chunk.
+    long row_count;
+    std::vector<char> input;    // Holds the lines when they are not in a mapped file.
+    std::string output;     // Converted csv text, when writing csv.
+};
+
+// Hands out the header line and then chunks of about chunk_size bytes of a mapped source file,
+// each ending after a '\n'.
+class mapped_chunk_source
+{
+public:
+    mapped_chunk_source(const char* begin, const char* end, size_t chunk_size)
+        : m_position(begin), m_end(end), m_chunk_size(chunk_size), m_next_row(0) {}
+
+    bool read_header(std::string& header_line)
+    {
+        const char* line_end = find_line_end(m_position, m_end);
+        header_line.assign(m_position, line_end);
+        m_position = line_end < m_end ? line_end + 1 : m_end;
+        return true;
+    }
+
+    bool next(conversion_chunk& chunk)
+    {
+        if (m_position >= m_end)
+        {
+            return false;
+        }
+        const char* chunk_end = m_end;
+        if ((size_t)(m_end - m_position) > m_chunk_size)
+        {
+            chunk_end = static_cast<const char*>(memchr(m_position + m_chunk_size, '\n', m_end - m_position - m_chunk_size));
+            chunk_end = chunk_end != NULL ? chunk_end + 1 : m_end;
+        }
+        chunk.begin = m_position;
+        chunk.end = chunk_end;
+        chunk.first_row = m_next_row;
+        chunk.row_count = count_lines(m_position, chunk_end);
+        m_next_row += chunk.row_count;
+        m_position = chunk_end;
+        return true;
+    }
+
+    bool failed() const { return false; }
+
+private:
+    const char* m_position;
+    const char* m_end;
+    size_t m_chunk_size;
+    long m_next_row;
+};
+
+// Hands out the header line and then chunks of complete lines decompressed by a decompressing_reader.
+// A line split across two decompressed blocks is carried over into the next chunk.
+class decompressed_chunk_source
+{
+public:
+    explicit decompressed_chunk_source(decompressing_reader* reader)
+        : m_reader(reader), m_next_row(0), m_ended(false), m_failed(false) {}
+
+    bool read_header(std::string& header_line)
+    {
+        conversion_chunk first;
+        if (!next_lines(first))
+        {
+            return false;
+        }
+        const char* line_end = find_line_end(first.begin, first.end);
+        header_line.assign(first.begin, line_end);
+        // Put the lines after the header back in front of whatever comes next.
+        const char* rest = line_end < first.end ? line_end + 1 : first.end;
+        m_carry.insert(m_carry.begin(), rest, first.end);
+        return true;
+    }
+
+    bool next(conversion_chunk& chunk)
+    {
+        if (!next_lines(chunk))
+        {
+            return false;
+        }
+        chunk.first_row = m_next_row;
+        chunk.row_count = count_lines(chunk.begin, chunk.end);
+        m_next_row += chunk.row_count;
+        return true;
+    }
+
+    bool failed() const { return m_failed; }
+
+private:
+    // Fill the chunk with the carried over partial line plus decompressed blocks,
+    // up to and including the last complete line.
+    bool next_lines(conversion_chunk& chunk)
+    {
+        chunk.input.swap(m_carry);
+        m_carry.clear();
+        size_t scanned = 0;
+        for (;;)
+        {
+            const char* newline = NULL;
+            for (size_t index = chunk.input.size(); index > scanned; index--)
+            {
+                if (chunk.input[index - 1] == '\n')
+                {
+                    newline = &chunk.input[index - 1];
+                    break;
+                }
+            }
+            if (newline != NULL || m_ended)
+            {
+                size_t line_bytes = newline != NULL ? newline + 1 - &chunk.input[0] : chunk.input.size();
+                m_carry.assign(chunk.input.begin() + line_bytes, chunk.input.end());
+                chunk.input.resize(line_bytes);
+                break;
+            }
+
+            scanned = chunk.input.size();
+            char* block;
+            long block_size = decompressing_reader_next(m_reader, &block);
+            if (block_size <= 0)
+            {
+                m_ended = true;
+                m_failed = block_size < 0;
+                continue;
+            }
+            chunk.input.insert(chunk.input.end(), block, block + block_size);
+            free(block);
+        }
+
+        if (chunk.input.empty() || m_failed)
+        {
+            return false;
+        }
+        chunk.begin = &chunk.input[0];
+        chunk.end = chunk.begin + chunk.input.size();
+        return true;
+    }
+
+    decompressing_reader* m_reader;
+    std::vector<char> m_carry;
+    long m_next_row;
+    bool m_ended;
+    bool m_failed;
+};
+
+// With --clean each chunk is passed through the clean_to_ascii.c filter before it is split into fields,
+// so a raw download goes straight to the mapped output without an intermediate clean file.
+// The filter keeps every '\n', so the rows stay where they were counted, except for a final line
+// with no newline that has nothing left once cleaned (e.g. a trailing end of file character),
+// which clean_to_ascii followed by map_fields would not see as a row either.
+
+// Whether all of the bytes in a range are dropped by the filter.
+bool cleans_away(const char* begin, const char* end)
+{
+    for (const char* position = begin; position < end; position++)
+    {
+        if (ascii_filter_keeps((unsigned char)*position))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether a source ends with a line without a newline that cleans away.
+bool final_line_cleans_away(const char* begin, const char* end)
+{
+    if (begin == end || end[-1] == '\n')
+    {
+        return false;
+    }
+    const char* position = end;
+    while (position > begin && position[-1] != '\n')
+    {
+        position--;
+    }
+    return cleans_away(position, end);
+}
+
+// Strip the bytes clean_to_ascii.c drops from a chunk,
+// in place if the chunk holds its own lines, otherwise into a copy of the mapped lines.
+void clean_chunk(conversion_chunk& chunk)
+{
+    size_t size = chunk.end - chunk.begin;
+    if (size == 0)
+    {
+        return;
+    }
+    bool final_line_dropped = final_line_cleans_away(chunk.begin, chunk.end);
+    if (chunk.input.empty() || chunk.begin != &chunk.input[0])
+    {
+        chunk.input.resize(size);
+    }
+    size_t kept = ascii_filter_block(chunk.begin, size, &chunk.input[0]);
+    chunk.begin = &chunk.input[0];
+    chunk.end = chunk.begin + kept;
+    if (final_line_dropped)
+    {
+        chunk.row_count--;
+    }
+}
+
+// Count the data rows of a compressed file by decompressing it once.
+// This is the price of knowing the big.matrix size before writing compressed input.
+// With clean set a final line that cleans away is not counted, as with clean_chunk().
+long count_decompressed_data_rows(const char* file_name, bool clean)
+{
+    decompressing_reader* reader = decompressing_reader_open(file_name, 4 << 20, 4);
+    if (NULL == reader)
+    {
+        return -1;
+    }
+    long newline_count = 0;
+    char last_character = '\n';
+    bool final_line_dropped = true;     // The final partial line so far cleans away.
+    char* block;
+    long block_size;
+    while ((block_size = decompressing_reader_next(reader, &block)) > 0)
+    {
+        newline_count += count_lines(block, block + block_size) - (block[block_size - 1] != '\n' ? 1 : 0);
+        last_character = block[block_size - 1];
+        if (clean)
+        {
+            const char* line_begin = block + block_size;
+            while (line_begin > block && line_begin[-1] != '\n')
+            {
+                line_begin--;
+            }
+            final_line_dropped = (line_begin > block || final_line_dropped) && cleans_away(line_begin, block + block_size);
+        }
+        free(block);
+    }
+    if (decompressing_reader_close(reader) != 0 || block_size < 0)
+    {
+        return -1;
+    }
+    long line_count = newline_count + (last_character != '\n' && !(clean && final_line_dropped) ? 1 : 0);
+    return line_count > 0 ? line_count - 1 : 0;
+}
+
+// Run convert(chunk) for every chunk from source on thread_count worker threads,
+// while the calling thread passes the converted chunks to write(chunk) in their original order.
+// Workers stay at most a few chunks ahead of the writer to bound the memory held in chunks.
+template <class SOURCE, class CONVERT, class WRITE>
+bool convert_chunks_in_order(SOURCE& source, int thread_count, CONVERT convert, WRITE write, size_t& chunk_count)
+{
+    const size_t window = 2 * thread_count;
+    std::mutex source_mutex;
+    std::mutex mutex;
+    std::condition_variable chunk_converted;
+    std::condition_variable chunk_written;
+    std::map<size_t, conversion_chunk> converted;
+    size_t next_chunk = 0;
+    size_t written_count = 0;
+    bool source_ended = false;
+    bool failed = false;
+
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            for (;;)
+            {
+                conversion_chunk chunk;
+                size_t chunk_index;
+                {
+                    // Chunks are taken from the source one at a time so they are numbered in order.
+                    std::lock_guard<std::mutex> source_lock(source_mutex);
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        chunk_written.wait(lock, [&]() { return failed || next_chunk < written_count + window; });
+                        if (failed || source_ended)
+                        {
+                            return;
+                        }
+                    }
+                    bool have_chunk = source.next(chunk);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!have_chunk)
+                    {
+                        source_ended = true;
+                        failed = failed || source.failed();
+                        chunk_converted.notify_all();
+                        return;
+                    }
+                    chunk_index = next_chunk++;
+                }
+
+                bool ok = false;
+                try
+                {
+                    ok = convert(chunk);
+                }
+                catch (const std::exception& exception)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    std::cout << "Conversion failed near data row " << chunk.first_row + 1 
+                        << ": " << exception.what() << std::endl;
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                converted[chunk_index].input.swap(chunk.input);
+                converted[chunk_index].output.swap(chunk.output);
+                converted[chunk_index].first_row = chunk.first_row;
+                converted[chunk_index].row_count = chunk.row_count;
+                failed = failed || !ok;
+                chunk_converted.notify_all();
+            }
+        }));
+    }
+
+    for (size_t chunk_index = 0; ; chunk_index++)
+    {
+        conversion_chunk chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            chunk_converted.wait(lock, [&]() { return failed || converted.count(chunk_index) > 0 || (source_ended && chunk_index == next_chunk); });
+            if (failed || converted.count(chunk_index) == 0)
+            {
+                break;
+            }
+            std::map<size_t, conversion_chunk>::iterator item_location = converted.find(chunk_index);
+            chunk.output.swap(item_location->second.output);
+            chunk.first_row = item_location->second.first_row;
+            chunk.row_count = item_location->second.row_count;
+            converted.erase(item_location);
+        }
+
+        bool ok = write(chunk);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        written_count++;
+        failed = failed || !ok;
+        chunk_written.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = failed || !source_ended;
+        chunk_written.notify_all();
+    }
+    for (size_t thread_index = 0; thread_index < workers.size(); thread_index++)
+    {
+        workers[thread_index].join();
+    }
+    chunk_count = written_count;
+    return !failed;
+}
+
+// Filter the header line as the rows are filtered, and drop a DOS line ending.
+void trim_header_line(std::string& header_line, bool clean)
+{
+    if (clean && !header_line.empty())
+    {
+        header_line.resize(ascii_filter_block(header_line.data(), header_line.size(), &header_line[0]));
+    }
+    if (!header_line.empty() && header_line[header_line.size() - 1] == '\r')
+    {
+        header_line.erase(header_line.size() - 1);
+    }
+}
+
+// Read the header line of a source file, the mapped plain file or else the compressed one,
+// so its columns can be checked before any output is written. Returns false if it cannot be read.
+bool read_source_header(const char* file_name, const mapped_file& source_file, bool compressed, bool clean, std::string& header_line)
+{
+    if (compressed)
+    {
+        decompressing_reader* reader = decompressing_reader_open(file_name, 1 << 20, 1);
+        if (NULL == reader)
+        {
+            return false;
+        }
+        decompressed_chunk_source source(reader);
+        bool read = source.read_header(header_line);
+        // Corrupt data past the header is left for the conversion to report.
+        decompressing_reader_close(reader);
+        if (!read)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        mapped_chunk_source source(source_file.data(), source_file.data() + source_file.size(), 4 << 20);
+        source.read_header(header_line);
+    }
+    trim_header_line(header_line, clean);
+    return true;
+}
+
+// Count the data rows of a source file, plain or compressed, as its conversion will find them.
+// Returns -1 if the file cannot be read.
+long count_source_data_rows(const char* file_name, bool clean)
+{
+    int source_format = decompressing_reader_detect_format(file_name);
+    if (source_format == DECOMPRESSING_READER_BZIP2 || source_format == DECOMPRESSING_READER_GZIP)
+    {
+        return count_decompressed_data_rows(file_name, clean);
+    }
+    mapped_file source_file;
+    if (source_format < 0 || !source_file.open(file_name))
+    {
+        return -1;
+    }
+    const char* source_end = source_file.data() + source_file.size();
+    long data_row_count = count_lines(source_file.data(), source_end) - 1
+        - (clean && final_line_cleans_away(source_file.data(), source_end) ? 1 : 0);
+    return data_row_count > 0 ? data_row_count : 0;
+}
+
+// =========================================================
+// Run statistics.
+// With --stats the conversion counts what it meets and times its stages, to tell whether a slow run
+// is held up reading the source, converting it on the worker threads, or writing the output:
+//     read        taking chunks of lines from the source, for compressed input waiting on the decompressing thread,
+//                 for mapped input faulting in the pages of the chunk, which are read from disk unless cached
+//     clean       the --clean filter
+//     tokenize    finding the lines and splitting them into fields
+//     decode      decoding the integer fields
+//     lookup      looking the code fields up in the reference tables
+//     derive      computing the --derived-times columns
+//     format      formatting the csv text
+//     write       handing the csv text to the writer thread, which waits when the file system falls behind,
+//                 or buffering and writing the big.matrix and column store blocks
+// The stages are timed with the time stamp counter where there is one (x86), otherwise with the steady clock,
+// and the ticks are turned into seconds by timing the whole run with both. Even so a read costs as much as
+// a good part of a field's decode, so the stages of a row are timed for one row in row_sample_interval at random,
+// and scaled up by the rows over the rows timed, after taking off the cost of the laps, measured once at the start.
+// Whole chunk stages, e.g. reading and block writes, are always timed.
+// A worker keeps the counts and ticks of its chunk to itself and adds them into the run's totals once per chunk,
+// so the rows never touch shared memory. Stage times are wall time on each thread, so they include any time
+// the thread was descheduled, e.g. with more threads than cores. To tell that apart, the wall and CPU time
+// of the threads over each chunk are measured too, and the difference is reported as waiting.
+// Without --stats the stages are not timed and the fields are not counted, only the bytes, chunks and malformed rows are.
+
+enum conversion_stage
+{
+    read_stage,
+    clean_stage,
+    tokenize_stage,
+    decode_stage,
+    lookup_stage,
+    derive_stage,
+    format_stage,
+    write_stage,
+    conversion_stage_count
+};
+
+const char* const conversion_stage_names[conversion_stage_count] =
+    {"read", "clean", "tokenize", "decode", "lookup", "derive", "format", "write"};
+
+inline uint64_t stage_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Enough for the columns of the airline data and the derived ones.
+const int max_counted_column_count = 64;
+
+const int row_sample_interval = 16;
+
+// The counts and stage ticks of a chunk, or of the whole run.
+struct conversion_counts
+{
+    uint64_t ticks[conversion_stage_count];             // Of whole chunks.
+    uint64_t sampled_ticks[conversion_stage_count];     // Of the rows timed.
+    long sampled_rows;
+    long wall_nanoseconds;      // Of the threads over the chunks, see thread_time_meter.
+    long cpu_nanoseconds;
+    long input_bytes;           // Handed out by the source, after any decompression.
+    long output_bytes;          // Of csv text.
+    long rows;
+    long malformed_rows;        // Rows with more or fewer fields than the columns of the schema.
+    long na_fields[max_counted_column_count];       // "NA" or "" fields, by column.
+    long lookup_misses[max_counted_column_count];   // Codes not found in the reference tables, by column.
+
+    conversion_counts() { memset(this, 0, sizeof(*this)); }
+
+    void add(const conversion_counts& counts)
+    {
+        for (int stage = 0; stage < conversion_stage_count; stage++)
+        {
+            ticks[stage] += counts.ticks[stage];
+            sampled_ticks[stage] += counts.sampled_ticks[stage];
+        }
+        sampled_rows += counts.sampled_rows;
+        wall_nanoseconds += counts.wall_nanoseconds;
+        cpu_nanoseconds += counts.cpu_nanoseconds;
+        input_bytes += counts.input_bytes;
+        output_bytes += counts.output_bytes;
+        rows += counts.rows;
+        malformed_rows += counts.malformed_rows;
+        for (int column_index = 0; column_index < max_counted_column_count; column_index++)
+        {
+            na_fields[column_index] += counts.na_fields[column_index];
+            lookup_misses[column_index] += counts.lookup_misses[column_index];
+        }
+    }
+};
+
+// Times the stages of one thread in turn: lap() adds the ticks since the last lap, or restart(), to a stage,
+// less the ticks a lap takes.
+class stage_timer
+{
+public:
+    // Measure the ticks of a lap, the least of a few runs of back to back laps.
+    static void calibrate()
+    {
+        const int lap_count = 64;
+        uint64_t ticks[conversion_stage_count] = {0};
+        uint64_t lap_ticks = UINT64_MAX;
+        overhead_ticks = 0;
+        for (int run = 0; run < 16; run++)
+        {
+            stage_timer timer(true, ticks);
+            uint64_t run_start = stage_ticks();
+            for (int lap = 0; lap < lap_count; lap++)
+            {
+                timer.lap(read_stage);
+            }
+            lap_ticks = std::min(lap_ticks, (stage_ticks() - run_start) / lap_count);
+        }
+        overhead_ticks = lap_ticks;
+    }
+
+    stage_timer(bool enabled, uint64_t* ticks)
+        : m_enabled(enabled), m_ticks(ticks), m_last(enabled ? stage_ticks() : 0) {}
+
+    void restart()
+    {
+        if (m_enabled)
+        {
+            m_last = stage_ticks();
+        }
+    }
+
+    void lap(conversion_stage stage)
+    {
+        if (m_enabled)
+        {
+            uint64_t now = stage_ticks();
+            uint64_t elapsed = now - m_last;
+            m_ticks[stage] += elapsed > overhead_ticks ? elapsed - overhead_ticks : 0;
+            m_last = now;
+        }
+    }
+
+private:
+    static inline uint64_t overhead_ticks = 0;
+
+    bool m_enabled;
+    uint64_t* m_ticks;
+    uint64_t m_last;
+};
+
+// Measures the wall and the CPU time of the calling thread from its construction to add_to().
+class thread_time_meter
+{
+public:
+    explicit thread_time_meter(bool enabled)
+        : m_enabled(enabled), m_wall(enabled ? wall_nanoseconds() : 0), m_cpu(enabled ? cpu_nanoseconds() : 0) {}
+
+    void add_to(conversion_counts& counts) const
+    {
+        if (m_enabled)
+        {
+            counts.wall_nanoseconds += wall_nanoseconds() - m_wall;
+            counts.cpu_nanoseconds += cpu_nanoseconds() - m_cpu;
+        }
+    }
+
+private:
+    static long wall_nanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static long cpu_nanoseconds()
+    {
+        struct timespec time;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return time.tv_sec * 1000000000L + time.tv_nsec;
+    }
+
+    bool m_enabled;
+    long m_wall;
+    long m_cpu;
+};
+
+// Touch every page of a mapped range, so that reading it from disk is timed here rather than where it is first used.
+inline void fault_in_pages(const char* begin, const char* end)
+{
+    static const long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t first_page = uintptr_t(begin) & ~uintptr_t(page_size - 1);
+    madvise(reinterpret_cast<void*>(first_page), end - reinterpret_cast<const char*>(first_page), MADV_WILLNEED);
+    volatile char sink = 0;
+    for (const char* position = begin; position < end; position += page_size)
+    {
+        sink += *position;
+    }
+    sink += end > begin ? end[-1] : 0;
+}
+
+// Picks the rows to time, one in row_sample_interval on average, at random
+// so that work done every so many rows, e.g. growing a buffer, is sampled fairly.
+class row_sampler
+{
+public:
+    explicit row_sampler(uint64_t seed) : m_state(seed * 2 + 1) {}
+
+    bool next()
+    {
+        m_state = m_state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (m_state >> 32) % row_sample_interval == 0;
+    }
+
+private:
+    uint64_t m_state;
+};
+
+// Count the "NA" or "" fields of a row, and the code fields that were not, but decoded to the missing value all the same.
+inline void count_missing_fields(const std::string_view* fields, const int* values, const char* const* table_names,
+                                 int column_count, int missing_value, conversion_counts& counts)
+{
+    for (int column_index = 0; column_index < column_count; column_index++)
+    {
+        const std::string_view& field = fields[column_index];
+        bool na = field.empty() || (field.size() == 2 && field[0] == 'N' && field[1] == 'A');
+        counts.na_fields[column_index] += na;
+        counts.lookup_misses[column_index] += table_names[column_index] != NULL && !na && values[column_index] == missing_value;
+    }
+}
+
+// The totals of a run, added to by every thread.
+class conversion_stats
+{
+public:
+    conversion_stats() : m_input_bytes(0), m_start_ticks(0), m_ticks_per_second(1e9), m_seconds(0) {}
+
+    void start()
+    {
+        stage_timer::calibrate();
+        m_start_ticks = stage_ticks();
+        m_start_clock = std::chrono::steady_clock::now();
+    }
+
+    // Calibrate the ticks against the steady clock, once the conversion is done.
+    void stop()
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start_clock).count();
+        uint64_t ticks = stage_ticks() - m_start_ticks;
+        m_ticks_per_second = seconds > 0 && ticks > 0 ? ticks / seconds : 1e9;
+        m_seconds = seconds;
+    }
+
+    void add(const conversion_counts& counts)
+    {
+        m_input_bytes.fetch_add(counts.input_bytes, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_totals.add(counts);
+    }
+
+    // The source bytes handed out so far, for the progress lines.
+    long input_bytes() const { return m_input_bytes; }
+
+    const conversion_counts& totals() const { return m_totals; }
+
+    // The rows timed stand for all the rows.
+    double stage_seconds(int stage) const
+    {
+        double row_scale = m_totals.sampled_rows > 0 ? double(m_totals.rows) / m_totals.sampled_rows : 0;
+        return (m_totals.ticks[stage] + m_totals.sampled_ticks[stage] * row_scale) / m_ticks_per_second;
+    }
+    double conversion_seconds() const { return m_seconds; }
+
+private:
+    std::mutex m_mutex;
+    conversion_counts m_totals;
+    std::atomic<long> m_input_bytes;
+    uint64_t m_start_ticks;
+    std::chrono::steady_clock::time_point m_start_clock;
+    double m_ticks_per_second;
+    double m_seconds;
+};
+
+// A chunk source that times the read stage and counts the bytes handed out.
+template <class SOURCE>
+class timed_chunk_source
+{
+public:
+    timed_chunk_source(SOURCE& source, bool timed, conversion_stats& stats)
+        : m_source(source), m_timed(timed), m_stats(stats) {}
+
+    bool read_header(std::string& header_line) { return m_source.read_header(header_line); }
+
+    bool next(conversion_chunk& chunk)
+    {
+        conversion_counts counts;
+        thread_time_meter thread_time(m_timed);
+        stage_timer timer(m_timed, counts.ticks);
+        bool have_chunk = m_source.next(chunk);
+        timer.lap(read_stage);
+        thread_time.add_to(counts);
+        counts.input_bytes = have_chunk ? chunk.end - chunk.begin : 0;
+        m_stats.add(counts);
+        return have_chunk;
+    }
+
+    bool failed() const { return m_source.failed(); }
+
+private:
+    SOURCE& m_source;
+    bool m_timed;
+    conversion_stats& m_stats;
+};
+
+// Prints a progress line every interval_seconds (none if 0), called with each chunk as it is written, in order.
+// For long PBS array tasks, whose output is only seen in the job log.
+class progress_reporter
+{
+public:
+    progress_reporter(double interval_seconds, long expected_rows, long expected_bytes)
+        : m_interval_seconds(interval_seconds), m_expected_rows(expected_rows), m_expected_bytes(expected_bytes),
+          m_start_clock(std::chrono::steady_clock::now()), m_next_report(interval_seconds) {}
+
+    void report(long rows, long input_bytes)
+    {
+        if (m_interval_seconds <= 0)
+        {
+            return;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start_clock).count();
+        if (seconds < m_next_report)
+        {
+            return;
+        }
+        m_next_report = seconds + m_interval_seconds;
+        printf ("Progress: %ld rows", rows);
+        if (m_expected_rows > 0)
+        {
+            printf (" (%.1f%%)", 100.0 * rows / m_expected_rows);
+        }
+        else if (m_expected_bytes > 0)
+        {
+            printf (" (%.1f%%)", 100.0 * input_bytes / m_expected_bytes);
+        }
+        printf (", %.1f MB of source at %.1f MB/s, %.0f rows/s, %.1f s\n", input_bytes / 1e6, input_bytes / 1e6 / seconds, rows / seconds, seconds);
+        fflush(stdout);
+    }
+
+private:
+    double m_interval_seconds;
+    long m_expected_rows;
+    long m_expected_bytes;
+    std::chrono::steady_clock::time_point m_start_clock;
+    double m_next_report;
+};
+
+// Print the stage times and counts of a run.
+void print_conversion_stats(const conversion_stats& stats, int thread_count, const std::vector<std::string>& column_names,
+                            const char* const* table_names, long output_bytes)
+{
+    const conversion_counts& totals = stats.totals();
+    double total_seconds = 0;
+    for (int stage = 0; stage < conversion_stage_count; stage++)
+    {
+        total_seconds += stats.stage_seconds(stage);
+    }
+    printf ("%-10s %10s %8s\n", "Stage", "Seconds", "Share");
+    for (int stage = 0; stage < conversion_stage_count; stage++)
+    {
+        printf ("%-10s %10.3f %7.1f%%\n", conversion_stage_names[stage], stats.stage_seconds(stage),
+            total_seconds > 0 ? 100 * stats.stage_seconds(stage) / total_seconds : 0.0);
+    }
+    printf ("Stage time: %.3f seconds of wall time on the threads, the row stages scaled up from %ld of %ld rows timed\n",
+        total_seconds, totals.sampled_rows, totals.rows);
+    double wall_seconds = totals.wall_nanoseconds / 1e9;
+    double cpu_seconds = totals.cpu_nanoseconds / 1e9;
+    printf ("Thread time: %.3f seconds of wall time, %.3f of CPU time, %.3f waiting or descheduled, on %d threads over %.3f seconds of conversion\n",
+        wall_seconds, cpu_seconds, wall_seconds - cpu_seconds, thread_count, stats.conversion_seconds());
+    printf ("Bytes in: %ld, bytes out: %ld\n", totals.input_bytes, output_bytes);
+    long na_count = 0;
+    for (size_t column_index = 0; column_index < column_names.size(); column_index++)
+    {
+        na_count += totals.na_fields[column_index];
+    }
+    printf ("NA field count: %ld\n", na_count);
+    for (size_t column_index = 0; column_index < column_names.size(); column_index++)
+    {
+        if (table_names[column_index] != NULL)
+        {
+            printf ("Lookup miss count: %s (%s): %ld\n", column_names[column_index].c_str(), table_names[column_index],
+                totals.lookup_misses[column_index]);
+        }
+    }
+}
+
+// Write the stage times and counts of a run as json.
+bool write_conversion_stats_json(const std::string& stats_file_name, const conversion_stats& stats, int thread_count,
+                                 const std::vector<std::string>& column_names, const char* const* table_names,
+                                 const char* source_file_name, const char* destination_file_name, const char* format_name,
+                                 long source_bytes, long output_bytes, long malformed_fields, double duration_seconds)
+{
+    FILE* stats_file = fopen(stats_file_name.c_str(), "w");
+    if (stats_file == NULL)
+    {
+        return false;
+    }
+    const conversion_counts& totals = stats.totals();
+    // The file names are written as they were given; a name holding a quote or backslash is not expected.
+    fprintf(stats_file, "{\n  \"source\": \"%s\",\n  \"destination\": \"%s\",\n  \"format\": \"%s\",\n",
+        source_file_name, destination_file_name, format_name);
+    fprintf(stats_file, "  \"threads\": %d,\n  \"rows\": %ld,\n  \"malformed_rows\": %ld,\n  \"malformed_fields\": %ld,\n",
+        thread_count, totals.rows, totals.malformed_rows, malformed_fields);
+    fprintf(stats_file, "  \"source_bytes\": %ld,\n  \"input_bytes\": %ld,\n  \"output_bytes\": %ld,\n",
+        source_bytes, totals.input_bytes, output_bytes);
+    fprintf(stats_file, "  \"conversion_seconds\": %.6f,\n  \"duration_seconds\": %.6f,\n", stats.conversion_seconds(), duration_seconds);
+    fprintf(stats_file, "  \"thread_wall_seconds\": %.6f,\n  \"thread_cpu_seconds\": %.6f,\n  \"sampled_rows\": %ld,\n",
+        totals.wall_nanoseconds / 1e9, totals.cpu_nanoseconds / 1e9, totals.sampled_rows);
+    fprintf(stats_file, "  \"stage_seconds\": {");
+    for (int stage = 0; stage < conversion_stage_count; stage++)
+    {
+        fprintf(stats_file, "%s\"%s\": %.6f", stage > 0 ? ", " : "", conversion_stage_names[stage], stats.stage_seconds(stage));
+    }
+    fprintf(stats_file, "},\n  \"na_fields\": {");
+    for (size_t column_index = 0; column_index < column_names.size(); column_index++)
+    {
+        fprintf(stats_file, "%s\"%s\": %ld", column_index > 0 ? ", " : "", column_names[column_index].c_str(), totals.na_fields[column_index]);
+    }
+    fprintf(stats_file, "},\n  \"lookup_misses\": [");
+    bool first = true;
+    for (size_t column_index = 0; column_index < column_names.size(); column_index++)
+    {
+        if (table_names[column_index] != NULL)
+        {
+            fprintf(stats_file, "%s\n    {\"column\": \"%s\", \"table\": \"%s\", \"misses\": %ld}", first ? "" : ",",
+                column_names[column_index].c_str(), table_names[column_index], totals.lookup_misses[column_index]);
+            first = false;
+        }
+    }
+    fprintf(stats_file, "\n  ]\n}\n");
+    return fclose(stats_file) == 0;
+}
+
+// =========================================================
+// One combined big.matrix for many source files, e.g. all.matrix for 1987.csv to 2008.csv.
+// A planning pass (--plan-combined) counts the data rows of every source file, gives each
+// its range of rows in the combined matrix, creates the combined backing files at their final size
+// with their descriptors, and saves the row ranges in a layout file.
+// Each conversion (--layout), e.g. one PBS array task per year, then writes its rows
+// straight into its own range of the shared backing files, so no yearly matrices
+// are written and nothing is concatenated afterwards.
+
+// The layout file is plain text, one setting or source file per line:
+//     rows 123534969
+//     column_types narrow
+//     clean 1
+//     derived_times 1
+//     source 0 1311826 /lustre/pVPAC0012/raw/1987.csv.bz2
+//     source 1311826 5202096 /lustre/pVPAC0012/raw/1988.csv.bz2
+// giving each source's first row (from 0) and row count in the combined matrix.
+
+// A source file and its range of rows in the combined matrix.
+struct layout_source
+{
+    std::string file_name;
+    long first_row;
+    long row_count;
+};
+
+struct combined_layout
+{
+    long row_count;
+    std::string column_types_specification;     // As given to --column-types, empty for all integer.
+    bool clean;     // The row counts are those left after --clean.
+    bool derived_times;     // The derived time columns are appended, see --derived-times.
+    std::vector<layout_source> sources;
+
+    combined_layout() : row_count(0), clean(false), derived_times(false) {}
+};
+
+bool write_combined_layout(const std::string& layout_file_name, const combined_layout& layout)
+{
+    std::ofstream layout_file(layout_file_name.c_str());
+    if (!layout_file.is_open())
+    {
+        return false;
+    }
+    layout_file << "rows " << layout.row_count << "\n";
+    if (!layout.column_types_specification.empty())
+    {
+        layout_file << "column_types " << layout.column_types_specification << "\n";
+    }
+    layout_file << "clean " << (layout.clean ? 1 : 0) << "\n";
+    if (layout.derived_times)
+    {
+        layout_file << "derived_times 1\n";
+    }
+    for (size_t source_index = 0; source_index < layout.sources.size(); source_index++)
+    {
+        const layout_source& source = layout.sources[source_index];
+        layout_file << "source " << source.first_row << " " << source.row_count << " " << source.file_name << "\n";
+    }
+    layout_file.close();
+    return !layout_file.fail();
+}
+
+bool read_combined_layout(const std::string& layout_file_name, combined_layout& layout)
+{
+    std::ifstream layout_file(layout_file_name.c_str());
+    if (!layout_file.is_open())
+    {
+        return false;
+    }
+    layout = combined_layout();
+    bool has_rows = false;
+    std::string line;
+    while (std::getline(layout_file, line))
+    {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key))
+        {
+            continue;
+        }
+        if (key == "rows")
+        {
+            has_rows = bool(fields >> layout.row_count);
+        }
+        else if (key == "column_types")
+        {
+            fields >> layout.column_types_specification;
+        }
+        else if (key == "clean")
+        {
+            int clean = 0;
+            fields >> clean;
+            layout.clean = clean != 0;
+        }
+        else if (key == "derived_times")
+        {
+            int derived_times = 0;
+            fields >> derived_times;
+            layout.derived_times = derived_times != 0;
+        }
+        else if (key == "source")
+        {
+            // The file name is the rest of the line, so it may hold spaces.
+            layout_source source;
+            if (!(fields >> source.first_row >> source.row_count) || !std::getline(fields >> std::ws, source.file_name))
+            {
+                return false;
+            }
+            layout.sources.push_back(source);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // The sources must tile the combined rows exactly.
+    long next_row = 0;
+    for (size_t source_index = 0; source_index < layout.sources.size(); source_index++)
+    {
+        if (layout.sources[source_index].first_row != next_row || layout.sources[source_index].row_count < 0)
+        {
+            return false;
+        }
+        next_row += layout.sources[source_index].row_count;
+    }
+    return has_rows && next_row == layout.row_count;
+}
+
+// Find a source file in the layout by the path it was planned with, or failing that by its file name alone,
+// so the conversions may be run from another folder than the planning pass.
+const layout_source* find_layout_source(const combined_layout& layout, const std::string& file_name)
+{
+    for (size_t source_index = 0; source_index < layout.sources.size(); source_index++)
+    {
+        if (layout.sources[source_index].file_name == file_name)
+        {
+            return &layout.sources[source_index];
+        }
+    }
+    auto base_name = [](const std::string& path) { return path.substr(path.find_last_of('/') + 1); };
+    const layout_source* found = NULL;
+    for (size_t source_index = 0; source_index < layout.sources.size(); source_index++)
+    {
+        if (base_name(layout.sources[source_index].file_name) == base_name(file_name))
+        {
+            if (found != NULL)
+            {
+                // Ambiguous, e.g. the same file name in two folders.
+                return NULL;
+            }
+            found = &layout.sources[source_index];
+        }
+    }
+    return found;
+}
+
+// =========================================================
+// Csv text output.
+// Each row of ints is formatted straight into a byte buffer, two digits at a time
+// from a table of the pairs "00" to "99", with the missing value copied in as a
+// precomputed literal. This gives the same text as streaming the ints through std::ostream,
+// without the stream's per value locale and formatting state.
+
+const char digit_pairs[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+// Format an int as decimal text at output, returning the end of the text.
+// output needs room for 11 characters.
+inline char* format_integer(int value, char* output)
+{
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    if (value < 0)
+    {
+        *output++ = '-';
+    }
+    char digits[10];
+    char* digit = digits + sizeof(digits);
+    while (magnitude >= 100)
+    {
+        unsigned int pair = magnitude % 100;
+        magnitude /= 100;
+        digit -= 2;
+        memcpy(digit, digit_pairs + 2 * pair, 2);
+    }
+    if (magnitude >= 10)
+    {
+        digit -= 2;
+        memcpy(digit, digit_pairs + 2 * magnitude, 2);
+    }
+    else
+    {
+        *--digit = char('0' + magnitude);
+    }
+    size_t length = digits + sizeof(digits) - digit;
+    memcpy(output, digit, length);
+    return output + length;
+}
+
+// Formats whole rows of ints as csv lines.
+class csv_row_formatter
+{
+public:
+    // The most characters a row of column_count values can take, including the newline.
+    static size_t max_row_size(int column_count) { return column_count * 12; }
+
+    explicit csv_row_formatter(int missing_value)
+        : m_missing_value(missing_value)
+    {
+        m_missing_length = format_integer(missing_value, m_missing_text) - m_missing_text;
+    }
+
+    // Format column_count values as one csv line at output, returning the end of the line.
+    // output needs room for max_row_size(column_count) characters.
+    char* format_row(const int* values, int column_count, char* output) const
+    {
+        for (int column_index = 0; column_index < column_count; column_index++)
+        {
+            if (values[column_index] == m_missing_value)
+            {
+                memcpy(output, m_missing_text, m_missing_length);
+                output += m_missing_length;
+            }
+            else
+            {
+                output = format_integer(values[column_index], output);
+            }
+            *output++ = ',';
+        }
+        output[-1] = '\n';
+        return output;
+    }
+
+private:
+    int m_missing_value;
+    char m_missing_text[12];
+    size_t m_missing_length;
+};
+
+// =========================================================
+// Coordinate the processing of the source file and output to the destination file.
+// 1. Read the reference data files.
+// 2. Parse and transform the csv file rows into typed vectors.
+// 3. Output the typed vectors into a new destination file.
+
+/*  
+For reference:
+ 
+Field names (29 columns): 
+
+    Name    Description
+    1   Year                1987-2008
+    2   Month               1-12
+    3   DayofMonth          1-31
+    4   DayOfWeek           1 (Monday) - 7 (Sunday)
+    5   DepTime             actual departure time (local, hhmm)
+    6   CRSDepTime          scheduled departure time (local, hhmm)
+    7   ArrTime             actual arrival time (local, hhmm)
+    8   CRSArrTime          scheduled arrival time (local, hhmm)
+    
+    9   UniqueCarrier       unique carrier code
+    10  FlightNum           flight number
+    11  TailNum             plane tail number, looks like N497WN.
+    12  ActualElapsedTime   in minutes
+    13  CRSElapsedTime      in minutes
+    14  AirTime             in minutes
+    15  ArrDelay            arrival delay, in minutes
+    16  DepDelay            departure delay, in minutes
+    
+    17  Origin              origin IATA airport code
+    18  Dest                destination IATA airport code
+    19  Distance            in miles
+    20  TaxiIn              taxi in time, in minutes
+    21  TaxiOut             taxi out time in minutes
+    
+    22  Cancelled           was the flight cancelled?
+    23  CancellationCode    reason for cancellation (A = carrier, B = weather, C = NAS, D = security)
+    24  Diverted            1 = yes, 0 = no
+    25  CarrierDelay        in minutes
+    26  WeatherDelay        in minutes
+    27  NASDelay            in minutes
+    28  SecurityDelay       in minutes
+    
+    29  LateAircraftDelay   in minutes
+        
+Example data for one line of csv file.
+The layout matches the airline_schema columns below.
+    1987,10,14,3,741,730,912,849,
+    PS,1451,NA,91,79,NA,23,11,
+    SAN,SFO,447,NA,NA,
+    0,NA,0,NA,NA,NA,NA,
+    NA
+*/
+
+int main(int argc, char **argv)
+{
+	// Timing
+	
+    time_t start_time;
+    time_t end_time;
+    struct tm * timeinfo;
+    char buffer [80];
+    double duration_secs;
+    std::chrono::steady_clock::time_point start_clock;
+
+    struct lconv * lc;
+
+	// Data structures to receive a csv file row.
+	
+	//const int default_value = INT_MAX;
+	const int default_value = -1;
+    typedef integer_field<default_value> year;
+    typedef integer_field<default_value> month;
+    typedef integer_field<default_value> day_of_month;
+    typedef integer_field<default_value> day_of_week;
+    typedef integer_field<default_value> dep_time;
+    typedef integer_field<default_value> crs_dep_time;
+    typedef integer_field<default_value> arr_time;
+    typedef integer_field<default_value> crs_arr_time;
+    
+    typedef lookup_field<unique_carrier_id, default_value> unique_carrier;
+    typedef integer_field<default_value> flight_num;
+    typedef lookup_field<aircraft_id, default_value> tail_num;
+    typedef integer_field<default_value> actual_elapsed_time;
+    typedef integer_field<default_value> crs_elapsed_time;
+    typedef integer_field<default_value> air_time;
+    typedef integer_field<default_value> arr_delay;
+    typedef integer_field<default_value> dep_delay;
+    
+    typedef lookup_field<airport_id, default_value> origin;
+    typedef lookup_field<airport_id, default_value> destination;
+    typedef integer_field<default_value> distance;
+    typedef integer_field<default_value> taxi_in;
+    typedef integer_field<default_value> taxi_out;
+    
+    typedef integer_field<default_value> cancelled;
+    typedef lookup_field<cancellation_code_id, default_value> cancellation_code;
+    typedef integer_field<default_value> diverted;
+    typedef integer_field<default_value> carrier_delay;
+    typedef integer_field<default_value> weather_delay;
+    typedef integer_field<default_value> nas_delay;
+    typedef integer_field<default_value> security_delay;
+    
+    typedef integer_field<default_value> late_aircraft_delay;
+
+    // The layout of a row: each column's header name, field and narrowest big.matrix type.
+    // Codes and flags fit in a char, times, delays, distances and most ids in a short.
+    // Tail numbers stay integer so that --extend-dictionaries cannot overflow them.
+    namespace names = airline_column_names;
+    typedef csv_schema<
+        column<names::year, year, short_column>,
+        column<names::month, month, char_column>,
+        column<names::day_of_month, day_of_month, char_column>,
+        column<names::day_of_week, day_of_week, char_column>,
+        column<names::dep_time, dep_time, short_column>,
+        column<names::crs_dep_time, crs_dep_time, short_column>,
+        column<names::arr_time, arr_time, short_column>,
+        column<names::crs_arr_time, crs_arr_time, short_column>,
+
+        column<names::unique_carrier, unique_carrier, short_column>,
+        column<names::flight_num, flight_num, short_column>,
+        column<names::tail_num, tail_num, integer_column>,
+        column<names::actual_elapsed_time, actual_elapsed_time, short_column>,
+        column<names::crs_elapsed_time, crs_elapsed_time, short_column>,
+        column<names::air_time, air_time, short_column>,
+        column<names::arr_delay, arr_delay, short_column>,
+        column<names::dep_delay, dep_delay, short_column>,
+
+        column<names::origin, origin, short_column>,
+        column<names::destination, destination, short_column>,
+        column<names::distance, distance, short_column>,
+        column<names::taxi_in, taxi_in, short_column>,
+        column<names::taxi_out, taxi_out, short_column>,
+
+        column<names::cancelled, cancelled, char_column>,
+        column<names::cancellation_code, cancellation_code, char_column>,
+        column<names::diverted, diverted, char_column>,
+        column<names::carrier_delay, carrier_delay, short_column>,
+        column<names::weather_delay, weather_delay, short_column>,
+        column<names::nas_delay, nas_delay, short_column>,
+        column<names::security_delay, security_delay, short_column>,
+
+        column<names::late_aircraft_delay, late_aircraft_delay, short_column>
+    > airline_schema;
+    const int column_count = airline_schema::column_count;
+
+    // With --derived-times the derived time columns follow the columns of the source file.
+    typedef concatenated_schema<airline_schema, derived_time_schema>::type derived_airline_schema;
+    const int max_output_column_count = derived_airline_schema::column_count;
+    
+    // Interpret the command line parameters and perform input validation.
+    // TODO RR: Sorry! ugly mixture to c and c++ I might fix one day.
+    
+    // Options start with "--", the rest are positional arguments.
+    bool big_matrix_output = false;
+    bool column_store_output = false;
+    std::string column_types_specification;
+    bool extend_dictionaries = false;
+    bool build_dictionaries = false;
+    bool benchmark = false;
+    bool clean_input = false;
+    bool derived_times = false;
+    bool collect_stats = false;
+    bool stats_json = false;
+    double progress_seconds = -1;        // Every minute with --stats, otherwise none, unless --progress= is given.
+    size_t write_buffer_size = 16 << 20;
+    sync_policy output_sync = sync_none;
+    char* dictionary_file_name = NULL;
+    std::string plan_layout_file_name;
+    std::string layout_file_name;
+    std::string bitmap_columns = default_bitmap_columns;
+    int thread_count = 1;
+    std::vector<char*> arguments;
+    for (int argument_index = 1; argument_index < argc; argument_index++)
+    {
+        std::string argument = argv[argument_index];
+        if (argument == "--threads" && argument_index + 1 < argc)
+        {
+            argument = std::string("--threads=") + argv[++argument_index];
+        }
+        if (argument.compare(0, 10, "--threads=") == 0)
+        {
+            thread_count = atoi(argument.c_str() + 10);
+            if (thread_count < 1)
+            {
+                std::cout << "Invalid thread count: " << argument << std::endl;
+                return 1;
+            }
+        }
+        else if (argument == "--extend-dictionaries")
+        {
+            extend_dictionaries = true;
+        }
+        else if (argument == "--build-dictionaries")
+        {
+            build_dictionaries = true;
+        }
+        else if (argument == "--benchmark")
+        {
+            benchmark = true;
+        }
+        else if (argument == "--clean")
+        {
+            clean_input = true;
+        }
+        else if (argument == "--derived-times")
+        {
+            derived_times = true;
+        }
+        else if (argument == "--stats" || argument == "--stats=text" || argument == "--stats=json")
+        {
+            collect_stats = true;
+            stats_json = argument == "--stats=json";
+        }
+        else if (argument.compare(0, 11, "--progress=") == 0)
+        {
+            // In seconds, 0 for none.
+            char* end;
+            progress_seconds = strtod(argument.c_str() + 11, &end);
+            if (*end != '\0' || progress_seconds < 0)
+            {
+                std::cout << "Invalid progress interval: " << argument << std::endl;
+                return 1;
+            }
+        }
+        else if (argument.compare(0, 15, "--write-buffer=") == 0)
+        {
+            // In MB.
+            long megabytes = atol(argument.c_str() + 15);
+            if (megabytes < 1)
+            {
+                std::cout << "Invalid write buffer size: " << argument << std::endl;
+                return 1;
+            }
+            write_buffer_size = size_t(megabytes) << 20;
+        }
+        else if (argument == "--fsync=none" || argument == "--fsync=end" || argument == "--fsync=buffer")
+        {
+            output_sync = argument == "--fsync=none" ? sync_none : argument == "--fsync=end" ? sync_end : sync_buffer;
+        }
+        else if (argument.compare(0, 15, "--dictionaries=") == 0)
+        {
+            dictionary_file_name = argv[argument_index] + 15;
+        }
+        else if (argument == "--format=bigmatrix" || argument == "--format=columnstore" || argument == "--format=csv")
+        {
+            big_matrix_output = argument == "--format=bigmatrix";
+            column_store_output = argument == "--format=columnstore";
+        }
+        else if (argument.compare(0, 15, "--column-types=") == 0)
+        {
+            column_types_specification = argument.substr(15);
+        }
+        else if (argument.compare(0, 16, "--plan-combined=") == 0)
+        {
+            plan_layout_file_name = argument.substr(16);
+        }
+        else if (argument.compare(0, 9, "--layout=") == 0)
+        {
+            layout_file_name = argument.substr(9);
+        }
+        else if (argument.compare(0, 10, "--bitmaps=") == 0)
+        {
+            bitmap_columns = argument == "--bitmaps=none" ? std::string() : argument.substr(10);
+        }
+        else if (argument.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option: " << argument << std::endl;
+            return 1;
+        }
+        else
+        {
+            arguments.push_back(argv[argument_index]);
+        }
+    }
+
+    // With --layout the column types, cleaning and derived columns were fixed when the combined matrix was planned.
+    combined_layout layout;
+    if (!layout_file_name.empty())
+    {
+        if (!read_combined_layout(layout_file_name, layout))
+        {
+            std::cout << "Invalid layout file: " << layout_file_name << std::endl;
+            return 1;
+        }
+        if (!column_types_specification.empty() && column_types_specification != layout.column_types_specification)
+        {
+            std::cout << "The column types must be those of the layout file: " << layout.column_types_specification << std::endl;
+            return 1;
+        }
+        if (extend_dictionaries)
+        {
+            // Each conversion would number the added codes differently in the one matrix.
+            std::cout << "--extend-dictionaries cannot be used with --layout" << std::endl;
+            return 1;
+        }
+        if (derived_times && !layout.derived_times)
+        {
+            std::cout << "--derived-times was not given when the layout file was planned: " << layout_file_name << std::endl;
+            return 1;
+        }
+        if (clean_input && !layout.clean)
+        {
+            std::cout << "--clean was not given when the layout file was planned: " << layout_file_name << std::endl;
+            return 1;
+        }
+        column_types_specification = layout.column_types_specification;
+        clean_input = layout.clean;
+        derived_times = layout.derived_times;
+        big_matrix_output = true;
+    }
+    if (column_store_output && (!layout_file_name.empty() || !plan_layout_file_name.empty() || !column_types_specification.empty()))
+    {
+        // Column store blocks are encoded from whole int values, and are appended rather than written in place.
+        std::cout << "--format=columnstore cannot be used with --column-types, --plan-combined or --layout" << std::endl;
+        return 1;
+    }
 
-	// Data structures to receive a csv file row.
-	
-	//const int default_value = INT_MAX;
-	const int default_value = -1;
-    typedef integer_field<default_value> year;
-    typedef integer_field<default_value> month;
-    typedef integer_field<default_value> day_of_month;
-    typedef integer_field<default_value> day_of_week;
-    typedef integer_field<default_value> dep_time;
-    typedef integer_field<default_value> crs_dep_time;
-    typedef integer_field<default_value> arr_time;
-    typedef integer_field<default_value> crs_arr_time;
-    
-    typedef lookup_field<unique_carrier_id, default_value> unique_carrier;
-    typedef integer_field<default_value> flight_num;
-    typedef lookup_field<aircraft_id, default_value> tail_num;
-    typedef integer_field<default_value> actual_elapsed_time;
-    typedef integer_field<default_value> crs_elapsed_time;
-    typedef integer_field<default_value> air_time;
-    typedef integer_field<default_value> arr_delay;
-    typedef integer_field<default_value> dep_delay;
-    
-    typedef lookup_field<airport_id, default_value> origin;
-    typedef lookup_field<airport_id, default_value> destination;
-    typedef integer_field<default_value> distance;
-    typedef integer_field<default_value> taxi_in;
-    typedef integer_field<default_value> taxi_out;
-    
-    typedef integer_field<default_value> cancelled;
-    typedef lookup_field<cancellation_code_id, default_value> cancellation_code;
-    typedef integer_field<default_value> diverted;
-    typedef integer_field<default_value> carrier_delay;
-    typedef integer_field<default_value> weather_delay;
-    typedef integer_field<default_value> nas_delay;
-    typedef integer_field<default_value> security_delay;
-    
-    typedef integer_field<default_value> late_aircraft_delay;
+    // The columns written: those of the source file, then with --derived-times the derived ones.
+    const int output_column_count = derived_times ? max_output_column_count : column_count;
+    auto parse_output_column_types = [&](column_type* types) -> bool
+    {
+        return derived_times ? parse_column_types<derived_airline_schema>(column_types_specification, types)
+            : parse_column_types<airline_schema>(column_types_specification, types);
+    };
 
-    // Boost Fusion vector templates limited to 10 types so the 29 fields
-    // are broken up into field groups, each of which is below the 10 limit.
-    // Might get around it by changing
-    // #define FUSION_MAX_VECTOR_SIZE 29
-    // These are all string fields as the target data file has "NA" in some integer fields
-    // and this causes the parse to fall out of alignment.
-    typedef fusion::vector<year, month, day_of_month, day_of_week, dep_time, crs_dep_time, arr_time, crs_arr_time> csv_row0;
-    typedef fusion::vector<unique_carrier, flight_num, tail_num, actual_elapsed_time, crs_elapsed_time, air_time, arr_delay, dep_delay> csv_row1;
-    typedef fusion::vector<origin, destination, distance, taxi_in, taxi_out> csv_row2;
-    typedef fusion::vector<cancelled, cancellation_code, diverted, carrier_delay, weather_delay, nas_delay, security_delay> csv_row3;
-    typedef fusion::vector<late_aircraft_delay> csv_row4;
-    
-    // Interpret the command line parameters and perform input validation.
-    // TODO RR: Sorry! ugly mixture to c and c++ I might fix one day.
-    
-    if (argc == 3 || argc == 4)
+    if (build_dictionaries && (arguments.size() == 1 || arguments.size() == 2))
+    {
+        // Compile the csv reference data into a binary dictionary file for --dictionaries.
+        std::string reference_data_path = arguments.size() == 2 ? arguments[1] : "./";
+        reference_tables tables;
+        if (!load_reference_data(reference_data_path, tables))
+        {
+            return 1;
+        }
+        std::cout << "Dictionary file path: " << arguments[0] << std::endl;
+        if (!write_dictionary_file(arguments[0], tables))
+        {
+            std::cout << "Null output file pointer from path: " << arguments[0] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    else if (!plan_layout_file_name.empty() && arguments.size() >= 2)
+    {
+        // Plan the combined big.matrix of all the source files: [destination_filename.matrix] [source-filename]...
+        start_clock = std::chrono::steady_clock::now();
+        column_type destination_column_types[max_output_column_count];
+        if (!parse_output_column_types(destination_column_types))
+        {
+            std::cout << "Invalid column types: " << column_types_specification << std::endl;
+            return 1;
+        }
+        layout.column_types_specification = column_types_specification;
+        layout.clean = clean_input;
+        layout.derived_times = derived_times;
+        layout.sources.resize(arguments.size() - 1);
+
+        // Count the data rows of the source files in parallel, one file per thread at a time.
+        std::cout << "Thread count: " << thread_count << std::endl;
+        std::atomic<size_t> next_source(0);
+        std::vector<std::thread> workers;
+        for (int thread_index = 0; thread_index < thread_count; thread_index++)
+        {
+            workers.push_back(std::thread([&]()
+            {
+                size_t source_index;
+                while ((source_index = next_source.fetch_add(1)) < layout.sources.size())
+                {
+                    layout.sources[source_index].file_name = arguments[source_index + 1];
+                    layout.sources[source_index].row_count = count_source_data_rows(arguments[source_index + 1], clean_input);
+                }
+            }));
+        }
+        for (int thread_index = 0; thread_index < thread_count; thread_index++)
+        {
+            workers[thread_index].join();
+        }
+        for (size_t source_index = 0; source_index < layout.sources.size(); source_index++)
+        {
+            layout_source& source = layout.sources[source_index];
+            if (source.row_count < 0)
+            {
+                std::cout << "Null input file pointer from path: " << source.file_name << std::endl;
+                return 1;
+            }
+            source.first_row = layout.row_count;
+            layout.row_count += source.row_count;
+            std::cout << "Source file path: " << source.file_name << ", rows " << source.first_row + 1 << " to " << layout.row_count << std::endl;
+        }
+        std::cout << "Data row count: " << layout.row_count << std::endl;
+
+        // Create the combined backing files at their final size, each with its descriptor,
+        // named as tutorial_bigmemory_4.R names them: all.matrix -> all.matrix.desc
+        char* destination_file_name = arguments[0];
+        for (int type = 0; type < column_type_count; type++)
+        {
+            std::vector<std::string> matrix_column_names;
+            for (int column_index = 0; column_index < output_column_count; column_index++)
+            {
+                if (destination_column_types[column_index] == type)
+                {
+                    matrix_column_names.push_back(derived_airline_schema::column_names[column_index]);
+                }
+            }
+            if (matrix_column_names.empty())
+            {
+                continue;
+            }
+            std::string matrix_file_name = column_types_specification.empty()
+                ? std::string(destination_file_name) : typed_backing_path_for(destination_file_name, column_types[type].name);
+            std::cout << "Destination file path: " << matrix_file_name << " (" << matrix_column_names.size() << " "
+                << column_types[type].name << " columns)" << std::endl;
+            big_matrix_file matrix;
+            if (!matrix.create(matrix_file_name.c_str(), layout.row_count, matrix_column_names.size(), column_type(type)) || !matrix.close())
+            {
+                std::cout << "Null output file pointer from path: " << matrix_file_name << std::endl;
+                return 1;
+            }
+            // An empty zone map, which each conversion merges its blocks into.
+            std::string zone_map_file_name = zone_map_path_for(matrix_file_name);
+            std::cout << "Zone map file path: " << zone_map_file_name << std::endl;
+            matrix.zones().reset(layout.row_count, matrix_column_names.size(), default_value);
+            if (!matrix.zones().write(zone_map_file_name))
+            {
+                std::cout << "Null output file pointer from path: " << zone_map_file_name << std::endl;
+                return 1;
+            }
+            // Any bitmap index of an earlier all.matrix no longer matches it.
+            unlink(bitmap_index_path_for(matrix_file_name).c_str());
+            std::string descriptor_file_name = matrix_file_name + ".desc";
+            std::cout << "Descriptor file path: " << descriptor_file_name << std::endl;
+            if (!write_big_matrix_descriptor(descriptor_file_name, matrix_file_name, layout.row_count, matrix_column_names, column_types[type].name))
+            {
+                std::cout << "Null output file pointer from path: " << descriptor_file_name << std::endl;
+                return 1;
+            }
+        }
+
+        std::cout << "Layout file path: " << plan_layout_file_name << std::endl;
+        if (!write_combined_layout(plan_layout_file_name, layout))
+        {
+            std::cout << "Null output file pointer from path: " << plan_layout_file_name << std::endl;
+            return 1;
+        }
+        duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+        printf ("Duration/sec: %.3f\n", duration_secs);
+        return 0;
+    }
+    else if (!build_dictionaries && (arguments.size() == 2 || arguments.size() == 3)
+        && (column_types_specification.empty() || big_matrix_output))
     {
         printf ("Locale: %s\n", setlocale(LC_ALL, NULL));
         time ( &start_time );
+        start_clock = std::chrono::steady_clock::now();
         timeinfo = localtime ( &start_time );
         strftime (buffer,80,"%c", timeinfo);
         printf ("Date is: %s\n", buffer);
         
-        char* source_file_name = argv[1];
+        char* source_file_name = arguments[0];
         std::cout << "Source file path: " <<  source_file_name <<  std::endl;
-        std::ifstream source_file(source_file_name);
-        if (!source_file.is_open())
+        // Plain csv files are memory mapped, compressed ones (YYYY.csv.bz2 or .gz)
+        // are decompressed on a separate thread while they are converted.
+        int source_format = decompressing_reader_detect_format(source_file_name);
+        bool compressed_source = (source_format == DECOMPRESSING_READER_BZIP2 || source_format == DECOMPRESSING_READER_GZIP);
+        mapped_file source_file;
+        if (source_format < 0 || (!compressed_source && !source_file.open(source_file_name)))
         {
-            std::cout << "Null input file pointer from path: " <<  source_file <<  std::endl;
+            std::cout << "Null input file pointer from path: " <<  source_file_name <<  std::endl;
             return 1;
         }
 
-        char* destination_file_name = argv[2];
-        std::cout << "Destination file path: " <<  destination_file_name <<  std::endl;
-        std::ofstream destination_file(destination_file_name);
-        if (!destination_file.is_open())
+        // The big.matrix and column store columns are those of the schema, so a source with other columns,
+        // or none, is turned away before anything is counted or written.
+        if (big_matrix_output || column_store_output)
         {
-            std::cout << "Null output file pointer from path: " <<  destination_file <<  std::endl;
-            return 1;
+            std::string header_line;
+            if (!read_source_header(source_file_name, source_file, compressed_source, clean_input, header_line))
+            {
+                std::cout << "Null input file pointer from path: " <<  source_file_name <<  std::endl;
+                return 1;
+            }
+            size_t header_column_count = header_line.empty() ? 0 : split_header(header_line).size();
+            if (header_column_count != size_t(column_count))
+            {
+                std::cout << "Unexpected header column count: " << header_column_count << std::endl;
+                return 1;
+            }
         }
 
-		std::string reference_data_path = "./";
-        if (argc == 4)
+        // The big.matrix size is needed up front, which costs an extra decompression of compressed input.
+        // The column store appends its blocks, so it is written without counting.
+        // With --layout it was counted by the planning pass, along with where the rows go in the combined matrix.
+        long data_row_count = 0;
+        long first_matrix_row = 0;
+        if (!layout_file_name.empty())
         {
-            reference_data_path = argv[3];
+            std::cout << "Layout file path: " << layout_file_name << std::endl;
+            const layout_source* planned_source = find_layout_source(layout, source_file_name);
+            if (planned_source == NULL)
+            {
+                std::cout << "Source file not found in the layout file: " << source_file_name << std::endl;
+                return 1;
+            }
+            data_row_count = planned_source->row_count;
+            first_matrix_row = planned_source->first_row;
+            std::cout << "Combined matrix rows: " << first_matrix_row + 1 << " to " << first_matrix_row + data_row_count
+                << " of " << layout.row_count << std::endl;
         }
-        std::cout << "Reference data folder path: " <<  reference_data_path <<  std::endl;
-        std::cout << "(E.g. /path/to/reference/data/)" <<  std::endl;
-    
-        char carrier_file_name[] = "carriers.csv";
-        std::cout << "Carriers file path: " <<  reference_data_path + carrier_file_name <<  std::endl;
-        std::ifstream carrier_file((reference_data_path + carrier_file_name).c_str());
-        if (!carrier_file.is_open())
+        else if (big_matrix_output)
         {
-            std::cout << "Null input file pointer from path: " <<  carrier_file <<  std::endl;
-            return 1;
+            data_row_count = count_source_data_rows(source_file_name, clean_input);
+            if (data_row_count < 0)
+            {
+                std::cout << "Failed to count the rows of the source file: " << source_file_name << std::endl;
+                return 1;
+            }
         }
-    
-        char aircraft_file_name[] = "plane-data.csv";
-        std::cout << "Aircraft file path: " <<  reference_data_path + aircraft_file_name <<  std::endl;
-        std::ifstream aircraft_file((reference_data_path + aircraft_file_name).c_str());
-        if (!aircraft_file.is_open())
+
+        char* destination_file_name = arguments[1];
+        std::cout << "Destination file path: " <<  destination_file_name <<  std::endl;
+        async_file_writer destination_file;
+        column_store_writer destination_store;
+
+        // Without --column-types every column is integer and goes into the one big.matrix.
+        // With it the columns are grouped by type into destination_filename.{char,short,integer}.matrix.
+        column_type destination_column_types[max_output_column_count];
+        if (!parse_output_column_types(destination_column_types))
         {
-            std::cout << "Null input file pointer from path: " <<  aircraft_file <<  std::endl;
+            std::cout << "Invalid column types: " << column_types_specification << std::endl;
             return 1;
         }
-    
-        char airport_file_name[] = "airports.csv";
-        std::cout << "Airport file path: " <<  reference_data_path + airport_file_name <<  std::endl;
-        std::ifstream airport_file((reference_data_path + airport_file_name).c_str());
-        if (!airport_file.is_open())
+        big_matrix_file destination_matrices[column_type_count];
+        std::string matrix_file_names[column_type_count];
+        long matrix_column_counts[column_type_count] = {0, 0, 0};
+        std::vector<matrix_column> matrix_columns(output_column_count);
+        for (int column_index = 0; column_index < output_column_count; column_index++)
         {
-            std::cout << "Null input file pointer from path: " <<  airport_file <<  std::endl;
-            return 1;
+            column_type type = destination_column_types[column_index];
+            matrix_columns[column_index].file = &destination_matrices[type];
+            matrix_columns[column_index].column_index = matrix_column_counts[type]++;
         }
-        
-        // Load the reference data from files or define it inline.
-        
-        std::tr1::unordered_map<std::string, int> carrier_indices;
-        load_carriers(carrier_file, carrier_indices);
-        unique_carrier::s_lookup_table = carrier_indices; 
-        std::cout << carrier_indices.size() << std::endl;
-        for (std::tr1::unordered_map<std::string, int>::iterator it = carrier_indices.begin(); it != carrier_indices.end(); ++it)
+        const std::vector<matrix_column> no_matrix_columns;
+        if (big_matrix_output)
         {
-            std::cout << (*it).first << "," << (*it).second << std::endl;
+            // The row count fixes the column offsets in the backing files.
+            std::cout << "Data row count: " << data_row_count << std::endl;
+            for (int type = 0; type < column_type_count; type++)
+            {
+                if (matrix_column_counts[type] == 0)
+                {
+                    continue;
+                }
+                matrix_file_names[type] = column_types_specification.empty()
+                    ? std::string(destination_file_name) : typed_backing_path_for(destination_file_name, column_types[type].name);
+                if (!column_types_specification.empty())
+                {
+                    std::cout << "Destination " << column_types[type].name << " file path: " << matrix_file_names[type]
+                        << " (" << matrix_column_counts[type] << " columns)" << std::endl;
+                }
+                bool opened = layout_file_name.empty()
+                    ? destination_matrices[type].create(matrix_file_names[type].c_str(), data_row_count, matrix_column_counts[type], column_type(type))
+                    : destination_matrices[type].open(matrix_file_names[type].c_str(), layout.row_count, matrix_column_counts[type], column_type(type));
+                if (!opened)
+                {
+                    std::cout << "Null output file pointer from path: " <<  matrix_file_names[type] <<  std::endl;
+                    return 1;
+                }
+                destination_matrices[type].zones().reset(destination_matrices[type].row_count(), matrix_column_counts[type], default_value);
+            }
         }
-        
-        std::tr1::unordered_map<std::string, int> aircraft_indices;
-        load_aircraft(aircraft_file, aircraft_indices);
-        tail_num::s_lookup_table = aircraft_indices; 
-        std::cout << aircraft_indices.size() << std::endl;
-        for (std::tr1::unordered_map<std::string, int>::iterator it = aircraft_indices.begin(); it != aircraft_indices.end(); ++it)
+        else if (column_store_output)
         {
-            std::cout << (*it).first << "," << (*it).second << std::endl;
+            if (!destination_store.create(destination_file_name, output_column_count, default_value))
+            {
+                std::cout << "Null output file pointer from path: " <<  destination_file_name <<  std::endl;
+                return 1;
+            }
         }
-        
-        std::tr1::unordered_map<std::string, int> airport_indices;
-        load_airports(airport_file, airport_indices);
-        origin::s_lookup_table = airport_indices; // This is shared with destination.
-        std::cout << airport_indices.size() << std::endl;
-        for (std::tr1::unordered_map<std::string, int>::iterator it = airport_indices.begin(); it != airport_indices.end(); ++it)
+        else
         {
-            std::cout << (*it).first << "," << (*it).second << std::endl;
+            if (!destination_file.open(destination_file_name, write_buffer_size, output_sync))
+            {
+                std::cout << "Null output file pointer from path: " <<  destination_file_name <<  std::endl;
+                return 1;
+            }
         }
-        
-        std::tr1::unordered_map<std::string, int> cancellation_code_indices;
-        load_cancellation_codes(cancellation_code_indices);
-        cancellation_code::s_lookup_table = cancellation_code_indices; 
-        std::cout << cancellation_code_indices.size() << std::endl;
-        for (std::tr1::unordered_map<std::string, int>::iterator it = cancellation_code_indices.begin(); it != cancellation_code_indices.end(); ++it)
+
+		std::string reference_data_path = "./";
+        if (arguments.size() == 3)
+        {
+            reference_data_path = arguments[2];
+        }
+
+        // Load the reference data from the binary dictionary file, or from files and define it inline.
+
+        if (dictionary_file_name != NULL)
+        {
+            std::cout << "Dictionary file path: " << dictionary_file_name << std::endl;
+            dictionary_file dictionaries;
+            const dictionary_entry* entries[4];
+            size_t entry_counts[4];
+            if (!dictionaries.open(dictionary_file_name)
+                || !dictionaries.find_table("carriers", entries[0], entry_counts[0])
+                || !dictionaries.find_table("aircraft", entries[1], entry_counts[1])
+                || !dictionaries.find_table("airports", entries[2], entry_counts[2])
+                || !dictionaries.find_table("cancellation_codes", entries[3], entry_counts[3]))
+            {
+                std::cout << "Invalid dictionary file: " << dictionary_file_name << std::endl;
+                return 1;
+            }
+            unique_carrier::index_dictionary_entries(entries[0], entry_counts[0], extend_dictionaries);
+            tail_num::index_dictionary_entries(entries[1], entry_counts[1], extend_dictionaries);
+            origin::index_dictionary_entries(entries[2], entry_counts[2], extend_dictionaries); // This is shared with destination.
+            cancellation_code::index_dictionary_entries(entries[3], entry_counts[3], extend_dictionaries);
+            std::cout << "Carrier count: " << entry_counts[0] << ", aircraft count: " << entry_counts[1]
+                << ", airport count: " << entry_counts[2] << ", cancellation code count: " << entry_counts[3] << std::endl;
+        }
+        else
         {
-            std::cout << (*it).first << "," << (*it).second << std::endl;
+            reference_tables tables;
+            if (!load_reference_data(reference_data_path, tables))
+            {
+                return 1;
+            }
+
+            unique_carrier::s_lookup_table = tables.carriers; 
+            unique_carrier::index_lookup_table(extend_dictionaries);
+            print_lookup_table(tables.carriers);
+
+            tail_num::s_lookup_table = tables.aircraft; 
+            tail_num::index_lookup_table(extend_dictionaries);
+            print_lookup_table(tables.aircraft);
+
+            origin::s_lookup_table = tables.airports; // This is shared with destination.
+            origin::index_lookup_table(extend_dictionaries);
+            print_lookup_table(tables.airports);
+
+            cancellation_code::s_lookup_table = tables.cancellation_codes; 
+            cancellation_code::index_lookup_table(extend_dictionaries);
+            print_lookup_table(tables.cancellation_codes);
         }
         
-        // Read the csv file records from the input file.
-
-        std::string aline;
-        csv_row0 csv0;
-        csv_row1 csv1;
-        csv_row2 csv2;
-        csv_row3 csv3;
-        csv_row4 csv4;
-        long line_count = 0;
-        while ( std::getline (source_file, aline) )
+        // Read the csv file records from the input file, one chunk of rows per worker thread.
+        // The benchmark stages are timed on one thread so they add up to the conversion.
+
+        if (benchmark)
         {
-            if (line_count == 0)
+            if (compressed_source)
             {
-                // Ignore header line. Just feed it though unchanged.               
-                destination_file << aline << std::endl;
-            } 
-            else
+                std::cout << "--benchmark needs an uncompressed source file: " << source_file_name << std::endl;
+                return 1;
+            }
+            thread_count = 1;
+        }
+        std::cout << "Thread count: " << thread_count << std::endl;
+        if (clean_input)
+        {
+            ascii_filter_init();
+        }
+
+        // The tables the columns are looked up in, for counting the codes missing from them.
+        const char* table_names[max_output_column_count] = {NULL};
+        airline_schema::lookup_table_names(table_names);
+        conversion_stats stats;
+
+        auto convert_chunk = [&](conversion_chunk& chunk) -> bool
+        {
+            conversion_counts counts;
+            thread_time_meter thread_time(collect_stats);
+            stage_timer chunk_timer(collect_stats, counts.ticks);
+            row_sampler sampler(chunk.first_row);
+            if (collect_stats && chunk.input.empty())
+            {
+                // A chunk of a mapped file, whose pages would otherwise be read from disk while it is tokenized.
+                fault_in_pages(chunk.begin, chunk.end);
+                chunk_timer.lap(read_stage);
+            }
+            if (clean_input)
             {
-                // Parse the CSV rows, transform the fields and store in the data structure
+                clean_chunk(chunk);
+                chunk_timer.lap(clean_stage);
+            }
+            if (big_matrix_output && chunk.first_row + chunk.row_count > data_row_count)
+            {
+                // More rows than were counted, which would overwrite the next source's rows in a combined matrix.
+                return false;
+            }
+
+            int row_values[max_output_column_count];
+            std::string_view fields[column_count];
+            csv_row_formatter row_formatter(default_value);
+            derived_time_calculator<airline_schema> derived_time_columns(default_value);
+            size_t output_size = 0;
+            // Only a big.matrix run buffers its rows in blocks, the others would allocate them for nothing.
+            big_matrix_writer chunk_matrix(big_matrix_output ? matrix_columns : no_matrix_columns, first_matrix_row + chunk.first_row, chunk.row_count, default_value);
+            column_store_chunk_writer chunk_columns(destination_store, column_store_output ? output_column_count : 0, chunk.first_row, chunk.row_count);
+
+            const char* position = chunk.begin;
+            while (position < chunk.end)
+            {
+                bool timed_row = collect_stats && sampler.next();
+                stage_timer timer(timed_row, counts.sampled_ticks);
+                counts.sampled_rows += timed_row;
+                const char* line_end = find_line_end(position, chunk.end);
+                const char* next_line = line_end < chunk.end ? line_end + 1 : chunk.end;
+                if (line_end > position && line_end[-1] == '\r')
+                {
+                    line_end--;
+                }
+
+                // Split the CSV row into fields in place and decode them into the row of values.
+                // Fields missing from a short row are treated as "", those past the columns of a long one are dropped.
                 
-                std::stringstream row(aline);
-                using fusion::operator >>;
-                row  >> fusion::tuple_open("") << fusion::tuple_close("") << fusion::tuple_delimiter(',') >> csv0;
-                row.ignore(std::numeric_limits<std::streamsize>::max(), ',');
-                row  >> csv1; 
-                row.ignore(std::numeric_limits<std::streamsize>::max(), ',');
-                row  >> csv2; 
-                row.ignore(std::numeric_limits<std::streamsize>::max(), ',');
-                row  >> csv3;
-                row.ignore(std::numeric_limits<std::streamsize>::max(), ',');
-                row  >> csv4;
-                                
-                // Output the data structure into the new csv output file.
+                int field_count = split_fields(position, line_end, fields, column_count);
+                for (int field_index = field_count; field_index < column_count; field_index++)
+                {
+                    fields[field_index] = std::string_view();
+                }
+                // Counted on every run, as the padded or cut off fields are not otherwise seen.
+                counts.malformed_rows += field_count != column_count;
+                if (collect_stats)
+                {
+                    timer.lap(tokenize_stage);
+                    airline_schema::parse_row_part<false>(fields, row_values);
+                    timer.lap(decode_stage);
+                    airline_schema::parse_row_part<true>(fields, row_values);
+                    count_missing_fields(fields, row_values, table_names, column_count, default_value, counts);
+                    timer.lap(lookup_stage);
+                }
+                else
+                {
+                    airline_schema::parse_row(fields, row_values);
+                }
+                if (derived_times)
+                {
+                    derived_time_columns.compute(row_values, row_values + column_count);
+                    timer.lap(derive_stage);
+                }
+
+                // Output the row into the new big.matrix backing file, the column store
+                // or into the chunk's csv text.
                 
-                using fusion::operator <<;
-                destination_file
-                    // Set delimiters within field groups.
-                    << fusion::tuple_open("") << fusion::tuple_close("") << fusion::tuple_delimiter(',') 
-                    // Output field groups with "," delimiters between field groups.
-                    << csv0 << ","
-                    << csv1 << ","
-                    << csv2 << "," 
-                    << csv3 << "," 
-                    << csv4 
-                    << std::endl;
+                // The block writes of a full block are timed as a whole.
+                if (big_matrix_output)
+                {
+                    chunk_matrix.buffer_row(row_values);
+                    timer.lap(write_stage);
+                    if (chunk_matrix.full())
+                    {
+                        chunk_timer.restart();
+                        if (!chunk_matrix.flush())
+                        {
+                            return false;
+                        }
+                        chunk_timer.lap(write_stage);
+                    }
+                }
+                else if (column_store_output)
+                {
+                    chunk_columns.buffer_row(row_values);
+                    timer.lap(write_stage);
+                    if (chunk_columns.full())
+                    {
+                        chunk_timer.restart();
+                        if (!chunk_columns.flush())
+                        {
+                            return false;
+                        }
+                        chunk_timer.lap(write_stage);
+                    }
+                }
+                else
+                {
+                    if (chunk.output.size() < output_size + csv_row_formatter::max_row_size(output_column_count))
+                    {
+                        chunk.output.resize(2 * chunk.output.size() + csv_row_formatter::max_row_size(output_column_count));
+                    }
+                    output_size = row_formatter.format_row(row_values, output_column_count, &chunk.output[output_size]) - &chunk.output[0];
+                    timer.lap(format_stage);
+                }
+
+                position = next_line;
+            }
+
+            bool flushed = true;
+            chunk_timer.restart();
+            if (big_matrix_output)
+            {
+                flushed = chunk_matrix.flush();
+            }
+            else if (column_store_output)
+            {
+                flushed = chunk_columns.flush();
+            }
+            else
+            {
+                chunk.output.resize(output_size);
+            }
+            chunk_timer.lap(write_stage);
+            thread_time.add_to(counts);
+            counts.rows = chunk.row_count;
+            stats.add(counts);
+            return flushed;
+        };
+
+        // Progress is told in rows when they were counted, otherwise in bytes of a mapped source.
+        progress_reporter progress(progress_seconds >= 0 ? progress_seconds : collect_stats ? 60 : 0, big_matrix_output ? data_row_count : 0, compressed_source ? 0 : source_file.size());
+        long line_count = 0;
+        auto write_chunk = [&](conversion_chunk& chunk) -> bool
+        {
+            line_count += chunk.row_count;
+            bool written = true;
+            if (!big_matrix_output && !column_store_output)
+            {
+                conversion_counts counts;
+                thread_time_meter thread_time(collect_stats);
+                stage_timer timer(collect_stats, counts.ticks);
+                written = destination_file.write(chunk.output.data(), chunk.output.size());
+                timer.lap(write_stage);
+                thread_time.add_to(counts);
+                counts.output_bytes = chunk.output.size();
+                stats.add(counts);
+            }
+            progress.report(line_count, stats.input_bytes());
+            return written;
+        };
+
+        // The header line holds the column names, the data rows follow it.
+        std::vector<std::string> column_names;
+        size_t header_size = 0;
+        size_t chunk_count = 0;
+        auto convert_source = [&](auto& source) -> bool
+        {
+            std::string header_line;
+            if (!source.read_header(header_line))
+            {
+                return false;
+            }
+            trim_header_line(header_line, clean_input);
+            column_names = split_header(header_line);
+            for (int column_index = column_count; column_index < output_column_count; column_index++)
+            {
+                header_line += std::string(",") + derived_airline_schema::column_names[column_index];
+            }
+            if (!big_matrix_output && !column_store_output)
+            {
+                // Ignore header line. Just feed it though unchanged, but for the derived column names.
+                header_line += '\n';
+                destination_file.write(header_line.data(), header_line.size());
+                header_size = header_line.size();
+            }
+            return convert_chunks_in_order(source, thread_count, convert_chunk, write_chunk, chunk_count);
+        };
+
+        // With --benchmark the stages are first timed separately, each as a pass over all the data rows:
+        // splitting rows into fields, then splitting and decoding the integer fields,
+        // then splitting and looking up the code fields. The decode and lookup stages are
+        // those passes less the split pass, the write stage is what the full conversion takes beyond all three.
+        // With --clean, filtering the source is timed too, as a separate clean stage.
+        double clean_seconds = 0;
+        double tokenize_seconds = 0;
+        double decode_seconds = 0;
+        double lookup_seconds = 0;
+        long benchmark_row_count = 0;
+        if (benchmark)
+        {
+            const char* source_end = source_file.data() + source_file.size();
+            const char* header_end = find_line_end(source_file.data(), source_end);
+            const char* data_begin = header_end < source_end ? header_end + 1 : source_end;
+            long sink = 0;
+            auto time_pass = [&](auto use_fields) -> double
+            {
+                std::string_view fields[column_count];
+                std::chrono::steady_clock::time_point pass_start = std::chrono::steady_clock::now();
+                benchmark_row_count = 0;
+                const char* position = data_begin;
+                while (position < source_end)
+                {
+                    const char* line_end = find_line_end(position, source_end);
+                    const char* next_line = line_end < source_end ? line_end + 1 : source_end;
+                    if (line_end > position && line_end[-1] == '\r')
+                    {
+                        line_end--;
+                    }
+                    int field_count = split_fields(position, line_end, fields, column_count);
+                    for (int field_index = field_count; field_index < column_count; field_index++)
+                    {
+                        fields[field_index] = std::string_view();
+                    }
+                    use_fields(fields, field_count);
+                    benchmark_row_count++;
+                    position = next_line;
+                }
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - pass_start).count();
+            };
+
+            if (clean_input)
+            {
+                std::vector<char> cleaned(4 << 20);
+                std::chrono::steady_clock::time_point pass_start = std::chrono::steady_clock::now();
+                for (const char* position = data_begin; position < source_end; position += cleaned.size())
+                {
+                    size_t size = std::min(cleaned.size(), size_t(source_end - position));
+                    sink += ascii_filter_block(position, size, &cleaned[0]);
+                }
+                clean_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - pass_start).count();
             }
 
-            line_count++;
+            // The columns decoded and looked up come from the schema, as in the conversion.
+            int benchmark_values[column_count] = {0};
+            auto sum_values = [&]()
+            {
+                for (int column_index = 0; column_index < column_count; column_index++)
+                {
+                    sink += benchmark_values[column_index];
+                }
+            };
+
+            tokenize_seconds = time_pass([&](const std::string_view* fields, int field_count)
+            {
+                sink += field_count + fields[column_count - 1].size();
+            });
+            decode_seconds = time_pass([&](const std::string_view* fields, int)
+            {
+                airline_schema::parse_row_part<false>(fields, benchmark_values);
+                sum_values();
+            }) - tokenize_seconds;
+            lookup_seconds = time_pass([&](const std::string_view* fields, int)
+            {
+                airline_schema::parse_row_part<true>(fields, benchmark_values);
+                sum_values();
+            }) - tokenize_seconds;
+
+            // The decode pass has already counted the malformed fields once.
+            malformed_field_count = 0;
+            std::cout << "Benchmark checksum: " << sink << std::endl;
+        }
+        std::chrono::steady_clock::time_point convert_start = std::chrono::steady_clock::now();
+        stats.start();
+
+        bool converted;
+        if (compressed_source)
+        {
+            decompressing_reader* reader = decompressing_reader_open(source_file_name, 4 << 20, 2 * thread_count + 2);
+            if (NULL == reader)
+            {
+                std::cout << "Null input file pointer from path: " <<  source_file_name <<  std::endl;
+                return 1;
+            }
+            decompressed_chunk_source source(reader);
+            timed_chunk_source<decompressed_chunk_source> timed_source(source, collect_stats, stats);
+            converted = convert_source(timed_source);
+            converted = (decompressing_reader_close(reader) == 0) && converted;
+        }
+        else
+        {
+            mapped_chunk_source source(source_file.data(), source_file.data() + source_file.size(), 4 << 20);
+            timed_chunk_source<mapped_chunk_source> timed_source(source, collect_stats, stats);
+            converted = convert_source(timed_source);
+        }
+        stats.stop();
+        std::cout << "Chunk count: " << chunk_count << std::endl;
+        if (!converted || (big_matrix_output && line_count != data_row_count))
+        {
+            std::cout << "Failed to convert source file " << source_file_name << " to destination file: " << destination_file_name << std::endl;
+            return 1;
         }
         
         // Report statistics on the calculation.
         
-        std::cout << "Line count: " << line_count - 1 <<  std::endl;
+        std::cout << "Line count: " << line_count <<  std::endl;
+        std::cout << "Malformed field count: " << malformed_field_count <<  std::endl;
+        std::cout << "Malformed row count: " << stats.totals().malformed_rows <<  std::endl;
+
+        if (benchmark)
+        {
+            double convert_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - convert_start).count();
+            double write_seconds = convert_seconds - clean_seconds - tokenize_seconds - decode_seconds - lookup_seconds;
+            const char* stage_names[] = {"clean", "tokenize", "decode", "lookup", "write", "total"};
+            double stage_seconds[] = {clean_seconds, tokenize_seconds, decode_seconds, lookup_seconds, write_seconds, convert_seconds};
+            double source_megabytes = source_file.size() / 1e6;
+            printf ("Benchmark: %ld rows, %.1f MB\n", benchmark_row_count, source_megabytes);
+            printf ("%-10s %10s %10s %14s\n", "Stage", "Seconds", "MB/s", "Rows/s");
+            for (int stage_index = clean_input ? 0 : 1; stage_index < 6; stage_index++)
+            {
+                // Stages derived from differences can come out at or below zero on tiny inputs.
+                double seconds = stage_seconds[stage_index] > 1e-9 ? stage_seconds[stage_index] : 1e-9;
+                printf ("%-10s %10.3f %10.1f %14.0f\n", stage_names[stage_index], stage_seconds[stage_index],
+                    source_megabytes / seconds, benchmark_row_count / seconds);
+            }
+        }
+        if (!column_types_specification.empty())
+        {
+            std::cout << "Out of range value count: " << out_of_range_value_count <<  std::endl;
+        }
+
+        if (extend_dictionaries)
+        {
+            // Save the dictionaries with the codes added during this run, next to the destination file.
+            std::cout << "Added carrier count: " << unique_carrier::s_added_count << std::endl;
+            std::cout << "Added aircraft count: " << tail_num::s_added_count << std::endl;
+            std::cout << "Added airport count: " << origin::s_added_count << std::endl;
+            std::cout << "Added cancellation code count: " << cancellation_code::s_added_count << std::endl;
+            // A full table has stored the codes it refused as missing, so the conversion was not lossless.
+            long refused_counts[] = {unique_carrier::s_refused_count, tail_num::s_refused_count,
+                origin::s_refused_count, cancellation_code::s_refused_count};
+            const char* refused_tables[] = {"carriers", "aircraft", "airports", "cancellation_codes"};
+            bool refused = false;
+            for (int table_index = 0; table_index < 4; table_index++)
+            {
+                if (refused_counts[table_index] > 0)
+                {
+                    std::cout << "Codes not added to the full " << refused_tables[table_index] << " table: " << refused_counts[table_index] << std::endl;
+                    refused = true;
+                }
+            }
+            if (refused)
+            {
+                std::cout << "Failed to extend the dictionaries without loss, a table takes at least "
+                    << packed_key_table::extension_capacity << " added codes" << std::endl;
+                return 1;
+            }
+            std::string dictionary_path = destination_file_name;
+            if (!unique_carrier::write_dictionary(dictionary_path + ".carriers.csv")
+                || !tail_num::write_dictionary(dictionary_path + ".aircraft.csv")
+                || !origin::write_dictionary(dictionary_path + ".airports.csv")
+                || !cancellation_code::write_dictionary(dictionary_path + ".cancellation_codes.csv"))
+            {
+                std::cout << "Failed to write the extended dictionaries: " << dictionary_path << ".*.csv" << std::endl;
+                return 1;
+            }
+        }
 
         source_file.close();
-        destination_file.close();
+        if (big_matrix_output)
+        {
+            for (int column_index = column_count; column_index < output_column_count; column_index++)
+            {
+                column_names.push_back(derived_airline_schema::column_names[column_index]);
+            }
+            for (int type = 0; type < column_type_count; type++)
+            {
+                if (matrix_column_counts[type] == 0)
+                {
+                    continue;
+                }
+                if (!destination_matrices[type].close(output_sync))
+                {
+                    std::cout << "Failed to write big.matrix backing file: " << matrix_file_names[type] << std::endl;
+                    return 1;
+                }
+                std::string zone_map_file_name = zone_map_path_for(matrix_file_names[type]);
+                std::cout << "Zone map file path: " << zone_map_file_name << std::endl;
+                bool zones_written = layout_file_name.empty()
+                    ? destination_matrices[type].zones().write(zone_map_file_name)
+                    : destination_matrices[type].zones().merge_into_file(zone_map_file_name, first_matrix_row, data_row_count);
+                if (!zones_written)
+                {
+                    std::cout << "Failed to write zone map file: " << zone_map_file_name << std::endl;
+                    return 1;
+                }
+                if (!layout_file_name.empty())
+                {
+                    // The combined matrix descriptors were written by the planning pass.
+                    continue;
+                }
+                std::vector<std::string> matrix_column_names;
+                for (int column_index = 0; column_index < output_column_count; column_index++)
+                {
+                    if (destination_column_types[column_index] == type)
+                    {
+                        matrix_column_names.push_back(column_names[column_index]);
+                    }
+                }
+                std::string descriptor_file_name = descriptor_path_for(matrix_file_names[type]);
+                std::cout << "Descriptor file path: " << descriptor_file_name << std::endl;
+                if (!write_big_matrix_descriptor(descriptor_file_name, matrix_file_names[type], data_row_count, matrix_column_names, column_types[type].name))
+                {
+                    std::cout << "Null output file pointer from path: " << descriptor_file_name << std::endl;
+                    return 1;
+                }
+
+                // The bitmap index is built from the matrix just written, which is still in the page cache.
+                std::string bitmap_file_name = bitmap_index_path_for(matrix_file_names[type]);
+                if (bitmap_columns.empty())
+                {
+                    unlink(bitmap_file_name.c_str());
+                    continue;
+                }
+                std::vector<std::string> skipped_columns;
+                std::cout << "Bitmap index file path: " << bitmap_file_name << std::endl;
+                if (!build_bitmap_index_for(descriptor_file_name, bitmap_columns, thread_count, bitmap_file_name, skipped_columns))
+                {
+                    std::cout << "Failed to write bitmap index file: " << bitmap_file_name << std::endl;
+                    return 1;
+                }
+                for (size_t column_index = 0; column_index < skipped_columns.size(); column_index++)
+                {
+                    std::cout << "Too many values to index column: " << skipped_columns[column_index] << std::endl;
+                }
+            }
+        }
+        else if (column_store_output)
+        {
+            for (int column_index = column_count; column_index < output_column_count; column_index++)
+            {
+                column_names.push_back(derived_airline_schema::column_names[column_index]);
+            }
+            if (!destination_store.close(line_count, column_names, output_sync != sync_none))
+            {
+                std::cout << "Failed to write column store file: " << destination_file_name << std::endl;
+                return 1;
+            }
+            double matrix_size = double(line_count) * output_column_count * sizeof(int);
+            printf ("Column store size: %.1f MB, %.1f%% of the big.matrix\n", destination_store.size() / 1e6,
+                matrix_size > 0 ? 100 * destination_store.size() / matrix_size : 0.0);
+        }
+        else
+        {
+            // The writer thread's last buffers are written out by close().
+            conversion_counts counts;
+            thread_time_meter thread_time(collect_stats);
+            stage_timer timer(collect_stats, counts.ticks);
+            bool closed = destination_file.close();
+            timer.lap(write_stage);
+            thread_time.add_to(counts);
+            stats.add(counts);
+            if (!closed)
+            {
+                std::cout << "Failed to write destination file: " << destination_file_name << std::endl;
+                return 1;
+            }
+        }
+
+        if (collect_stats)
+        {
+            long output_bytes = header_size + stats.totals().output_bytes;
+            if (big_matrix_output)
+            {
+                output_bytes = 0;
+                for (int type = 0; type < column_type_count; type++)
+                {
+                    output_bytes += data_row_count * matrix_column_counts[type] * column_types[type].element_size;
+                }
+            }
+            else if (column_store_output)
+            {
+                output_bytes = destination_store.size();
+            }
+            // The counts are of the columns of the source file.
+            std::vector<std::string> stats_column_names(airline_schema::column_names, airline_schema::column_names + column_count);
+            print_conversion_stats(stats, thread_count, stats_column_names, table_names, output_bytes);
+            if (stats_json)
+            {
+                struct stat source_status;
+                long source_bytes = stat(source_file_name, &source_status) == 0 ? source_status.st_size : 0;
+                std::string stats_file_name = std::string(destination_file_name) + ".stats.json";
+                std::cout << "Stats file path: " << stats_file_name << std::endl;
+                const char* format_name = big_matrix_output ? "bigmatrix" : column_store_output ? "columnstore" : "csv";
+                duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+                if (!write_conversion_stats_json(stats_file_name, stats, thread_count, stats_column_names, table_names, source_file_name,
+                                                 destination_file_name, format_name, source_bytes, output_bytes, malformed_field_count, duration_secs))
+                {
+                    std::cout << "Null output file pointer from path: " << stats_file_name << std::endl;
+                    return 1;
+                }
+            }
+        }
 
         time ( &end_time );
         timeinfo = localtime ( &end_time );
         strftime (buffer, 80, "%c", timeinfo);
         printf ("Date is: %s\n",buffer);
         
-        duration_secs = difftime(end_time, start_time);
-        printf ("Duration/sec: %.f\n", duration_secs);
+        // The wall clock only has whole seconds, so the duration comes from the steady clock.
+        duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+        printf ("Duration/sec: %.3f\n", duration_secs);
 
         printf ("Locale: %s\n", setlocale(LC_ALL, "") );
         return 0;
     }
     else
     {
-        std::cout << "Use: ./map_fields [source-filename] [destination_filename] [reference_data_path]" <<  std::endl;
+        std::cout << "Use: ./map_fields [--format=csv|bigmatrix|columnstore] [--column-types=narrow[,Column:char|short|integer...]] [--threads N] [--extend-dictionaries] [--dictionaries=dictionary_filename] [--clean] [--derived-times] [--benchmark] [--stats[=json]] [--progress=seconds] [--write-buffer=MB] [--fsync=none|end|buffer] [--bitmaps=column,...|none] [--layout=layout_filename] [source-filename] [destination_filename] [reference_data_path]" <<  std::endl;
+        std::cout << " or: ./map_fields --plan-combined=layout_filename [--column-types=...] [--clean] [--derived-times] [--threads N] [destination_filename.matrix] [source-filename]..." <<  std::endl;
+        std::cout << " or: ./map_fields --build-dictionaries [dictionary_filename] [reference_data_path]" <<  std::endl;
         return 1;
     }
 }
@@ -0,0 +1,207 @@
+// Materialize a plain file-backed big.matrix from a block-compressed column store, e.g. 2008.columns,
+// written by map_fields --format=columnstore (see column_store.h), for when R needs to attach.big.matrix() it.
+
+// The integer backing file is preallocated at its final size, then a pool of threads decodes the blocks
+// of the store in directory order, each into its place in the column-major file with pwrite().
+// The descriptor is written next to it, named as map_fields names it: 2008.matrix -> 2008.desc,
+// along with the zone map (see zone_map.h), built from the values as they are decoded,
+// and the bitmap index (see bitmap_index.h) of the columns given by --bitmaps=column,..., by default those map_fields indexes,
+// so the result is the big.matrix map_fields --format=bigmatrix would have written.
+
+// To compile this c++ program on linux:
+//     g++ -W -std=c++17 -O2 -mavx2 -pthread materialize_matrix.cpp -o materialize_matrix
+// Run it with:
+//     $ ./materialize_matrix [--threads N] [--bitmaps=column,...|none] [column_store_filename] [destination_filename.matrix]
+// e.g.
+//     $ ./materialize_matrix --threads 8 big_matrices/2008.columns big_matrices/2008.matrix
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "big_matrix_descriptor.h"
+#include "bitmap_index.h"
+#include "column_store.h"
+#include "zone_map.h"
+
+int main(int argc, char **argv)
+{
+    int thread_count = 1;
+    std::string bitmap_columns = default_bitmap_columns;
+    std::vector<char*> arguments;
+    for (int argument_index = 1; argument_index < argc; argument_index++)
+    {
+        std::string argument = argv[argument_index];
+        if (argument == "--threads" && argument_index + 1 < argc)
+        {
+            argument = std::string("--threads=") + argv[++argument_index];
+        }
+        if (argument.compare(0, 10, "--threads=") == 0)
+        {
+            thread_count = atoi(argument.c_str() + 10);
+            if (thread_count < 1)
+            {
+                std::cout << "Invalid thread count: " << argument << std::endl;
+                return 1;
+            }
+        }
+        else if (argument.compare(0, 10, "--bitmaps=") == 0)
+        {
+            bitmap_columns = argument == "--bitmaps=none" ? std::string() : argument.substr(10);
+        }
+        else if (argument.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option: " << argument << std::endl;
+            return 1;
+        }
+        else
+        {
+            arguments.push_back(argv[argument_index]);
+        }
+    }
+
+    if (arguments.size() != 2)
+    {
+        std::cout << "Use: ./materialize_matrix [--threads N] [--bitmaps=column,...|none] [column_store_filename] [destination_filename.matrix]" << std::endl;
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start_clock = std::chrono::steady_clock::now();
+    column_store_reader store;
+    std::string error;
+    std::cout << "Column store file path: " << arguments[0] << std::endl;
+    if (!store.open(arguments[0], error))
+    {
+        std::cout << "Invalid column store file " << arguments[0] << ": " << error << std::endl;
+        return 1;
+    }
+    const long row_count = store.row_count();
+    const long column_count = store.column_count();
+    std::cout << "Row count: " << row_count << ", column count: " << column_count << ", block count: " << store.block_count() << std::endl;
+    if (store.column_names().size() != size_t(column_count))
+    {
+        std::cout << "Invalid column store file " << arguments[0] << ": " << store.column_names().size()
+            << " column names for " << column_count << " columns" << std::endl;
+        return 1;
+    }
+
+    // Preallocate the backing file so the writes never extend it.
+
+    char* destination_file_name = arguments[1];
+    std::cout << "Destination file path: " << destination_file_name << std::endl;
+    int destination_file = open(destination_file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (destination_file < 0)
+    {
+        std::cout << "Null output file pointer from path: " << destination_file_name << std::endl;
+        return 1;
+    }
+    off_t destination_size = (off_t)row_count * column_count * sizeof(int32_t);
+    int allocation_status = posix_fallocate(destination_file, 0, destination_size);
+    if (allocation_status != 0 && ftruncate(destination_file, destination_size) != 0)
+    {
+        std::cout << "Failed to allocate " << destination_size << " bytes for: " << destination_file_name << std::endl;
+        return 1;
+    }
+    zone_map_builder zones;
+    zones.reset(row_count, column_count, store.missing_value());
+
+    // Decode the blocks in parallel, each to its place in the backing file.
+
+    std::cout << "Thread count: " << thread_count << std::endl;
+    std::atomic<long> next_block(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            std::vector<int32_t> values;
+            std::vector<int32_t> scratch;
+            long block_index;
+            while (!failed && (block_index = next_block.fetch_add(1)) < store.block_count())
+            {
+                const column_block_entry& entry = store.block(block_index);
+                values.resize(entry.row_count);
+                store.decode_block(block_index, values.data(), scratch);
+                zones.record(entry.column_index, entry.first_row, values.data(), entry.row_count);
+                const char* position = reinterpret_cast<const char*>(values.data());
+                size_t size = entry.row_count * sizeof(int32_t);
+                off_t offset = ((off_t)entry.column_index * row_count + entry.first_row) * sizeof(int32_t);
+                while (size > 0)
+                {
+                    ssize_t written = pwrite(destination_file, position, size, offset);
+                    if (written < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (written <= 0)
+                    {
+                        failed = true;
+                        break;
+                    }
+                    position += written;
+                    size -= written;
+                    offset += written;
+                }
+            }
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+    }
+    if (close(destination_file) != 0 || failed)
+    {
+        std::cout << "Failed to write into the destination file: " << destination_file_name << std::endl;
+        return 1;
+    }
+    double decode_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+
+    std::string descriptor_file_name = descriptor_path_for(destination_file_name);
+    std::cout << "Descriptor file path: " << descriptor_file_name << std::endl;
+    if (!write_big_matrix_descriptor(descriptor_file_name, destination_file_name, row_count, store.column_names(), "integer"))
+    {
+        std::cout << "Null output file pointer from path: " << descriptor_file_name << std::endl;
+        return 1;
+    }
+    std::string zone_map_file_name = zone_map_path_for(destination_file_name);
+    std::cout << "Zone map file path: " << zone_map_file_name << std::endl;
+    if (!zones.write(zone_map_file_name))
+    {
+        std::cout << "Null output file pointer from path: " << zone_map_file_name << std::endl;
+        return 1;
+    }
+
+    // A bitmap index left from an earlier run would no longer match the matrix.
+    std::string bitmap_file_name = bitmap_index_path_for(destination_file_name);
+    unlink(bitmap_file_name.c_str());
+    if (!bitmap_columns.empty())
+    {
+        std::vector<std::string> skipped_columns;
+        std::cout << "Bitmap index file path: " << bitmap_file_name << std::endl;
+        if (!build_bitmap_index_for(descriptor_file_name, bitmap_columns, thread_count, bitmap_file_name, skipped_columns))
+        {
+            std::cout << "Failed to write bitmap index file: " << bitmap_file_name << std::endl;
+            return 1;
+        }
+        for (size_t column_index = 0; column_index < skipped_columns.size(); column_index++)
+        {
+            std::cout << "Too many values to index column: " << skipped_columns[column_index] << std::endl;
+        }
+    }
+
+    double duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+    printf ("Duration/sec: %.3f\n", duration_secs);
+    printf ("Decode rate MB/s: %.1f (of the big.matrix, from %.1f MB of column store)\n",
+        destination_size / 1e6 / (decode_secs > 0 ? decode_secs : 1e-9), store.file_size() / 1e6);
+    return 0;
+}
@@ -9,7 +9,7 @@
 #PBS -N map_fields
 
 #     how many cpus and cores?
-#PBS -l nodes=1:ppn=1
+#PBS -l nodes=1:ppn=8
 
 #      how much memory
 #PBS -l mem=1G
@@ -41,10 +41,25 @@ module load boost
 cd $PBS_O_WORKDIR
  
 #     Launching the job as a job array!
+#     Each array task converts one year, using --threads to split that year across the ppn cores.
 
 #PBS -t 1987-1988
 
-./map_fields /lustre/pVPAC0012/raw/${PBS_ARRAYID}.csv /lustre/pVPAC0012/preprocessed/${PBS_ARRAYID}.csv /lustre/pVPAC0012/reference_data/
+./map_fields --threads 8 /lustre/pVPAC0012/raw/${PBS_ARRAYID}.csv /lustre/pVPAC0012/preprocessed/${PBS_ARRAYID}.csv /lustre/pVPAC0012/reference_data/
+
+# Or build the dictionaries once before submitting the array:
+#     ./map_fields --build-dictionaries /lustre/pVPAC0012/reference_data/dictionaries.bin /lustre/pVPAC0012/reference_data/
+# and have every task map them instead of parsing the reference csv files:
+# ./map_fields --threads 8 --dictionaries=/lustre/pVPAC0012/reference_data/dictionaries.bin /lustre/pVPAC0012/raw/${PBS_ARRAYID}.csv /lustre/pVPAC0012/preprocessed/${PBS_ARRAYID}.csv
+
+# Or write file-backed big.matrices (YYYY.matrix + YYYY.desc) directly, skipping tutorial_bigmemory_3.R:
+# ./map_fields --threads 8 --format=bigmatrix /lustre/pVPAC0012/raw/${PBS_ARRAYID}.csv /lustre/pVPAC0012/big_matrices/${PBS_ARRAYID}.matrix /lustre/pVPAC0012/reference_data/
+
+# Or write every year into its rows of one combined big.matrix, after planning it once before submitting the array:
+#     ./map_fields --plan-combined=/lustre/pVPAC0012/big_matrices/all.layout --threads 8 /lustre/pVPAC0012/big_matrices/all.matrix /lustre/pVPAC0012/raw/{1987..2008}.csv
+# ./map_fields --threads 8 --layout=/lustre/pVPAC0012/big_matrices/all.layout /lustre/pVPAC0012/raw/${PBS_ARRAYID}.csv /lustre/pVPAC0012/big_matrices/all.matrix /lustre/pVPAC0012/reference_data/
+# and index it once the whole array has finished:
+#     ./query_matrix --threads 8 --build-bitmaps /lustre/pVPAC0012/big_matrices/all.matrix.desc
 
 # map_fields-<1987-2008>.out will contain the mapping 
 # between string identifiers and integers for:
@@ -0,0 +1,261 @@
+// Query a file-backed big.matrix, e.g. all.matrix, without R.
+// This is the query of tutorial_bigmemory_6.R:
+//     long_flight_indices <- mwhich(full_matrix, 12, 1800, 'ge')
+// followed by full_matrix[flight_index, 10] and full_matrix[flight_index, 19] for each of the rows found,
+// done as a parallel scan of the matrix columns and one batched fetch per selected column (see column_scan.h).
+
+// Conditions are written column:comparison:value, with the comparisons of mwhich (eq, neq, lt, le, gt, ge),
+// and the column given by its name or its number counted from 1, e.g. ActualElapsedTime:ge:1800 or 12:ge:1800.
+// The rows must meet all of the conditions, or with --op=OR any of them.
+// The row numbers found (counted from 1, as mwhich gives them) and the --select columns at those rows
+// are printed as csv, or with --output=result.matrix written as a file-backed big.matrix of integers
+// with the descriptor result.matrix.desc, for attach.big.matrix.
+// Blocks of rows that the matrix's zone map (all.matrix.zones, written by map_fields) rules out are not read at all.
+// Selective conditions on the columns of the matrix's bitmap index (all.matrix.bitmaps, see bitmap_index.h)
+// are answered from the index, ANDing or ORing the bitmaps and reading only the rows found, unless --no-bitmaps is given.
+// With --build-bitmaps, or --build-bitmaps=column,... for other columns than the default ones,
+// the bitmap index of the matrix is built instead, e.g. after the map_fields --layout tasks have written all.matrix.
+
+// To compile this c++ program on linux:
+//     g++ -W -std=c++17 -O2 -mavx2 -pthread query_matrix.cpp -o query_matrix
+// Run it with:
+//     $ ./query_matrix [--threads N] [--op=AND|OR] [--select=column,...] [--output=result_filename] [--no-bitmaps] [descriptor_filename] [condition]...
+//     $ ./query_matrix [--threads N] --build-bitmaps[=column,...] [descriptor_filename]
+// e.g.
+//     $ ./query_matrix --threads 8 --select=FlightNum,Distance big_matrices/all.matrix.desc ActualElapsedTime:ge:1800
+//     $ ./query_matrix --select=FlightNum big_matrices/all.matrix.desc Cancelled:eq:1 UniqueCarrier:eq:5 Origin:eq:17
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bitmap_index.h"
+#include "column_scan.h"
+
+// Write the result as a column-major big.matrix of integers with its descriptor.
+bool write_result_matrix(const std::string& result_file_name, const std::vector<std::string>& column_names,
+                         const std::vector<std::vector<int> >& columns)
+{
+    std::ofstream result_file(result_file_name.c_str(), std::ios::binary);
+    if (!result_file.is_open())
+    {
+        return false;
+    }
+    for (size_t column_index = 0; column_index < columns.size(); column_index++)
+    {
+        result_file.write(reinterpret_cast<const char*>(columns[column_index].data()), columns[column_index].size() * sizeof(int));
+    }
+    result_file.close();
+    long row_count = columns.empty() ? 0 : columns[0].size();
+    return !result_file.fail()
+        && write_big_matrix_descriptor(result_file_name + ".desc", result_file_name, row_count, column_names, "integer");
+}
+
+int main(int argc, char **argv)
+{
+    int thread_count = 1;
+    bool any = false;
+    bool use_bitmaps = true;
+    bool build_bitmaps = false;
+    std::string bitmap_columns = default_bitmap_columns;
+    std::string select_specification;
+    std::string result_file_name;
+    std::vector<char*> arguments;
+    for (int argument_index = 1; argument_index < argc; argument_index++)
+    {
+        std::string argument = argv[argument_index];
+        if (argument == "--threads" && argument_index + 1 < argc)
+        {
+            argument = std::string("--threads=") + argv[++argument_index];
+        }
+        if (argument.compare(0, 10, "--threads=") == 0)
+        {
+            thread_count = atoi(argument.c_str() + 10);
+            if (thread_count < 1)
+            {
+                std::cout << "Invalid thread count: " << argument << std::endl;
+                return 1;
+            }
+        }
+        else if (argument == "--op=AND" || argument == "--op=OR")
+        {
+            any = argument == "--op=OR";
+        }
+        else if (argument.compare(0, 9, "--select=") == 0)
+        {
+            select_specification = argument.substr(9);
+        }
+        else if (argument.compare(0, 9, "--output=") == 0)
+        {
+            result_file_name = argument.substr(9);
+        }
+        else if (argument == "--no-bitmaps")
+        {
+            use_bitmaps = false;
+        }
+        else if (argument == "--build-bitmaps" || argument.compare(0, 16, "--build-bitmaps=") == 0)
+        {
+            build_bitmaps = true;
+            bitmap_columns = argument.size() > 16 ? argument.substr(16) : bitmap_columns;
+        }
+        else if (argument.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option: " << argument << std::endl;
+            return 1;
+        }
+        else
+        {
+            arguments.push_back(argv[argument_index]);
+        }
+    }
+
+    if (arguments.size() < 1)
+    {
+        std::cout << "Use: ./query_matrix [--threads N] [--op=AND|OR] [--select=column,...] [--output=result_filename] [--no-bitmaps] [descriptor_filename] [condition]..." << std::endl;
+        std::cout << "  or: ./query_matrix [--threads N] --build-bitmaps[=column,...] [descriptor_filename]" << std::endl;
+        std::cout << " where a condition is column:eq|neq|lt|le|gt|ge:value, e.g. ActualElapsedTime:ge:1800" << std::endl;
+        return 1;
+    }
+
+    // The progress goes to stderr when the result rows are printed, so the rows alone can be redirected.
+    std::ostream& progress = result_file_name.empty() && !build_bitmaps ? std::cerr : std::cout;
+
+    // Attach the matrix.
+
+    std::chrono::steady_clock::time_point start_clock = std::chrono::steady_clock::now();
+    mapped_big_matrix matrix;
+    std::string error;
+    if (!matrix.open(arguments[0], error))
+    {
+        std::cout << "Invalid descriptor file " << arguments[0] << ": " << error << std::endl;
+        return 1;
+    }
+    progress << "Matrix file path: " << matrix.backing_path() << ", rows: " << matrix.row_count()
+        << ", columns: " << matrix.column_count() << ", type: " << matrix.descriptor().type_name << std::endl;
+
+    if (build_bitmaps)
+    {
+        std::string bitmap_file_name = bitmap_index_path_for(matrix.backing_path());
+        std::vector<std::string> skipped_columns;
+        std::cout << "Bitmap index file path: " << bitmap_file_name << std::endl;
+        if (!write_bitmap_index(matrix, bitmap_columns, thread_count, bitmap_file_name, skipped_columns))
+        {
+            std::cout << "Null output file pointer from path: " << bitmap_file_name << std::endl;
+            return 1;
+        }
+        for (size_t column_index = 0; column_index < skipped_columns.size(); column_index++)
+        {
+            std::cout << "Too many values to index column: " << skipped_columns[column_index] << std::endl;
+        }
+        double duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+        std::cout << "Duration/sec: " << duration_secs << std::endl;
+        return 0;
+    }
+
+    std::vector<column_condition> conditions;
+    for (size_t argument_index = 1; argument_index < arguments.size(); argument_index++)
+    {
+        if (!parse_column_condition(matrix, arguments[argument_index], conditions))
+        {
+            std::cout << "Invalid condition: " << arguments[argument_index] << std::endl;
+            return 1;
+        }
+    }
+    std::vector<long> select_columns;
+    std::stringstream select_items(select_specification);
+    std::string select_item;
+    while (std::getline(select_items, select_item, ','))
+    {
+        long column_index = matrix.column_index(select_item);
+        if (column_index < 0)
+        {
+            std::cout << "Unknown column: " << select_item << std::endl;
+            return 1;
+        }
+        select_columns.push_back(column_index);
+    }
+
+    // Find the rows.
+
+    progress << "Thread count: " << thread_count << std::endl;
+    std::chrono::steady_clock::time_point scan_clock = std::chrono::steady_clock::now();
+    std::vector<long> rows;
+    bitmap_index index;
+    bool from_bitmaps = use_bitmaps && index.open(bitmap_index_path_for(matrix.backing_path()), matrix.row_count(), matrix.column_count())
+        && bitmap_rows(matrix, index, conditions, any, rows);
+    long settled_block_count = from_bitmaps ? 0 : scan_rows(matrix, conditions, any, thread_count, rows);
+    double scan_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - scan_clock).count();
+    progress << "Row count: " << rows.size() << std::endl;
+    if (from_bitmaps)
+    {
+        progress << "Rows found with the bitmap index" << std::endl;
+    }
+    else if (matrix.has_zone_map())
+    {
+        progress << "Blocks skipped by the zone map: " << settled_block_count << " of " << zone_block_count(matrix.row_count()) << std::endl;
+    }
+
+    // Fetch the selected columns at those rows, the first result column being the row numbers themselves.
+
+    std::chrono::steady_clock::time_point gather_clock = std::chrono::steady_clock::now();
+    std::vector<std::string> result_column_names(1, "Row");
+    std::vector<std::vector<int> > result_columns(1 + select_columns.size());
+    result_columns[0].resize(rows.size());
+    for (size_t row_index = 0; row_index < rows.size(); row_index++)
+    {
+        result_columns[0][row_index] = int(rows[row_index] + 1);
+    }
+    for (size_t select_index = 0; select_index < select_columns.size(); select_index++)
+    {
+        result_column_names.push_back(matrix.column_name(select_columns[select_index]));
+        gather_column(matrix, select_columns[select_index], rows, thread_count, result_columns[select_index + 1]);
+    }
+    double gather_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - gather_clock).count();
+
+    if (!result_file_name.empty())
+    {
+        std::cout << "Result file path: " << result_file_name << std::endl;
+        if (!write_result_matrix(result_file_name, result_column_names, result_columns))
+        {
+            std::cout << "Null output file pointer from path: " << result_file_name << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        for (size_t column_index = 0; column_index < result_column_names.size(); column_index++)
+        {
+            fputs(column_index > 0 ? "," : "", stdout);
+            fputs(result_column_names[column_index].c_str(), stdout);
+        }
+        fputc('\n', stdout);
+        for (size_t row_index = 0; row_index < rows.size(); row_index++)
+        {
+            for (size_t column_index = 0; column_index < result_columns.size(); column_index++)
+            {
+                printf(column_index > 0 ? ",%d" : "%d", result_columns[column_index][row_index]);
+            }
+            fputc('\n', stdout);
+        }
+        fflush(stdout);
+    }
+
+    double duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+    double scanned_megabytes = double(matrix.row_count()) * matrix.element_size() * conditions.size() / 1e6;
+    if (from_bitmaps)
+    {
+        progress << "Index duration/sec: " << scan_seconds << std::endl;
+    }
+    else
+    {
+        progress << "Scan duration/sec: " << scan_seconds << " (" << scanned_megabytes / (scan_seconds > 0 ? scan_seconds : 1e-9) << " MB/s)" << std::endl;
+    }
+    progress << "Gather duration/sec: " << gather_seconds << std::endl;
+    progress << "Duration/sec: " << duration_secs << std::endl;
+    return 0;
+}
@@ -0,0 +1,649 @@
+// Sort the rows of a file-backed big.matrix, e.g. all.matrix, by a composite key of its columns,
+// e.g. (UniqueCarrier, Origin, Year, Month), writing the sorted rows as a new big.matrix.
+// all.matrix is in year and source line order, so a query on one carrier or one route touches every block;
+// sorted, the rows of a carrier lie together, and the zone maps (see zone_map.h) skip all the blocks of the others.
+
+// The sort is out of core, in a bounded memory budget (--memory=MB, 1024 by default):
+// - The key columns are codes and small integers, so the key of each row packs into one 64 bit integer,
+//   each column (less its smallest value, from the zone map or a scan) in as many bits as its range needs,
+//   the first key column in the highest bits.
+// - The rows are cut into runs that fit the budget. Each thread takes a run, packs the (key, row) pairs of its rows,
+//   sorts them with a least significant digit first radix sort, 8 bits at a time over the bits the key uses,
+//   and writes the sorted run to a temporary file.
+// - The runs are merged with a k-way merge into the permutation: the source row of every sorted row, in a second temporary file.
+// - Each thread then takes a column at a time and writes it in sorted order, gathering its values
+//   through the memory map of the source for one slice of the permutation at a time.
+// The sort is stable, rows with equal keys keep their order.
+
+// The typed groups written by map_fields --column-types=narrow are rows of the same matrix,
+// so several source descriptors may be given, each with its own destination, and the key columns may be in any of them:
+// every group is put in the order of the one permutation.
+// Each destination gets its descriptor (destination_filename.desc, as concat_matrices names it) and its zone map,
+// and if its source has a bitmap index (see bitmap_index.h) the same columns of the destination are indexed.
+
+// To compile this c++ program on linux:
+//     g++ -W -std=c++17 -O2 -pthread sort_matrix.cpp -o sort_matrix
+// Run it with:
+//     $ ./sort_matrix [--threads N] [--memory=MB] --by=column,... [source_descriptor_filename] [destination_filename] [source_descriptor_filename destination_filename]...
+// e.g.
+//     $ ./sort_matrix --threads 8 --memory=4096 --by=UniqueCarrier,Origin,Year,Month big_matrices/all.matrix.desc big_matrices/all_by_carrier.matrix
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bitmap_index.h"
+#include "group_aggregate.h"
+
+// The sort key of a row, and the row.
+struct key_row
+{
+    uint64_t key;
+    int64_t row;
+};
+
+inline bool operator>(const key_row& left, const key_row& right)
+{
+    return left.key != right.key ? left.key > right.key : left.row > right.row;
+}
+
+// A key column and where its bits go in the packed key.
+struct sort_key_column
+{
+    const mapped_big_matrix* matrix;
+    long column_index;
+    int min_value;
+    uint32_t range;     // The largest value less the smallest.
+    int shift;
+};
+
+// A matrix to sort and where its sorted rows go.
+struct sort_matrix_pair
+{
+    std::string descriptor_path;
+    std::string destination_path;
+    mapped_big_matrix matrix;
+    bool has_bitmaps;
+    std::string bitmap_columns;
+    zone_map_builder zones;
+    int file_descriptor;
+};
+
+bool write_all(int file_descriptor, const void* data, size_t size, off_t offset)
+{
+    const char* position = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        ssize_t written = pwrite(file_descriptor, position, size, offset);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        position += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool read_all(int file_descriptor, void* data, size_t size, off_t offset)
+{
+    char* position = static_cast<char*>(data);
+    while (size > 0)
+    {
+        ssize_t read_size = pread(file_descriptor, position, size, offset);
+        if (read_size < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (read_size <= 0)
+        {
+            return false;
+        }
+        position += read_size;
+        size -= read_size;
+        offset += read_size;
+    }
+    return true;
+}
+
+// Pack the keys of rows [first_row, first_row + row_count) into pairs.
+// False if a key value is outside the range its column was planned with.
+template <typename T>
+bool pack_key_column(const sort_key_column& key_column, long first_row, long row_count, std::vector<key_row>& pairs)
+{
+    const T* values = reinterpret_cast<const T*>(key_column.matrix->column_data(key_column.column_index)) + first_row;
+    uint32_t out_of_range = 0;
+    for (long row_index = 0; row_index < row_count; row_index++)
+    {
+        uint32_t offset = uint32_t(int(values[row_index])) - uint32_t(key_column.min_value);
+        out_of_range |= offset > key_column.range;
+        pairs[row_index].key |= uint64_t(offset) << key_column.shift;
+    }
+    return out_of_range == 0;
+}
+
+// Sort pairs by key with a least significant digit first radix sort, 8 bits at a time over the key's bits.
+// All the digit histograms come from one pass, and digits on which every key agrees are skipped.
+// Stable, so pairs of equal keys keep their row order.
+void radix_sort_pairs(std::vector<key_row>& pairs, std::vector<key_row>& scratch, int key_bits)
+{
+    const int digit_count = (key_bits + 7) / 8;
+    std::vector<size_t> counts(digit_count * 256, 0);
+    for (size_t pair_index = 0; pair_index < pairs.size(); pair_index++)
+    {
+        uint64_t key = pairs[pair_index].key;
+        for (int digit = 0; digit < digit_count; digit++)
+        {
+            counts[digit * 256 + ((key >> (digit * 8)) & 255)]++;
+        }
+    }
+    scratch.resize(pairs.size());
+    for (int digit = 0; digit < digit_count; digit++)
+    {
+        size_t* digit_counts = &counts[digit * 256];
+        if (*std::max_element(digit_counts, digit_counts + 256) == pairs.size())
+        {
+            continue;
+        }
+        size_t offsets[256];
+        size_t offset = 0;
+        for (int bucket = 0; bucket < 256; bucket++)
+        {
+            offsets[bucket] = offset;
+            offset += digit_counts[bucket];
+        }
+        for (size_t pair_index = 0; pair_index < pairs.size(); pair_index++)
+        {
+            scratch[offsets[(pairs[pair_index].key >> (digit * 8)) & 255]++] = pairs[pair_index];
+        }
+        pairs.swap(scratch);
+    }
+}
+
+// Write one column of a matrix in the order of the permutation, a slice of slice_rows rows at a time.
+template <typename T>
+bool write_sorted_column(sort_matrix_pair& pair, long column_index, int permutation_file, long slice_rows,
+                         std::vector<int64_t>& source_rows, std::vector<char>& buffer)
+{
+    const long row_count = pair.matrix.row_count();
+    const T* source = reinterpret_cast<const T*>(pair.matrix.column_data(column_index));
+    source_rows.resize(slice_rows);
+    buffer.resize(slice_rows * sizeof(T));
+    T* sorted = reinterpret_cast<T*>(&buffer[0]);
+    for (long first_row = 0; first_row < row_count; first_row += slice_rows)
+    {
+        long rows = std::min(slice_rows, row_count - first_row);
+        if (!read_all(permutation_file, &source_rows[0], rows * sizeof(int64_t), first_row * sizeof(int64_t)))
+        {
+            return false;
+        }
+        for (long row_index = 0; row_index < rows; row_index++)
+        {
+            sorted[row_index] = source[source_rows[row_index]];
+        }
+        pair.zones.record(column_index, first_row, sorted, rows);
+        if (!write_all(pair.file_descriptor, sorted, rows * sizeof(T), ((off_t)column_index * row_count + first_row) * sizeof(T)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int thread_count = 1;
+    long memory_megabytes = 1024;
+    std::string key_specification;
+    std::vector<char*> arguments;
+    for (int argument_index = 1; argument_index < argc; argument_index++)
+    {
+        std::string argument = argv[argument_index];
+        if (argument == "--threads" && argument_index + 1 < argc)
+        {
+            argument = std::string("--threads=") + argv[++argument_index];
+        }
+        if (argument.compare(0, 10, "--threads=") == 0)
+        {
+            thread_count = atoi(argument.c_str() + 10);
+            if (thread_count < 1)
+            {
+                std::cout << "Invalid thread count: " << argument << std::endl;
+                return 1;
+            }
+        }
+        else if (argument.compare(0, 9, "--memory=") == 0)
+        {
+            memory_megabytes = atol(argument.c_str() + 9);
+            if (memory_megabytes < 1)
+            {
+                std::cout << "Invalid memory budget: " << argument << std::endl;
+                return 1;
+            }
+        }
+        else if (argument.compare(0, 5, "--by=") == 0)
+        {
+            key_specification = argument.substr(5);
+        }
+        else if (argument.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option: " << argument << std::endl;
+            return 1;
+        }
+        else
+        {
+            arguments.push_back(argv[argument_index]);
+        }
+    }
+
+    if (key_specification.empty() || arguments.size() < 2 || arguments.size() % 2 != 0)
+    {
+        std::cout << "Use: ./sort_matrix [--threads N] [--memory=MB] --by=column,... [source_descriptor_filename] [destination_filename] [source_descriptor_filename destination_filename]..." << std::endl;
+        return 1;
+    }
+
+    // Attach the source matrices, which must be rows of the same matrix.
+
+    std::chrono::steady_clock::time_point start_clock = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<sort_matrix_pair> > pairs;
+    std::string error;
+    for (size_t argument_index = 0; argument_index < arguments.size(); argument_index += 2)
+    {
+        pairs.push_back(std::unique_ptr<sort_matrix_pair>(new sort_matrix_pair()));
+        sort_matrix_pair& pair = *pairs.back();
+        pair.descriptor_path = arguments[argument_index];
+        pair.destination_path = arguments[argument_index + 1];
+        pair.file_descriptor = -1;
+        if (!pair.matrix.open(pair.descriptor_path, error))
+        {
+            std::cout << "Invalid descriptor file " << pair.descriptor_path << ": " << error << std::endl;
+            return 1;
+        }
+        if (pair.matrix.row_count() != pairs[0]->matrix.row_count())
+        {
+            std::cout << "Descriptor file " << pair.descriptor_path << " has " << pair.matrix.row_count()
+                << " rows, " << pairs[0]->descriptor_path << " has " << pairs[0]->matrix.row_count() << std::endl;
+            return 1;
+        }
+        std::cout << "Source: " << pair.matrix.backing_path() << ", columns: " << pair.matrix.column_count()
+            << ", type: " << pair.matrix.descriptor().type_name << std::endl;
+
+        // The destination file is truncated, so it must not be the file the rows are read from.
+        struct stat source_status;
+        struct stat destination_status;
+        if (stat(pair.destination_path.c_str(), &destination_status) == 0)
+        {
+            for (size_t pair_index = 0; pair_index < pairs.size(); pair_index++)
+            {
+                if (stat(pairs[pair_index]->matrix.backing_path().c_str(), &source_status) == 0
+                    && source_status.st_dev == destination_status.st_dev && source_status.st_ino == destination_status.st_ino)
+                {
+                    std::cout << "The destination file is a source backing file: " << pair.destination_path << std::endl;
+                    return 1;
+                }
+            }
+        }
+
+        // The columns of a bitmap index are indexed again in the sorted matrix.
+        bitmap_index index;
+        pair.has_bitmaps = index.open(bitmap_index_path_for(pair.matrix.backing_path()), pair.matrix.row_count(), pair.matrix.column_count());
+        std::vector<long> indexed_columns = index.column_indexes();
+        for (size_t index_column = 0; index_column < indexed_columns.size(); index_column++)
+        {
+            pair.bitmap_columns += (index_column > 0 ? "," : "") + std::to_string(indexed_columns[index_column] + 1);
+        }
+    }
+    const long row_count = pairs[0]->matrix.row_count();
+    std::cout << "Row count: " << row_count << std::endl;
+    std::cout << "Thread count: " << thread_count << ", memory budget: " << memory_megabytes << "MB" << std::endl;
+
+    // Plan the packed key, the first key column in the highest bits.
+
+    std::vector<sort_key_column> key_columns;
+    std::stringstream key_items(key_specification);
+    std::string key_item;
+    while (std::getline(key_items, key_item, ','))
+    {
+        sort_key_column key_column = {NULL, -1, 0, 0, 0};
+        for (size_t pair_index = 0; pair_index < pairs.size() && key_column.matrix == NULL; pair_index++)
+        {
+            key_column.column_index = pairs[pair_index]->matrix.column_index(key_item);
+            key_column.matrix = key_column.column_index >= 0 ? &pairs[pair_index]->matrix : NULL;
+        }
+        if (key_column.matrix == NULL)
+        {
+            std::cout << "Unknown column: " << key_item << std::endl;
+            return 1;
+        }
+        int max_value;
+        column_value_range(*key_column.matrix, key_column.column_index, thread_count, key_column.min_value, max_value);
+        key_column.range = row_count > 0 ? uint32_t(max_value) - uint32_t(key_column.min_value) : 0;
+        key_columns.push_back(key_column);
+        std::cout << "Key column: " << key_item << ", values " << (row_count > 0 ? key_column.min_value : 0)
+            << " to " << (row_count > 0 ? max_value : 0) << std::endl;
+    }
+    int key_bits = 0;
+    for (long key_index = key_columns.size() - 1; key_index >= 0; key_index--)
+    {
+        key_columns[key_index].shift = key_bits;
+        key_bits += key_columns[key_index].range == 0 ? 0 : 32 - __builtin_clz(key_columns[key_index].range);
+    }
+    if (key_bits > 64)
+    {
+        std::cout << "The key columns need " << key_bits << " bits, more than the 64 of a packed key: use fewer or narrower key columns" << std::endl;
+        return 1;
+    }
+    std::cout << "Key bits: " << key_bits << std::endl;
+
+    // Sort runs of rows that fit the budget, each thread holding a run and its radix sort scratch at a time.
+
+    const long budget_bytes = memory_megabytes << 20;
+    const long run_rows = std::max(long(zone_block_row_count), budget_bytes / (2 * long(sizeof(key_row)) * thread_count));
+    const long run_count = (row_count + run_rows - 1) / run_rows;
+    std::string runs_file_name = pairs[0]->destination_path + ".runs";
+    std::string permutation_file_name = pairs[0]->destination_path + ".permutation";
+    int runs_file = open(runs_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int permutation_file = open(permutation_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (runs_file < 0 || permutation_file < 0)
+    {
+        std::cout << "Null output file pointer from path: " << (runs_file < 0 ? runs_file_name : permutation_file_name) << std::endl;
+        return 1;
+    }
+    // The temporary files are only needed while they are open.
+    unlink(runs_file_name.c_str());
+    unlink(permutation_file_name.c_str());
+
+    std::atomic<long> next_run(0);
+    std::atomic<bool> failed(false);
+    std::atomic<bool> out_of_range(false);
+    std::vector<std::thread> workers;
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            std::vector<key_row> run_pairs;
+            std::vector<key_row> scratch;
+            long run_index;
+            while (!failed && (run_index = next_run.fetch_add(1)) < run_count)
+            {
+                long first_row = run_index * run_rows;
+                long rows = std::min(run_rows, row_count - first_row);
+                run_pairs.resize(rows);
+                for (long row_index = 0; row_index < rows; row_index++)
+                {
+                    run_pairs[row_index].key = 0;
+                    run_pairs[row_index].row = first_row + row_index;
+                }
+                for (size_t key_index = 0; key_index < key_columns.size(); key_index++)
+                {
+                    bool in_range;
+                    switch (key_columns[key_index].matrix->element_size())
+                    {
+                    case 1:
+                        in_range = pack_key_column<int8_t>(key_columns[key_index], first_row, rows, run_pairs);
+                        break;
+                    case 2:
+                        in_range = pack_key_column<int16_t>(key_columns[key_index], first_row, rows, run_pairs);
+                        break;
+                    default:
+                        in_range = pack_key_column<int32_t>(key_columns[key_index], first_row, rows, run_pairs);
+                        break;
+                    }
+                    if (!in_range)
+                    {
+                        out_of_range = true;
+                        failed = true;
+                    }
+                }
+                radix_sort_pairs(run_pairs, scratch, key_bits);
+                if (!write_all(runs_file, &run_pairs[0], rows * sizeof(key_row), (off_t)first_row * sizeof(key_row)))
+                {
+                    failed = true;
+                }
+            }
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+    }
+    workers.clear();
+    if (out_of_range)
+    {
+        std::cout << "A key column holds values outside the range of its zone map, which no longer matches the matrix" << std::endl;
+        return 1;
+    }
+    if (failed)
+    {
+        std::cout << "Failed to write the sorted runs: " << runs_file_name << std::endl;
+        return 1;
+    }
+    double run_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+    std::cout << "Run count: " << run_count << ", rows per run: " << run_rows << std::endl;
+
+    // Merge the runs into the permutation, each run read through its own buffer, half the budget between them.
+
+    std::chrono::steady_clock::time_point merge_clock = std::chrono::steady_clock::now();
+    const long run_buffer_pairs = std::max(4096L, budget_bytes / 2 / long(sizeof(key_row)) / std::max(run_count, 1L));
+    const long output_buffer_rows = std::max(4096L, budget_bytes / 4 / long(sizeof(int64_t)));
+    std::vector<std::vector<key_row> > run_buffers(run_count);
+    std::vector<long> run_positions(run_count, 0);      // The pairs of each run merged or buffered so far.
+    std::vector<size_t> buffer_positions(run_count, 0);
+    auto fill_run_buffer = [&](long run_index) -> bool
+    {
+        long first_row = run_index * run_rows;
+        long pairs_left = std::min(run_rows, row_count - first_row) - run_positions[run_index];
+        run_buffers[run_index].resize(std::min(run_buffer_pairs, pairs_left));
+        buffer_positions[run_index] = 0;
+        if (!read_all(runs_file, &run_buffers[run_index][0], run_buffers[run_index].size() * sizeof(key_row),
+                      ((off_t)first_row + run_positions[run_index]) * sizeof(key_row)))
+        {
+            return false;
+        }
+        run_positions[run_index] += run_buffers[run_index].size();
+        return true;
+    };
+    typedef std::pair<key_row, long> merge_head;
+    auto later = [](const merge_head& left, const merge_head& right) { return left.first > right.first; };
+    std::priority_queue<merge_head, std::vector<merge_head>, decltype(later)> heads(later);
+    for (long run_index = 0; run_index < run_count; run_index++)
+    {
+        if (!fill_run_buffer(run_index))
+        {
+            std::cout << "Failed to read the sorted runs: " << runs_file_name << std::endl;
+            return 1;
+        }
+        heads.push(merge_head(run_buffers[run_index][buffer_positions[run_index]++], run_index));
+    }
+    std::vector<int64_t> output_rows;
+    output_rows.reserve(output_buffer_rows);
+    long merged_rows = 0;
+    while (!heads.empty())
+    {
+        long run_index = heads.top().second;
+        output_rows.push_back(heads.top().first.row);
+        heads.pop();
+        if (buffer_positions[run_index] == run_buffers[run_index].size()
+            && run_positions[run_index] < std::min(run_rows, row_count - run_index * run_rows) && !fill_run_buffer(run_index))
+        {
+            std::cout << "Failed to read the sorted runs: " << runs_file_name << std::endl;
+            return 1;
+        }
+        if (buffer_positions[run_index] < run_buffers[run_index].size())
+        {
+            heads.push(merge_head(run_buffers[run_index][buffer_positions[run_index]++], run_index));
+        }
+        if ((long)output_rows.size() == output_buffer_rows || heads.empty())
+        {
+            if (!write_all(permutation_file, &output_rows[0], output_rows.size() * sizeof(int64_t), (off_t)merged_rows * sizeof(int64_t)))
+            {
+                std::cout << "Failed to write the permutation: " << permutation_file_name << std::endl;
+                return 1;
+            }
+            merged_rows += output_rows.size();
+            output_rows.clear();
+        }
+    }
+    close(runs_file);
+    run_buffers.clear();
+    output_rows = std::vector<int64_t>();
+    double merge_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - merge_clock).count();
+
+    // Write the destination matrices a column at a time in the sorted order.
+
+    std::chrono::steady_clock::time_point write_clock = std::chrono::steady_clock::now();
+    std::vector<std::pair<size_t, long> > columns;
+    off_t destination_size = 0;
+    for (size_t pair_index = 0; pair_index < pairs.size(); pair_index++)
+    {
+        sort_matrix_pair& pair = *pairs[pair_index];
+        std::cout << "Destination file path: " << pair.destination_path << std::endl;
+        pair.file_descriptor = open(pair.destination_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (pair.file_descriptor < 0)
+        {
+            std::cout << "Null output file pointer from path: " << pair.destination_path << std::endl;
+            return 1;
+        }
+        off_t size = (off_t)row_count * pair.matrix.column_count() * pair.matrix.element_size();
+        int allocation_status = size > 0 ? posix_fallocate(pair.file_descriptor, 0, size) : 0;
+        if (allocation_status != 0 && ftruncate(pair.file_descriptor, size) != 0)
+        {
+            std::cout << "Failed to allocate " << size << " bytes for: " << pair.destination_path << std::endl;
+            return 1;
+        }
+        destination_size += size;
+        zone_map_header header;
+        std::vector<zone_record> records;
+        int missing_value = read_zone_map(zone_map_path_for(pair.matrix.backing_path()), row_count, pair.matrix.column_count(), header, records)
+            ? header.missing_value : -1;
+        pair.zones.reset(row_count, pair.matrix.column_count(), missing_value);
+        for (long column_index = 0; column_index < pair.matrix.column_count(); column_index++)
+        {
+            columns.push_back(std::make_pair(pair_index, column_index));
+        }
+    }
+
+    // Each thread gathers a slice of rows of a column at a time, its share of the budget
+    // holding the slice of the permutation and the sorted values.
+    const long slice_rows = std::max(4096L, budget_bytes / thread_count / long(sizeof(int64_t) + sizeof(int32_t)));
+    std::atomic<size_t> next_column(0);
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            std::vector<int64_t> source_rows;
+            std::vector<char> buffer;
+            size_t column;
+            while (!failed && (column = next_column.fetch_add(1)) < columns.size())
+            {
+                sort_matrix_pair& pair = *pairs[columns[column].first];
+                long column_index = columns[column].second;
+                bool written;
+                switch (pair.matrix.element_size())
+                {
+                case 1:
+                    written = write_sorted_column<int8_t>(pair, column_index, permutation_file, slice_rows, source_rows, buffer);
+                    break;
+                case 2:
+                    written = write_sorted_column<int16_t>(pair, column_index, permutation_file, slice_rows, source_rows, buffer);
+                    break;
+                default:
+                    written = write_sorted_column<int32_t>(pair, column_index, permutation_file, slice_rows, source_rows, buffer);
+                    break;
+                }
+                if (!written)
+                {
+                    failed = true;
+                }
+            }
+        }));
+    }
+    for (int thread_index = 0; thread_index < thread_count; thread_index++)
+    {
+        workers[thread_index].join();
+    }
+    close(permutation_file);
+    for (size_t pair_index = 0; pair_index < pairs.size(); pair_index++)
+    {
+        if (close(pairs[pair_index]->file_descriptor) != 0)
+        {
+            failed = true;
+        }
+    }
+    if (failed)
+    {
+        std::cout << "Failed to write the sorted matrices" << std::endl;
+        return 1;
+    }
+    double write_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - write_clock).count();
+
+    // The descriptors, zone maps and bitmap indexes of the sorted matrices.
+
+    for (size_t pair_index = 0; pair_index < pairs.size(); pair_index++)
+    {
+        sort_matrix_pair& pair = *pairs[pair_index];
+        std::string descriptor_file_name = pair.destination_path + ".desc";
+        std::cout << "Descriptor file path: " << descriptor_file_name << std::endl;
+        std::vector<std::string> column_names;
+        for (long column_index = 0; column_index < pair.matrix.column_count(); column_index++)
+        {
+            column_names.push_back(pair.matrix.column_name(column_index));
+        }
+        if (!write_big_matrix_descriptor(descriptor_file_name, pair.destination_path, row_count, column_names,
+                                         pair.matrix.descriptor().type_name.c_str()))
+        {
+            std::cout << "Null output file pointer from path: " << descriptor_file_name << std::endl;
+            return 1;
+        }
+        std::string zone_map_file_name = zone_map_path_for(pair.destination_path);
+        std::cout << "Zone map file path: " << zone_map_file_name << std::endl;
+        if (!pair.zones.write(zone_map_file_name))
+        {
+            std::cout << "Null output file pointer from path: " << zone_map_file_name << std::endl;
+            return 1;
+        }
+        std::string bitmap_file_name = bitmap_index_path_for(pair.destination_path);
+        unlink(bitmap_file_name.c_str());
+        if (pair.has_bitmaps)
+        {
+            std::vector<std::string> skipped_columns;
+            std::cout << "Bitmap index file path: " << bitmap_file_name << std::endl;
+            if (!build_bitmap_index_for(descriptor_file_name, pair.bitmap_columns, thread_count, bitmap_file_name, skipped_columns))
+            {
+                std::cout << "Null output file pointer from path: " << bitmap_file_name << std::endl;
+                return 1;
+            }
+            for (size_t column_index = 0; column_index < skipped_columns.size(); column_index++)
+            {
+                std::cout << "Too many values to index column: " << skipped_columns[column_index] << std::endl;
+            }
+        }
+    }
+
+    double duration_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_clock).count();
+    printf ("Run sort duration/sec: %.3f\n", run_secs);
+    printf ("Merge duration/sec: %.3f\n", merge_secs);
+    printf ("Write duration/sec: %.3f (%.1f MB/s)\n", write_secs, destination_size / 1e6 / (write_secs > 0 ? write_secs : 1e-9));
+    printf ("Duration/sec: %.3f\n", duration_secs);
+    return 0;
+}
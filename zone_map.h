@@ -0,0 +1,312 @@
+// Zone maps of file-backed big.matrices: the smallest value, the largest value and the count of missing values
+// of every block of zone_block_row_count rows of every column, kept in a sidecar file next to the backing file
+// (all.matrix -> all.matrix.zones). A scan skips a block outright when its value range cannot meet a condition,
+// e.g. ActualElapsedTime >= 1800 in a block whose longest flight is 900 minutes.
+
+// The blocks are aligned to the rows of the matrix, block b holding rows b * zone_block_row_count onwards,
+// so the statistics gathered by separate writers of one matrix (threads, or the processes of map_fields --layout)
+// merge exactly: the minimum of the minimums, the maximum of the maximums and the sum of the counts.
+// Each record also counts the rows it has seen, so a block that is not yet completely written is never used to skip.
+// The missing value is compared like any other value, as mwhich() does, so it is inside the range of its block.
+
+// The sidecar file is a zone_map_header followed by the records, column by column, each column block_count() records long.
+
+// Used from map_string_fields.cpp, concat_matrices.cpp and column_scan.h.
+
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Rows per zone, which is also the block size of the scans in column_scan.h.
+const long zone_block_row_count = 65536;
+
+struct zone_record
+{
+    int32_t min_value;
+    int32_t max_value;
+    uint32_t missing_count;
+    uint32_t row_count;     // The rows of the block seen so far.
+};
+
+struct zone_map_header
+{
+    char magic[8];          // "ZONEMAP1"
+    int64_t row_count;
+    int64_t column_count;
+    int64_t block_row_count;
+    int32_t missing_value;
+    int32_t reserved;
+};
+
+const char zone_map_magic[8] = {'Z', 'O', 'N', 'E', 'M', 'A', 'P', '1'};
+
+// The sidecar file path of a backing file: all.matrix -> all.matrix.zones
+inline std::string zone_map_path_for(const std::string& backing_file_path)
+{
+    return backing_file_path + ".zones";
+}
+
+inline long zone_block_count(long row_count)
+{
+    return (row_count + zone_block_row_count - 1) / zone_block_row_count;
+}
+
+// The rows in a block, zone_block_row_count except maybe for the last block.
+inline long zone_block_rows(long row_count, long block_index)
+{
+    long first_row = block_index * zone_block_row_count;
+    return row_count - first_row < zone_block_row_count ? row_count - first_row : zone_block_row_count;
+}
+
+inline zone_record empty_zone_record()
+{
+    zone_record record = {INT_MAX, INT_MIN, 0, 0};
+    return record;
+}
+
+inline void merge_zone_record(zone_record& into, const zone_record& from)
+{
+    into.min_value = from.min_value < into.min_value ? from.min_value : into.min_value;
+    into.max_value = from.max_value > into.max_value ? from.max_value : into.max_value;
+    into.missing_count += from.missing_count;
+    into.row_count += from.row_count;
+}
+
+// Gathers the zone map of a matrix as its column segments are written, from any number of threads at once.
+// Each segment is summarized on its own, then merged into the shared records with atomic operations.
+class zone_map_builder
+{
+public:
+    zone_map_builder() : m_row_count(0), m_column_count(0), m_block_count(0), m_missing_value(0) {}
+
+    void reset(long row_count, long column_count, int missing_value)
+    {
+        m_row_count = row_count;
+        m_column_count = column_count;
+        m_block_count = zone_block_count(row_count);
+        m_missing_value = missing_value;
+        m_records.reset(new shared_zone_record[m_block_count * column_count]);
+        for (long record_index = 0; record_index < m_block_count * column_count; record_index++)
+        {
+            m_records[record_index].min_value = INT_MAX;
+            m_records[record_index].max_value = INT_MIN;
+            m_records[record_index].missing_count = 0;
+            m_records[record_index].row_count = 0;
+        }
+    }
+
+    // Record value_count values of a column, as written starting at first_row.
+    template <typename T>
+    void record(long column_index, long first_row, const T* values, long value_count)
+    {
+        while (value_count > 0)
+        {
+            long block_index = first_row / zone_block_row_count;
+            long block_end = (block_index + 1) * zone_block_row_count;
+            long count = block_end - first_row < value_count ? block_end - first_row : value_count;
+            T min_value = values[0];
+            T max_value = values[0];
+            uint32_t missing_count = 0;
+            for (long index = 0; index < count; index++)
+            {
+                T value = values[index];
+                min_value = value < min_value ? value : min_value;
+                max_value = value > max_value ? value : max_value;
+                missing_count += (value == m_missing_value);
+            }
+
+            shared_zone_record& shared = m_records[column_index * m_block_count + block_index];
+            int current = shared.min_value.load(std::memory_order_relaxed);
+            while (min_value < current && !shared.min_value.compare_exchange_weak(current, min_value, std::memory_order_relaxed))
+            {
+            }
+            current = shared.max_value.load(std::memory_order_relaxed);
+            while (max_value > current && !shared.max_value.compare_exchange_weak(current, max_value, std::memory_order_relaxed))
+            {
+            }
+            shared.missing_count.fetch_add(missing_count, std::memory_order_relaxed);
+            shared.row_count.fetch_add(count, std::memory_order_relaxed);
+
+            values += count;
+            first_row += count;
+            value_count -= count;
+        }
+    }
+
+    // The records of the blocks from first_block to end_block of one column.
+    void get_records(long column_index, long first_block, long end_block, zone_record* records) const
+    {
+        for (long block_index = first_block; block_index < end_block; block_index++)
+        {
+            const shared_zone_record& shared = m_records[column_index * m_block_count + block_index];
+            zone_record& record = records[block_index - first_block];
+            record.min_value = shared.min_value.load(std::memory_order_relaxed);
+            record.max_value = shared.max_value.load(std::memory_order_relaxed);
+            record.missing_count = shared.missing_count.load(std::memory_order_relaxed);
+            record.row_count = shared.row_count.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Write the whole zone map file.
+    bool write(const std::string& zone_map_file_name) const
+    {
+        int file_descriptor = ::open(zone_map_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file_descriptor < 0)
+        {
+            return false;
+        }
+        zone_map_header header = make_header();
+        std::vector<zone_record> records(m_block_count > 0 ? m_block_count : 1);
+        bool ok = write_all(file_descriptor, &header, sizeof(header), 0);
+        for (long column_index = 0; column_index < m_column_count && ok; column_index++)
+        {
+            get_records(column_index, 0, m_block_count, &records[0]);
+            ok = write_all(file_descriptor, &records[0], m_block_count * sizeof(zone_record), record_offset(column_index, 0));
+        }
+        return (::close(file_descriptor) == 0) && ok;
+    }
+
+    // Merge the records of the blocks holding rows first_row to first_row + row_count into an existing zone map file
+    // shared with other writers of the same matrix, e.g. created by map_fields --plan-combined.
+    // The records are locked with fcntl() while they are read, merged and written back,
+    // as the first and last blocks may also hold the rows of the neighbouring writers.
+    bool merge_into_file(const std::string& zone_map_file_name, long first_row, long row_count) const
+    {
+        if (row_count <= 0)
+        {
+            return true;
+        }
+        int file_descriptor = ::open(zone_map_file_name.c_str(), O_RDWR);
+        if (file_descriptor < 0)
+        {
+            return false;
+        }
+        zone_map_header header;
+        zone_map_header expected = make_header();
+        bool ok = pread(file_descriptor, &header, sizeof(header), 0) == sizeof(header) && memcmp(&header, &expected, sizeof(header)) == 0;
+
+        long first_block = first_row / zone_block_row_count;
+        long end_block = (first_row + row_count - 1) / zone_block_row_count + 1;
+        size_t size = (end_block - first_block) * sizeof(zone_record);
+        std::vector<zone_record> records(end_block - first_block);
+        std::vector<zone_record> file_records(end_block - first_block);
+        for (long column_index = 0; column_index < m_column_count && ok; column_index++)
+        {
+            struct flock lock;
+            memset(&lock, 0, sizeof(lock));
+            lock.l_type = F_WRLCK;
+            lock.l_whence = SEEK_SET;
+            lock.l_start = record_offset(column_index, first_block);
+            lock.l_len = size;
+            while (!(ok = fcntl(file_descriptor, F_SETLKW, &lock) == 0) && errno == EINTR)
+            {
+            }
+            if (!ok)
+            {
+                break;
+            }
+            get_records(column_index, first_block, end_block, &records[0]);
+            ok = pread(file_descriptor, &file_records[0], size, lock.l_start) == (ssize_t)size;
+            for (long block_index = 0; block_index < end_block - first_block && ok; block_index++)
+            {
+                merge_zone_record(file_records[block_index], records[block_index]);
+            }
+            ok = ok && write_all(file_descriptor, &file_records[0], size, lock.l_start);
+            lock.l_type = F_UNLCK;
+            fcntl(file_descriptor, F_SETLK, &lock);
+        }
+        return (::close(file_descriptor) == 0) && ok;
+    }
+
+    long row_count() const { return m_row_count; }
+    long column_count() const { return m_column_count; }
+    long block_count() const { return m_block_count; }
+
+private:
+    struct shared_zone_record
+    {
+        std::atomic<int> min_value;
+        std::atomic<int> max_value;
+        std::atomic<uint32_t> missing_count;
+        std::atomic<uint32_t> row_count;
+    };
+
+    zone_map_header make_header() const
+    {
+        zone_map_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, zone_map_magic, sizeof(header.magic));
+        header.row_count = m_row_count;
+        header.column_count = m_column_count;
+        header.block_row_count = zone_block_row_count;
+        header.missing_value = m_missing_value;
+        return header;
+    }
+
+    off_t record_offset(long column_index, long block_index) const
+    {
+        return sizeof(zone_map_header) + ((off_t)column_index * m_block_count + block_index) * sizeof(zone_record);
+    }
+
+    static bool write_all(int file_descriptor, const void* data, size_t size, off_t offset)
+    {
+        const char* position = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            ssize_t written = pwrite(file_descriptor, position, size, offset);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return false;
+            }
+            position += written;
+            size -= written;
+            offset += written;
+        }
+        return true;
+    }
+
+    long m_row_count;
+    long m_column_count;
+    long m_block_count;
+    int m_missing_value;
+    std::unique_ptr<shared_zone_record[]> m_records;
+};
+
+// Read a zone map file, which must describe a matrix of row_count rows and column_count columns.
+inline bool read_zone_map(const std::string& zone_map_file_name, long row_count, long column_count,
+                          zone_map_header& header, std::vector<zone_record>& records)
+{
+    int file_descriptor = ::open(zone_map_file_name.c_str(), O_RDONLY);
+    if (file_descriptor < 0)
+    {
+        return false;
+    }
+    bool ok = pread(file_descriptor, &header, sizeof(header), 0) == sizeof(header)
+        && memcmp(header.magic, zone_map_magic, sizeof(header.magic)) == 0
+        && header.row_count == row_count && header.column_count == column_count && header.block_row_count == zone_block_row_count;
+    if (ok)
+    {
+        records.resize(zone_block_count(row_count) * column_count);
+        size_t size = records.size() * sizeof(zone_record);
+        ok = records.empty() || pread(file_descriptor, &records[0], size, sizeof(header)) == (ssize_t)size;
+    }
+    ::close(file_descriptor);
+    return ok;
+}
+
+#endif // ZONE_MAP_H